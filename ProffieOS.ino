@@ -320,6 +320,24 @@ const char* next_current_directory(const char* dir) {
   if (!*dir) return NULL;
   return dir;
 }
+// Converts a preset font, like "font;common/", into a search path list.
+// |dest| needs room for strlen(font) + 2 characters.
+void MakeDirectoryList(char* dest, const char* font) {
+  for (const char *a = font; *a; a++) {
+    // Skip trailing slash
+    if (*a == '/' && (a[1] == 0 || a[1] == ';'))
+      continue;
+    if (*a == ';') {
+      *(dest++) = 0;
+      continue;
+    }
+    *(dest++) = *a;
+  }
+  // Two zeroes at end!
+  *(dest++) = 0;
+  *(dest++) = 0;
+}
+
 const char* last_current_directory() {
   const char* ret = current_directory;
   while (true) {
@@ -573,6 +591,7 @@ const char* GetSaveDir() {
 
 PROP_TYPE prop;
 
+#include "common/motion_trace.h"
 
 #include "buttons/button.h"
 
@@ -724,6 +743,10 @@ class Commands : public CommandParser {
       STDOUT.println(beeper.isPlaying() ? "On" : "Off");
       STDOUT.print("Talker: ");
       STDOUT.println(talkie.isPlaying() ? "On" : "Off");
+      STDOUT.print("Mixer active streams: ");
+      STDOUT.println(dynamic_mixer.active_streams());
+      STDOUT << "Wav file reads: " << PlayWav::file_reads_
+             << " underflows: " << dynamic_mixer.underflow_count_.get() << "\n";
       for (size_t i = 0; i < NELEM(wav_players); i++) {
 	       STDOUT << "Wav player " << i << ": "
                 << (wav_players[i].isPlaying() ? "On" : "Off")
@@ -731,6 +754,8 @@ class Commands : public CommandParser {
                 << " volume = " << wav_players[i].volume()
                 << " refs = " << wav_players[i].refs()
                 << " fade speed = " << wav_players[i].fade_speed()
+                << " buffer = " << wav_players[i].buffer_size()
+                << " read = " << wav_players[i].read_size()
                 << " filename=" << wav_players[i].filename() << ")\n";
       }
       return true;
@@ -938,6 +963,9 @@ class Commands : public CommandParser {
         audio_dma_interrupt_cycles.Print(DoWhatToProbe::print_frequency); STDOUT.println(" Audio DMA ISR");  // report frequency for ISRs
         wav_interrupt_cycles.Print(DoWhatToProbe::print_frequency); STDOUT.println(" WAV Reader ISR"); 
         pixel_dma_interrupt_cycles.Print(DoWhatToProbe::print_frequency); STDOUT.println(" Pixel ISR"); 
+        #if POST_MIX_DSP
+        post_mix_cycles.Print(DoWhatToProbe::print_frequency); STDOUT.println(" Post-mix DSP");
+        #endif
         motion_interrupt_cycles.Print(DoWhatToProbe::print_frequency); STDOUT.println(" Motion ISR"); 
         Looper::DoProbe(DoWhatToProbe::print_frequency);  // Call .Print() on all looper's probes                                                                                // report frequency for all loopers
         // 3. Report runtimes
@@ -945,6 +973,9 @@ class Commands : public CommandParser {
         audio_dma_interrupt_cycles.Print(DoWhatToProbe::print_duration); STDOUT.println(" Audio DMA ISR");  // report frequency for ISRs
         wav_interrupt_cycles.Print(DoWhatToProbe::print_duration); STDOUT.println(" WAV Reader ISR"); 
         pixel_dma_interrupt_cycles.Print(DoWhatToProbe::print_duration); STDOUT.println(" Pixel ISR"); 
+        #if POST_MIX_DSP
+        post_mix_cycles.Print(DoWhatToProbe::print_duration); STDOUT.println(" Post-mix DSP");
+        #endif
         motion_interrupt_cycles.Print(DoWhatToProbe::print_duration); STDOUT.println(" Motion ISR"); 
         Looper::DoProbe(DoWhatToProbe::print_duration); 
         // 4. Report CPU usage
@@ -952,8 +983,18 @@ class Commands : public CommandParser {
         audio_dma_interrupt_cycles.Print(DoWhatToProbe::print_cpu_usage); STDOUT.println(" Audio DMA ISR");  // report frequency for ISRs
         wav_interrupt_cycles.Print(DoWhatToProbe::print_cpu_usage); STDOUT.println(" WAV Reader ISR"); 
         pixel_dma_interrupt_cycles.Print(DoWhatToProbe::print_cpu_usage); STDOUT.println(" Pixel ISR"); 
+        #if POST_MIX_DSP
+        post_mix_cycles.Print(DoWhatToProbe::print_cpu_usage); STDOUT.println(" Post-mix DSP");
+        #endif
         motion_interrupt_cycles.Print(DoWhatToProbe::print_cpu_usage); STDOUT.println(" Motion ISR"); 
         Looper::DoProbe(DoWhatToProbe::print_cpu_usage); 
+        #ifdef ENABLE_AUDIO
+        STDOUT.print("Audio fill margin [ms]: min="); STDOUT.print(AudioStreamWork::fill_margin.min * 1000.0f / AUDIO_RATE);
+        STDOUT.print(" avg="); STDOUT.println(AudioStreamWork::fill_margin.avg * 1000.0f / AUDIO_RATE);
+        #ifdef ARDUINO_ARCH_ESP32   // ESP architecture
+        STDOUT.print("Audio fill task free stack [bytes]: "); STDOUT.println(AudioStreamWork::fill_task_stack_free());
+        #endif
+        #endif
         // 5. Report loop counters
         SaberBase::DoTop(0);  // original DoTop needed total cycles to make calculations, we send 0 to keep backward compatibility
         // 6. Reset probes
@@ -963,6 +1004,12 @@ class Commands : public CommandParser {
         wav_interrupt_cycles.Reset();
         pixel_dma_interrupt_cycles.Reset();
         motion_interrupt_cycles.Reset();
+        #ifdef ENABLE_AUDIO
+        #if POST_MIX_DSP
+        post_mix_cycles.Reset();
+        #endif
+        AudioStreamWork::fill_margin.Reset();
+        #endif
         interrupts();
         STDOUT.println("-> CPU probes reset.");
         STDOUT.println("");
@@ -1069,6 +1116,9 @@ class Commands : public CommandParser {
       if (!strcmp(cmd, "dumpwav")) {
         int16_t tmp[32];
         wav_players[0].Stop();
+    #if WAV_BUFFER_POOL
+        if (!SetupPooledWavPlayerBuffers(wav_players, false)) return true;
+    #endif
         wav_players[0].read(tmp, NELEM(tmp));
         wav_players[0].Play(e);
         for (int j = 0; j < 64; j++) {
@@ -1097,6 +1147,69 @@ class Commands : public CommandParser {
 
   #endif // ENABLE_DEVELOPER_COMMANDS
 
+  #ifdef ENABLE_DIAGNOSE_COMMANDS
+      // Print per-player audio stats since the last wavstats, then reset them.
+      if (!strcmp(cmd, "wavstats")) {
+        for (size_t i = 0; i < NELEM(wav_players); i++) {
+          STDOUT << "Wav player " << i << " (" << wav_players[i].filename() << "):";
+          wav_players[i].DumpStats();
+          wav_players[i].ResetStats();
+        }
+    #if PAIRED_SWING_PLAYER
+        paired_swing_player.DumpStats();
+        paired_swing_player.ResetStats();
+    #endif
+    #if ATTACK_CACHE_FILES > 0
+        STDOUT << "Attack cache hits: " << attack_cache.hits()
+               << " misses: " << attack_cache.misses() << "\n";
+    #endif
+    #if OPEN_FILE_CACHE_SIZE > 0
+        open_file_cache.DumpStats();
+        open_file_cache.ResetStats();
+    #endif
+    #if WAV_BUFFER_POOL
+        wav_buffer_pool.DumpStats();
+        wav_buffer_pool.ResetStats();
+    #endif
+        STDOUT << "Wav players stolen: " << wav_players_stolen
+               << " dropped: " << wav_players_dropped << "\n";
+        wav_players_stolen = wav_players_dropped = 0;
+        STDOUT << "Preset change to first sound us min=" << WavPlayerStats::preset_change_latency.min
+               << " avg=" << WavPlayerStats::preset_change_latency.avg
+               << " max=" << WavPlayerStats::preset_change_latency.max << "\n";
+        WavPlayerStats::preset_change_latency.Reset();
+    #if PRESET_PREFETCH
+        STDOUT << "Preset prefetch hits: " << preset_prefetch.hits()
+               << " misses: " << preset_prefetch.misses() << "\n";
+    #endif
+        return true;
+      }
+  #endif // ENABLE_DIAGNOSE_COMMANDS
+
+  #if defined(ENABLE_DEVELOPER_COMMANDS) && MIXER_BUSES
+      // busgain <bus> <gain>: gain 0 ... 1 for bus 0 = hum, 1 = swing,
+      // 2 = effects, 3 = voice, 4 = track. No arguments lists the gains.
+      if (!strcmp(cmd, "busgain")) {
+        if (e && *e) {
+          int bus = atoi(e);
+          if (bus < 0 || bus >= NUM_MIXER_BUSES) return false;
+          dynamic_mixer.buses_.set_gain((MixerBus)bus, parsefloat(SkipWord(e)));
+        }
+        for (int i = 0; i < NUM_MIXER_BUSES; i++) {
+          STDOUT << "Bus " << i << " gain: " << dynamic_mixer.buses_.gain((MixerBus)i) << "\n";
+        }
+        return true;
+      }
+      // ducking <db> <attack ms> <release ms>, 0 dB turns it off.
+      if (!strcmp(cmd, "ducking")) {
+        if (!e || CountWords(e) != 3) return false;
+        const char* attack = SkipWord(e);
+        const char* release = SkipWord(attack);
+        dynamic_mixer.buses_.set_ducking(parsefloat(e), parsefloat(attack), parsefloat(release));
+        return true;
+      }
+  #endif
+
 #endif // ENABLE_AUDIO
 
 
@@ -1329,6 +1442,13 @@ class Commands : public CommandParser {
   #ifndef DISABLE_DIAGNOSTIC_COMMANDS    
     STDOUT.println(" effects - list current effects");
   #endif    
+  #if defined(ENABLE_AUDIO) && defined(ENABLE_DIAGNOSE_COMMANDS)
+    STDOUT.println(" wavstats - per-player underflows, buffer fill, read rate, start latency and file open times");
+  #endif
+  #if defined(ENABLE_AUDIO) && defined(ENABLE_DEVELOPER_COMMANDS) && MIXER_BUSES
+    STDOUT.println(" busgain <bus> <gain> - set a mixer bus gain, 0 ... 1");
+    STDOUT.println(" ducking <db> <attack ms> <release ms> - set voice ducking");
+  #endif
   #ifdef ENABLE_SERIALFLASH
     STDOUT.println("Serial Flash memory management:");
     STDOUT.println("   ls, rm <file>, format, play <file>, effects");
@@ -48,6 +48,9 @@ protected:
   // may double-presses there has been. The count starts at FIRST, that way
   // the first event can be distinguished from the rest.
   bool Send(uint32_t event) {
+#ifdef ENABLE_DEVELOPER_COMMANDS
+    motion_trace.RecordButton(button_, event, press_count_);
+#endif
     if (!prop.Event(button_, (EVENT)(event + (EVENT_SECOND_PRESSED - EVENT_FIRST_PRESSED) * press_count_))) {
       // Only send the second event if the first event didn't trigger a response.
       return prop.Event(button_, (EVENT)event);
@@ -316,6 +316,7 @@ uint16_t LUT<uint16_t, uint16_t>::Get(uint16_t x) {
 // Linear uni-dimensional interpolator 
 template<class REFT, class WORKT>
 class TF  : public Interpolator<REFT, WORKT> {
+protected:
     // Bring dependent names in scope (lost when binding templates against inheritance):
     using Interpolator<REFT, WORKT>::refSize;          
     using Interpolator<REFT, WORKT>::refData;          
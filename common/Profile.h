@@ -155,6 +155,36 @@ uint16_t ReadProfile(const char* filename, uint16_t ID) {
     return profileData.activePresets_id;
 }
 
+#if POST_MIX_DSP
+// Read the post-mix EQ and limiter settings from the COD file: the struct
+// with handler HANDLER_PostMix and the smallest ID. Without one, the mixer
+// keeps its compressor.
+bool ReadPostMix(const char* filename) {
+    CodReader reader;
+    postMixData_t postMixData;
+    bool success = false;
+    if (reader.Open(filename)) {
+        uint16_t id = 1;
+        for (; id <= POST_MIX_MAXID; id++) {
+            if (reader.FindEntry(id) == COD_ENTYPE_STRUCT &&
+                reader.codProperties.structure.Handler == HANDLER_PostMix) break;
+        }
+        if (id <= POST_MIX_MAXID)
+            success = reader.ReadEntry(id, (void*)&postMixData, sizeof(postMixData)) == sizeof(postMixData);
+        reader.Close();
+    }
+    if (success) success = dynamic_mixer.post_mix_.Set(postMixData);
+    if (!success) dynamic_mixer.post_mix_.Disable();
+    #ifdef DIAGNOSE_BOOT
+        if (success) {
+            STDOUT.print("* Post-mix EQ: "); STDOUT.print(postMixData.nBands);
+            STDOUT.print(" bands, limiter at "); STDOUT.println(postMixData.limiterThreshold);
+        }
+    #endif
+    return success;
+}
+#endif
+
 // Write user profile and color variations to profile.cod
 // __attribute__((optimize("Og")))
 bool WriteUserProfile(const char* filename, uint16_t ID) {
@@ -221,6 +251,9 @@ bool SetUserProfile(const char* filename) {
         STDOUT.println("Starting xProfile ................................."); 
     #endif
     uint16_t retVal = ReadProfile(filename, 1);     // retVal = ID of active presets
+    #if POST_MIX_DSP
+        ReadPostMix(filename);
+    #endif
     bool success = false; 
     if (retVal) {
         userProfile.apID = retVal;      // store ID of active presets table, in case we need to overwrite        
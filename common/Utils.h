@@ -93,6 +93,8 @@ public:
         if (!p_avg) {
             // Fist number in the empty stream: 
             p_avg = value;
+            if (value < p_min) p_min = value;
+            if (value > p_max) p_max = value;
         }
         else {   
             // stream already initialized
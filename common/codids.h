@@ -22,6 +22,7 @@
 #define  HANDLER_Profile                       12      // User profile
 #define  HANDLER_Preset                        13      // Preset
 #define  HANDLER_PresetList                    14      // List of active presets
+#define  HANDLER_PostMix                       15      // Post-mix EQ and limiter
 
 
 
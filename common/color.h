@@ -410,6 +410,7 @@ inline Color16 operator+(const Color16& a, const Color16 &b) {
 
 // Unmultiplied RGBA (no overdrive), used as a temporary and makes optimization easier.
 struct RGBA_um_nod {
+  RGBA_um_nod() {}
   constexpr RGBA_um_nod(Color16 c_, uint16_t a) : c(c_), alpha(a) {}
   constexpr RGBA_um_nod(const SimpleColor& c_) : c(c_.c), alpha(32768) {}
   static RGBA_um_nod Transparent() { return RGBA_um_nod(Color16(), 0); }
@@ -426,6 +427,7 @@ struct RGBA_um_nod {
 
 // Unmultiplied RGBA, used as a temporary and makes optimization easier.
 struct RGBA_um {
+  RGBA_um() {}
   constexpr RGBA_um(Color16 c_, bool od, uint16_t a) : c(c_), alpha(a), overdrive(od) {}
   constexpr RGBA_um(const RGBA_um_nod& o) : c(o.c), alpha(o.alpha), overdrive(false) {}
   constexpr RGBA_um(const OverDriveColor& o) : c(o.c), alpha(32768), overdrive(o.overdrive) {}
@@ -446,6 +448,7 @@ struct RGBA_um {
 
 // Premultiplied ALPHA, no overdrive
 struct RGBA_nod {
+  RGBA_nod() {}
   constexpr RGBA_nod(Color16 c_, uint16_t a) : c(c_), alpha(a) {}
   RGBA_nod(const RGBA_um_nod& rgba) : c(rgba.c * rgba.alpha >> 15), alpha(rgba.alpha)  {}
   RGBA_nod(const SimpleColor& o) : c(o.c), alpha(32768) {}
@@ -461,6 +464,7 @@ struct RGBA_nod {
 
 // Premultiplied ALPHA
 struct RGBA {
+  RGBA() {}
   constexpr RGBA(Color16 c_, bool od, uint16_t a) : c(c_), alpha(a), overdrive(od) {}
   RGBA(const RGBA_nod& rgba) : c(rgba.c * rgba.alpha >> 15), alpha(rgba.alpha), overdrive(false)  {}
   RGBA(const RGBA_um& rgba) : c(rgba.c * rgba.alpha >> 15), alpha(rgba.alpha), overdrive(rgba.overdrive)  {}
@@ -4,6 +4,16 @@
 #include "file_reader.h"
 #include "strfun.h"
 
+// Config files that have already been read into memory, so that
+// ReadInCurrentDir() doesn't have to go to the SD card for them.
+class ConfigFileCache {
+public:
+  // Returns true if |path| is cached. |f| is opened on the contents,
+  // or left closed if the file does not exist.
+  virtual bool OpenCached(const char* path, FileReader* f) = 0;
+};
+ConfigFileCache* config_file_cache = nullptr;
+
 // Reads an config file, looking for variable assignments.
 // TODO(hubbe): Read config files from serialflash.
 struct ConfigFile {
@@ -189,7 +199,12 @@ struct ConfigFile {
     // Search through all the directories.
     for (const char* dir = last_current_directory(); dir; dir = previous_current_directory(dir)) {
       PathHelper full_name(dir, name);
-      Read(full_name, false);
+      FileReader f;
+      if (config_file_cache && config_file_cache->OpenCached(full_name, &f)) {
+        Read(&f, false);
+      } else {
+        Read(full_name, false);
+      }
     }
   }
 
@@ -186,6 +186,32 @@ public:
     type_ = TYPE_MEM;
     mem_file_ = MemFile();
   }
+  // Hand the open file over to |other| without closing it.
+  // Leaves this reader closed.
+  void MoveTo(FileReader& other) {
+    if (&other == this) return;
+    other.Close();
+    switch (type_) {
+      IF_SD(case TYPE_SD:
+        new (&other.sd_file_) File;
+        other.sd_file_ = sd_file_;
+        sd_file_ = File();
+        sd_file_.~File();
+        break;)
+      IF_SF(case TYPE_SF:
+        new (&other.sf_file_) SerialFlashFile;
+        other.sf_file_ = sf_file_;
+        sf_file_.~SerialFlashFile();
+        break;)
+      IF_MEM(case TYPE_MEM:
+        other.mem_file_ = mem_file_;
+        mem_file_.~MemFile();
+        break;)
+    }
+    other.type_ = type_;
+    type_ = TYPE_MEM;
+    mem_file_ = MemFile();
+  }
   int Read(uint8_t* dest, int bytes) {
     RUN_ALL(read(dest, bytes))
     return 0;
@@ -249,10 +275,11 @@ public:
   int AlignRead(int n) {
 #ifdef ENABLE_SD
     if (type_ == TYPE_SD) {
+      // End the read on a block boundary; it may span several blocks.
       uint32_t pos = Tell();
-      uint32_t next_block = (pos + 512u) & ~511u;
-      int bytes_to_end_of_block = next_block - pos;
-      return std::min<int>(n, bytes_to_end_of_block);
+      uint32_t last_block = (pos + n) & ~511u;
+      if (last_block <= pos) return n;
+      return last_block - pos;
     }
 #endif
     return n;
@@ -100,8 +100,8 @@ public:
   int write(const uint8_t *dest, size_t bytes) {
     return fwrite(dest, 1, bytes, file_.get());
   }
-  void seek(size_t pos) {
-    fseek(file_.get(), pos, SEEK_SET);
+  bool seek(size_t pos) {
+    return fseek(file_.get(), pos, SEEK_SET) == 0;
   }
   uint32_t position() {
     return ftell(file_.get());
@@ -157,6 +157,9 @@ public:
   static File OpenForWrite(const char* path) {
     return fopen(path, "wct");
   }
+  static File OpenForOverWrite(const char* path) {
+    return fopen(path, "r+");
+  }
   class Iterator {
   public:
     explicit Iterator(const char* dirname) {
@@ -184,7 +187,11 @@ public:
     operator bool() { return !!entry_; }
     // bool isdir() { return f_.isDirectory(); }
     const char* name() { return entry_->d_name; }
-    // size_t size() { return f_.size(); }
+    size_t size() {
+      struct stat s;
+      if (fstatat(dirfd(dir_.get()), entry_->d_name, &s, 0) != 0) return 0;
+      return s.st_size;
+    }
     
   private:
     LinkedPtr<DIR, DoCloseDir> dir_;
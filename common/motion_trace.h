@@ -0,0 +1,319 @@
+#ifndef COMMON_MOTION_TRACE_H
+#define COMMON_MOTION_TRACE_H
+
+// Motion traces: motion sensor data and button events, recorded to a file
+// with time stamps and played back to the prop, so the same saber session
+// can be run again and again without moving the saber.
+//   trace rec <file>    record until "trace stop"
+//   trace play <file>   play back; the motion sensor's own data is held back
+//   trace stop
+// After a play back, the mixer time per audio block and the underflows
+// during the play back are printed. Playing the same trace with the same
+// font before and after a change to the audio path shows what it did.
+//
+// The file is a series of MotionTraceRecord, little-endian, so traces can
+// also be made on a PC.
+
+#ifdef ENABLE_DEVELOPER_COMMANDS
+
+#include "file_reader.h"
+
+// Records buffered between the motion sensor and the SD card.
+#ifndef MOTION_TRACE_BUFFER
+#define MOTION_TRACE_BUFFER 256
+#endif
+
+enum MotionTraceType : uint32_t {
+  MOTION_TRACE_ACCEL = 0,    // v in g
+  MOTION_TRACE_GYRO = 1,     // v in degrees per second
+  MOTION_TRACE_BUTTON = 2,   // e as given to ButtonBase::Send()
+};
+
+struct MotionTraceRecord {
+  uint32_t millis;    // since the start of the trace
+  uint32_t type;      // MotionTraceType
+  union {
+    float v[3];
+    struct {
+      uint32_t button;
+      uint32_t event;
+      uint32_t press_count;
+    } e;
+  };
+};
+
+class MotionTrace : public Looper, public CommandParser {
+public:
+  const char* name() override { return "MotionTrace"; }
+
+  bool playing() const { return state_ == PLAYING; }
+
+  // From the motion sensor, maybe in an interrupt, or in loop() where the
+  // buttons may interrupt.
+  void RecordMotion(MotionTraceType type, const Vec3& v) {
+    if (state_ != RECORDING) return;
+    noInterrupts();
+    MotionTraceRecord* r = Next();
+    if (r) {
+      r->millis = millis() - start_;
+      r->type = type;
+      r->v[0] = v.x;
+      r->v[1] = v.y;
+      r->v[2] = v.z;
+      head_.set(head_.get() + 1);
+    }
+    interrupts();
+  }
+
+  // From the buttons; the motion sensor may interrupt.
+  void RecordButton(BUTTON button, uint32_t event, uint32_t press_count) {
+    if (state_ != RECORDING) return;
+    noInterrupts();
+    MotionTraceRecord* r = Next();
+    if (r) {
+      r->millis = millis() - start_;
+      r->type = MOTION_TRACE_BUTTON;
+      r->e.button = button;
+      r->e.event = event;
+      r->e.press_count = press_count;
+      head_.set(head_.get() + 1);
+    }
+    interrupts();
+  }
+
+  void Loop() override {
+    switch (state_) {
+      case IDLE:
+        break;
+      case RECORDING:
+        if (head_.get() - tail_ >= kChunk) Flush();
+        break;
+      case PLAYING:
+        Play();
+        break;
+    }
+  }
+
+  bool Parse(const char* cmd, const char* arg) override {
+    if (strcmp(cmd, "trace")) return false;
+    if (!arg) arg = "";
+    if (!strncmp(arg, "rec ", 4)) {
+      Stop();
+      if (!Begin(arg + 4, true)) return true;
+      STDOUT << "Recording " << (arg + 4) << "\n";
+      state_ = RECORDING;
+      return true;
+    }
+    if (!strncmp(arg, "play ", 5)) {
+      Stop();
+      if (!Begin(arg + 5, false)) return true;
+      STDOUT << "Playing " << (arg + 5) << "\n";
+      first_accel_ = first_gyro_ = true;
+      ResetStats();
+      state_ = PLAYING;
+      return true;
+    }
+    if (!strcmp(arg, "stop")) {
+      Stop();
+      return true;
+    }
+    STDOUT.println("trace rec <file> | play <file> | stop");
+    return true;
+  }
+
+  void Help() override {
+    #if defined(COMMANDS_HELP)
+    STDOUT.println(" trace rec <file> | play <file> | stop - record or play back motion and buttons");
+    #endif
+  }
+
+private:
+  enum State : uint8_t { IDLE, RECORDING, PLAYING };
+
+  // Records per SD read or write.
+  static const uint32_t kChunk = MOTION_TRACE_BUFFER / 4;
+
+  MotionTraceRecord* Next() {
+    if (head_.get() - tail_ >= MOTION_TRACE_BUFFER) {
+      lost_++;
+      return nullptr;
+    }
+    return &buffer_[head_.get() % MOTION_TRACE_BUFFER];
+  }
+
+  bool Begin(const char* filename, bool write) {
+    if (!buffer_) buffer_ = (MotionTraceRecord*)malloc(sizeof(MotionTraceRecord) * MOTION_TRACE_BUFFER);
+    if (!buffer_) {
+      STDOUT.println("Out of memory.");
+      return false;
+    }
+    LOCK_SD(true);
+    bool ok = write ? file_.Create(filename) : file_.Open(filename);
+    LOCK_SD(false);
+    if (!ok) {
+      STDOUT << "Can't open " << filename << "\n";
+      free(buffer_);
+      buffer_ = nullptr;
+      return false;
+    }
+    head_.set(0);
+    tail_ = 0;
+    lost_ = 0;
+    start_ = millis();
+    return true;
+  }
+
+  void Stop() {
+    State state = state_;
+    state_ = IDLE;
+    if (state == IDLE) return;
+    if (state == RECORDING) {
+      Flush();
+      STDOUT << "Recorded " << (uint32_t)(millis() - start_) << " ms";
+      if (lost_) STDOUT << ", " << lost_ << " records lost";
+      STDOUT << "\n";
+    } else {
+      DumpStats();
+    }
+    LOCK_SD(true);
+    file_.Close();
+    LOCK_SD(false);
+    free(buffer_);
+    buffer_ = nullptr;
+  }
+
+  // Write out everything recorded so far.
+  void Flush() {
+    uint32_t head = head_.get();
+    LOCK_SD(true);
+    while (tail_ != head) {
+      uint32_t pos = tail_ % MOTION_TRACE_BUFFER;
+      uint32_t n = std::min<uint32_t>(head - tail_, MOTION_TRACE_BUFFER - pos);
+      file_.Write((const uint8_t*)&buffer_[pos], n * sizeof(MotionTraceRecord));
+      tail_ += n;
+    }
+    LOCK_SD(false);
+  }
+
+  // Send everything that is due to the prop, reading ahead in chunks.
+  void Play() {
+    uint32_t now = millis() - start_;
+    while (true) {
+      if (tail_ == head_.get()) {
+        LOCK_SD(true);
+        int bytes = file_.Read((uint8_t*)buffer_, kChunk * sizeof(MotionTraceRecord));
+        LOCK_SD(false);
+        tail_ = 0;
+        head_.set(bytes / sizeof(MotionTraceRecord));
+        if (!head_.get()) {
+          Stop();
+          return;
+        }
+      }
+      const MotionTraceRecord& r = buffer_[tail_];
+      if ((int32_t)(r.millis - now) > 0) return;
+      switch (r.type) {
+        case MOTION_TRACE_ACCEL:
+          prop.DoAccel(Vec3(r.v[0], r.v[1], r.v[2]), first_accel_);
+          first_accel_ = false;
+          break;
+        case MOTION_TRACE_GYRO:
+          prop.DoMotion(Vec3(r.v[0], r.v[1], r.v[2]), first_gyro_);
+          first_gyro_ = false;
+          break;
+        case MOTION_TRACE_BUTTON: {
+          // Same as ButtonBase::Send().
+          BUTTON button = (BUTTON)r.e.button;
+          if (!prop.Event(button, (EVENT)(r.e.event + (EVENT_SECOND_PRESSED - EVENT_FIRST_PRESSED) * r.e.press_count))) {
+            prop.Event(button, (EVENT)r.e.event);
+          }
+          break;
+        }
+      }
+      tail_++;
+    }
+  }
+
+  void ResetStats() {
+#ifdef ENABLE_AUDIO
+    noInterrupts();
+    audio_dma_interrupt_cycles.Reset();
+    wav_interrupt_cycles.Reset();
+#if POST_MIX_DSP
+    post_mix_cycles.Reset();
+#endif
+    AudioStreamWork::fill_margin.Reset();
+    interrupts();
+    for (size_t i = 0; i < NELEM(wav_players); i++) wav_players[i].ResetStats();
+    mixer_underflows_ = dynamic_mixer.underflow_count_.get();
+    stolen_ = wav_players_stolen;
+    dropped_ = wav_players_dropped;
+#endif
+  }
+
+  void DumpStats() {
+    STDOUT << "Played " << (uint32_t)(millis() - start_) << " ms\n";
+#ifdef ENABLE_AUDIO
+#ifdef X_PROBECPU
+    // Cycles to microseconds.
+    float us = 1.0f / (_SYSTEM_CORE_CLOCK_MHZ_);
+    STDOUT << "Mixer per block of " << AUDIO_BUFFER_SIZE << " [us]: min="
+           << audio_dma_interrupt_cycles.duration.min * us
+           << " avg=" << audio_dma_interrupt_cycles.duration.avg * us
+           << " max=" << audio_dma_interrupt_cycles.duration.max * us
+           << " of " << AUDIO_BUFFER_SIZE * 1000000.0f / AUDIO_RATE << "\n";
+    STDOUT << "WAV reader [us]: avg=" << wav_interrupt_cycles.duration.avg * us
+           << " max=" << wav_interrupt_cycles.duration.max * us << "\n";
+#if POST_MIX_DSP
+    STDOUT << "Post-mix DSP [us]: avg=" << post_mix_cycles.duration.avg * us
+           << " max=" << post_mix_cycles.duration.max * us << "\n";
+#endif
+#endif
+    uint32_t underflows = 0;
+    for (size_t i = 0; i < NELEM(wav_players); i++) underflows += wav_players[i].underflows();
+    STDOUT << "Underflows: mixer=" << (dynamic_mixer.underflow_count_.get() - mixer_underflows_)
+           << " wav players=" << underflows << "\n";
+    STDOUT << "Audio fill margin [ms]: min=" << AudioStreamWork::fill_margin.min * 1000.0f / AUDIO_RATE << "\n";
+    STDOUT << "Wav players stolen: " << (wav_players_stolen - stolen_)
+           << " dropped: " << (wav_players_dropped - dropped_) << "\n";
+#endif
+  }
+
+  volatile State state_ = IDLE;
+  FileReader file_;
+  MotionTraceRecord* buffer_ = nullptr;
+  // Recording: written by the motion sensor and buttons, read by Flush().
+  // Playing: records in buffer_ not sent yet.
+  POAtomic<uint32_t> head_;
+  uint32_t tail_ = 0;
+  uint32_t lost_ = 0;
+  uint32_t start_ = 0;
+  bool first_accel_ = true;
+  bool first_gyro_ = true;
+  uint32_t mixer_underflows_ = 0;
+  uint32_t stolen_ = 0;
+  uint32_t dropped_ = 0;
+};
+
+MotionTrace motion_trace;
+
+#endif  // ENABLE_DEVELOPER_COMMANDS
+
+// The motion sensor hands its data to the prop through these.
+void PropDoAccel(const Vec3& accel, bool first) {
+#ifdef ENABLE_DEVELOPER_COMMANDS
+  if (motion_trace.playing()) return;
+  motion_trace.RecordMotion(MOTION_TRACE_ACCEL, accel);
+#endif
+  prop.DoAccel(accel, first);
+}
+
+void PropDoMotion(const Vec3& gyro, bool first) {
+#ifdef ENABLE_DEVELOPER_COMMANDS
+  if (motion_trace.playing()) return;
+  motion_trace.RecordMotion(MOTION_TRACE_GYRO, gyro);
+#endif
+  prop.DoMotion(gyro, first);
+}
+
+#endif
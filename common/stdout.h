@@ -12,9 +12,15 @@ struct Print {
   }
   void print(int v, int base) {
     char tmp[64];
-    sprintf(tmp, "%d", v);
+    sprintf(tmp, base == 16 ? "%x" : "%d", v);
     print(tmp);
   }
+  void print(char c) { write(c); }
+  void print(int v) { print(v, 10); }
+  void print(unsigned v) { print((unsigned long)v); }
+  void print(long v) { char tmp[64]; sprintf(tmp, "%ld", v); print(tmp); }
+  void print(unsigned long v) { char tmp[64]; sprintf(tmp, "%lu", v); print(tmp); }
+  void print(double v) { print((float)v); }
   void write(char s) { write( (uint8_t) s); }
   template<class T>
   void println(T s) { print(s); write('\n'); }
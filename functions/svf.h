@@ -12,6 +12,10 @@
 class SingleValueBase {
 public:
   int getInteger(int led) { return value_; }
+  void getIntegers(int begin, int end, int* out) {
+    int v = value_;
+    for (int i = begin; i < end; i++) *out++ = v;
+  }
   int value_;
 };
 
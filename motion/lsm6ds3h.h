@@ -236,13 +236,13 @@
 	
 	I2C_READ_BYTES_ASYNC(OUTX_L_G, databuffer, 12);
 	// accel data available
-	prop.DoAccel(
+	PropDoAccel(
 	  MotionUtil::FromData(databuffer + 6, 16.0 / 32768.0,   // 16 g range
 			       Vec3::BYTEORDER_LSB, Vec3::ORIENTATION),
 	  first_accel_);
 	first_accel_ = false;
 	// gyroscope data available
-	prop.DoMotion(
+	PropDoMotion(
 	  MotionUtil::FromData(databuffer, 2000.0 / 32768.0,  // 2000 dps
 			       Vec3::BYTEORDER_LSB, Vec3::ORIENTATION),
 	  first_motion_);
@@ -335,13 +335,13 @@
     stm32l4_i2c_notify(Wire._i2c, nullptr, 0, 0);
     I2CUnlock();
     // accel data available
-    prop.DoAccel(MotionUtil::FromData(databuffer + 6, 16.0 / 32768.0,   // 16 g range
+    PropDoAccel(MotionUtil::FromData(databuffer + 6, 16.0 / 32768.0,   // 16 g range
 				      Vec3::BYTEORDER_LSB, Vec3::ORIENTATION),
 		 first_accel_);
     
     first_accel_ = false;
     // gyroscope data available
-    prop.DoMotion(MotionUtil::FromData(databuffer, 2000.0 / 32768.0,  // 2000 dps
+    PropDoMotion(MotionUtil::FromData(databuffer, 2000.0 / 32768.0,  // 2000 dps
 				       Vec3::BYTEORDER_LSB, Vec3::ORIENTATION),
 		  first_motion_);
     first_motion_ = false;
@@ -203,7 +203,7 @@ bool SetActions(xMenuActions* actions_, TYPE initialValue)  {
         player1->CloseFiles();
     }
     else {
-        player1 = GetFreeWavPlayer();
+        player1 = GetFreeWavPlayer(false, BUS_VOICE);
         player1->set_fade_time(0.003);
     }
     
@@ -212,7 +212,7 @@ bool SetActions(xMenuActions* actions_, TYPE initialValue)  {
         player2->CloseFiles();
     }
     else {
-        player2 = GetFreeWavPlayer();
+        player2 = GetFreeWavPlayer(false, BUS_VOICE);
         player2->set_fade_time(0.003);
     }     
 
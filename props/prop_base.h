@@ -134,6 +134,12 @@ public:
 
   bool on_pending_ = false;
 
+#ifdef ENABLE_AUDIO
+  // Set while a button event is handled, see Event().
+  bool in_event_ = false;
+  uint32_t event_start_ = 0;
+#endif
+
   virtual bool IsOn() {
     return SaberBase::IsOn() || on_pending_;
   }
@@ -266,22 +272,12 @@ public:
     }
 #endif
 
-    char *b = current_directory;
-    for (const char *a = dir; *a; a++) {
-      // Skip trailing slash
-      if (*a == '/' && (a[1] == 0 || a[1] == ';'))
-        continue;
-      if (*a == ';') {
-        *(b++) = 0;
-        continue;
-      }
-      *(b++) = *a;
-    }
-    // Two zeroes at end!
-    *(b++) = 0;
-    *(b++) = 0;
+    MakeDirectoryList(current_directory, dir);
 
 #ifdef ENABLE_AUDIO
+#if PRESET_PREFETCH
+    if (!preset_prefetch.Apply())
+#endif
     Effect::ScanCurrentDirectory();
     SaberBase* font = NULL;
     hybrid_font.Activate();
@@ -392,6 +388,13 @@ public:
       
       SaberBase::SetVariation(current_preset_->variation); // update variation
       chdir(current_preset_->font);                       // change font
+    #if defined(ENABLE_AUDIO) && PRESET_PREFETCH
+      if (presets.size()) {                               // prefetch the neighbours
+        size_t n = presets.size();
+        preset_prefetch.SetTargets(presets.data()[(presetIndex + 1) % n].font,
+                                   presets.data()[(presetIndex + n - 1) % n].font);
+      }
+    #endif
       userProfile.preset = presetIndex+1;                 // set current preset in user profile
     }
   
@@ -399,8 +402,14 @@ public:
     // preset_num starts at 1!
     virtual void SetPreset(int preset_num, bool announce) {
       if (!preset_num) return;    // presets are numbered from 1; 0 means preset error
+    #ifdef ENABLE_AUDIO
+      WavPlayerStats::preset_change_start = in_event_ ? event_start_ : micros();
+    #endif
       bool on = BladeOff();
       ChangePreset(preset_num-1);   
+    #ifdef ENABLE_AUDIO
+      WavPlayerStats::preset_change_pending.set(on || announce);
+    #endif
       if (on) On(); 
         else if (announce) {  // don't announce if you just did on!
         SaberBase::DoNewFont();
@@ -410,8 +419,14 @@ public:
     // preset_num starts at 1!
     void SetPresetFast(int preset_num, bool announce = true) {
       if (!preset_num) return;    // presets are numbered from 1; 0 means preset error
+    #ifdef ENABLE_AUDIO
+      WavPlayerStats::preset_change_start = in_event_ ? event_start_ : micros();
+    #endif
       bool on = BladeOff(true);   // silent off
       ChangePreset(preset_num-1); 
+    #ifdef ENABLE_AUDIO
+      WavPlayerStats::preset_change_pending.set(on);
+    #endif
       if (on) {
         hybrid_font.silentOn = true;
         // FastOn();
@@ -850,7 +865,7 @@ void Detect2Tap(float acc)  {  // Got acceleration resultant from DoAccel()
     } else {
       MountSDCard();
       EnableAmplifier();
-      track_player_ = GetFreeWavPlayer();
+      track_player_ = GetFreeWavPlayer(true, BUS_TRACK);
       if (track_player_) {
           track_player_->Play(current_preset_->track);
       } else {
@@ -1173,7 +1188,7 @@ void Detect2Tap(float acc)  {  // Got acceleration resultant from DoAccel()
       }
       MountSDCard();
       EnableAmplifier();
-      track_player_ = GetFreeWavPlayer();
+      track_player_ = GetFreeWavPlayer(true, BUS_TRACK);
       if (track_player_) {
         STDOUT.print("Playing ");
         STDOUT.println(arg);
@@ -1770,9 +1785,20 @@ bool PassEventToProp(enum BUTTON button, EVENT event) {
 }
 
 
-virtual bool Event(enum BUTTON button, EVENT event) {    
+virtual bool Event(enum BUTTON button, EVENT event) {
+#ifdef ENABLE_AUDIO
+    // Preset changes made by this event count their latency from here.
+    event_start_ = micros();
+    in_event_ = true;
+    bool ret = DispatchEvent(button, event);
+    in_event_ = false;
+    return ret;
+#else
+    return DispatchEvent(button, event);
+#endif
+  }
 
-    
+  bool DispatchEvent(enum BUTTON button, EVENT event) {
     switch (event) {
       case EVENT_RELEASED:
         clash_pending_ = false;
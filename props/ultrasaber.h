@@ -57,7 +57,7 @@ public:
     {   
         bool resultPlay;
         // STDOUT.print("Prin SS player state"); STDOUT.println(player ? "something": "null");
-        if (!player) player = GetFreeWavPlayer();
+        if (!player) player = GetFreeWavPlayer(false, BUS_VOICE);
         if (!player)  {
           STDOUT.println("Ultrasaber prop cannot get free player!");
           return false;
@@ -259,7 +259,7 @@ class menuPreset_t :  public menuInterface<T>{
         #endif
         if(restoreTrack)
         {
-           track_player_ = GetFreeWavPlayer();
+           track_player_ = GetFreeWavPlayer(true, BUS_TRACK);
           if (track_player_) 
           track_player_->Play(menuInterface<T>::workingProp->current_preset_->track);
         }
@@ -0,0 +1,169 @@
+#ifndef SOUND_ATTACK_CACHE_H
+#define SOUND_ATTACK_CACHE_H
+
+#include "playwav.h"
+
+// Keeps the first ATTACK_CACHE_MS of every clash, blast, stab and lock
+// file in RAM. BufferedWavPlayer::PlayOnce() copies the cached samples
+// into its buffer and starts playing right away, while PlayWav opens the
+// file and picks up streaming right after the cached part.
+// Only 16-bit or 8-bit PCM files at AUDIO_RATE are cached, as those can be
+// resumed at an exact sample.
+// The cache is filled with the audio buffers (lowest priority) after
+// a font is loaded.
+#ifndef ATTACK_CACHE_FILES
+#ifdef ARDUINO_ARCH_ESP32   // ESP architecture
+#define ATTACK_CACHE_FILES 16
+#else
+#define ATTACK_CACHE_FILES 0     // ~880 bytes per file at 10 ms
+#endif
+#endif
+
+#ifndef ATTACK_CACHE_MS
+#define ATTACK_CACHE_MS 10
+#endif
+
+#if ATTACK_CACHE_FILES > 0
+
+class AttackCache : public AudioStreamWork, Looper {
+public:
+  static const int kSamples = AUDIO_RATE * ATTACK_CACHE_MS / 1000;
+
+  struct Entry {
+    Effect::FileID id;
+    uint16_t samples;
+    float length;    // whole file, seconds
+  };
+
+  AttackCache() : AudioStreamWork(), Looper(10000), pending_(false) {
+    wav_.SetReadBuffer(read_buffer_, sizeof(read_buffer_));
+  }
+  const char* name() override { return "AttackCache"; }
+
+  // Forget everything and start caching the current font.
+  // Locks the SD so that it can't race with FillBuffer().
+  void Reload() {
+    LockSD_nomount(true);
+    num_entries_ = 0;
+    effect_ = 0;
+    file_ = 0;
+    sub_ = 0;
+    pending_.set(true);
+    LockSD_nomount(false);
+  }
+
+  // Effects that are cached. Only these count as hits or misses.
+  static bool Caches(const Effect* effect) {
+    for (size_t i = 0; Effect* e = CachedEffect(i); i++) {
+      if (e == effect) return true;
+    }
+    return false;
+  }
+
+  const Entry* Find(const Effect::FileID& id) const {
+    if (!Caches(id.GetEffect())) return nullptr;
+    if (pending_.get()) {
+      misses_++;    // not loaded yet
+      return nullptr;
+    }
+    for (int i = 0; i < num_entries_; i++) {
+      if (entries_[i].id == id) {
+        hits_++;
+        return entries_ + i;
+      }
+    }
+    misses_++;
+    return nullptr;
+  }
+
+  const int16_t* data(const Entry* entry) const {
+    return data_[entry - entries_];
+  }
+
+  uint32_t hits() const { return hits_; }
+  uint32_t misses() const { return misses_; }
+
+protected:
+  void Loop() override {
+    // Nothing may be playing, so nothing else is asking for buffer fills.
+    if (pending_.get()) scheduleFillBuffer();
+  }
+
+  size_t space_available() override { return pending_.get() ? 1 : 0; }
+  uint32_t samples_to_underrun() override { return 0xFFFFFFFFu; }
+  void CloseFiles() override { wav_.Close(); }
+
+  // Caches one file per call, so it never holds up the players for long.
+  bool FillBuffer() override {
+    if (!pending_.get()) return false;
+    Effect::FileID id = Next();
+    if (!id) {
+      wav_.Close();
+      pending_.set(false);
+      return false;
+    }
+    Entry& e = entries_[num_entries_];
+    int16_t* dest = data_[num_entries_];
+    int got = 0;
+    wav_.PlayOnce(id);
+    wav_.PlayNext(nullptr);
+    for (int i = 0; i < 100 && got < kSamples && !wav_.eof(); i++) {
+      got += wav_.read(dest + got, kSamples - got);
+    }
+    bool ok = got == kSamples && wav_.resumable();
+    if (ok) {
+      e.id = id;
+      e.samples = got;
+      e.length = wav_.length();
+      num_entries_++;
+    }
+    wav_.Stop();
+    return false;
+  }
+
+private:
+  static Effect* CachedEffect(size_t i) {
+    static Effect* const effects[] = {
+      &SFX_clsh, &SFX_clash, &SFX_blst, &SFX_blaster, &SFX_stab, &SFX_bgnlock
+    };
+    return i < NELEM(effects) ? effects[i] : nullptr;
+  }
+
+  // Next file to cache, or an empty FileID when done.
+  Effect::FileID Next() {
+    while (num_entries_ < ATTACK_CACHE_FILES) {
+      Effect* effect = CachedEffect(effect_);
+      if (!effect) break;
+      if (file_ < effect->files_found()) {
+        Effect::FileID id(effect, file_, sub_);
+        if (++sub_ >= effect->number_of_subfiles()) {
+          sub_ = 0;
+          file_++;
+        }
+        return id;
+      }
+      effect_++;
+      file_ = 0;
+      sub_ = 0;
+    }
+    return Effect::FileID();
+  }
+
+  PlayWav wav_;
+  unsigned char read_buffer_[512] __attribute__((aligned(4)));
+  POAtomic<bool> pending_;
+  size_t effect_ = 0;
+  size_t file_ = 0;
+  size_t sub_ = 0;
+  int num_entries_ = 0;
+  mutable uint32_t hits_ = 0;
+  mutable uint32_t misses_ = 0;
+  Entry entries_[ATTACK_CACHE_FILES];
+  int16_t data_[ATTACK_CACHE_FILES][kSamples];
+};
+
+AttackCache attack_cache;
+
+#endif  // ATTACK_CACHE_FILES > 0
+
+#endif
@@ -1,6 +1,7 @@
 #ifndef SOUND_AUDIO_STREAM_WORK_H
 #define SOUND_AUDIO_STREAM_WORK_H
 
+#include <algorithm>
 #include "../common/atomic.h"
 
 
@@ -9,6 +10,36 @@
 // let audio processing preempt less important tasks.
 #define IRQ_WAV 55
 
+// Most streams the fill scheduler orders by urgency in one pass. Streams
+// that don't fit are still filled, in list order, after the others.
+#ifndef AUDIO_FILL_MAX_STREAMS
+#define AUDIO_FILL_MAX_STREAMS 16
+#endif
+
+#ifdef ARDUINO_ARCH_ESP32   // ESP architecture
+// Buffers are filled by a task on the core that does not run loop(),
+// the i2s writer and the blades.
+#ifndef AUDIO_FILL_CORE
+#if CONFIG_FREERTOS_UNICORE
+#define AUDIO_FILL_CORE ARDUINO_RUNNING_CORE
+#else
+#define AUDIO_FILL_CORE (ARDUINO_RUNNING_CORE ? 0 : 1)
+#endif
+#endif
+// That core also runs WiFi and Bluetooth, at configMAX_PRIORITIES - 2.
+// The fill task stays below them: the buffers hold several ms of audio,
+// which covers their bursts, while a long SD read at their priority
+// would hold up the radio for a whole tick.
+#ifndef AUDIO_FILL_PRIORITY
+#define AUDIO_FILL_PRIORITY (configMAX_PRIORITIES - 5)
+#endif
+// Same as the i2s writer; the fill path goes through the SD driver and
+// the WAV decoders. See fill_task_stack_free().
+#ifndef AUDIO_FILL_STACK
+#define AUDIO_FILL_STACK (4096 * 3)
+#endif
+#endif
+
 class AudioStreamWork;
 AudioStreamWork* data_streams;
 
@@ -22,6 +53,7 @@ public:
     for (AudioStreamWork** d = &data_streams; *d; d = &(*d)->next_) {
       if (*d == this) {
         *d = next_;
+        break;
       }
     }
   }
@@ -37,28 +69,79 @@ public:
     if (enqueue) {
 
 #ifdef ARDUINO_ARCH_ESP32   // ESP architecture
-      // TODO TRIGGER ProcessAudioStreams !!! 
+      if (fill_task_) xTaskNotifyGive(fill_task_);
+      else ProcessAudioStreams();   // before SetupFillTask()
+#elif defined(PROFFIE_TEST)
       ProcessAudioStreams();
-      // STDOUT.println("SEV");
-      // xEventGroupSetBits(xEventGroup, 1);
 #else
       armv7m_pendsv_enqueue((armv7m_pendsv_routine_t)ProcessAudioStreams, NULL, 0);
 #endif    
     }
   }
 
-  static void LockSD(bool locked) {
-//    scheduleFillBuffer();
-    sd_locked.set(locked);
-    if (locked) MountSDCard();
+#ifdef ARDUINO_ARCH_ESP32   // ESP architecture
+  static void SetupFillTask() {
+    if (fill_task_) return;
+    sd_mutex_ = xSemaphoreCreateRecursiveMutex();
+    fill_done_ = xSemaphoreCreateBinary();
+    xTaskCreatePinnedToCore(FillTask, "Audio Fill Task", AUDIO_FILL_STACK, nullptr,
+                            AUDIO_FILL_PRIORITY, &fill_task_, AUDIO_FILL_CORE);
+  }
+
+  // Least free stack the fill task has had, in bytes.
+  static uint32_t fill_task_stack_free() {
+    return fill_task_ ? uxTaskGetStackHighWaterMark(fill_task_) : 0;
   }
 
+  // The fill task runs in parallel with loop(), so locking the SD has to
+  // wait for it to finish what it's reading.
+  static void LockSD_nomount(bool locked) {
+    if (!sd_mutex_) {
+      sd_locked.set(locked);
+    } else if (locked) {
+      xSemaphoreTakeRecursive(sd_mutex_, portMAX_DELAY);
+      sd_locked.set(true);
+    } else {
+      sd_locked.set(false);
+      xSemaphoreGiveRecursive(sd_mutex_);
+    }
+  }
+#else
   static void LockSD_nomount(bool locked) {
     sd_locked.set(locked);
   }
+#endif
+
+  static void LockSD(bool locked) {
+//    scheduleFillBuffer();
+    LockSD_nomount(locked);
+    if (locked) MountSDCard();
+  }
   
   static bool sd_is_locked() { return sd_locked.get(); }
 
+  // Run the fill scheduler once and wait for it to finish. From loop()
+  // only; on ESP32 this sleeps until the fill task is done instead of
+  // spinning on scheduleFillBuffer().
+  static void FillBuffersAndWait() {
+#ifdef ARDUINO_ARCH_ESP32   // ESP architecture
+    if (fill_task_) {
+      xSemaphoreTake(fill_done_, 0);    // from an earlier pass
+      scheduleFillBuffer();
+      xSemaphoreTake(fill_done_, portMAX_DELAY);
+      return;
+    }
+#endif
+    scheduleFillBuffer();
+  }
+
+  // Samples left in the most urgent playing stream each time the fill
+  // scheduler runs. If min gets near zero, the scheduler is not keeping up.
+  static RangeStats<int32_t, 4> fill_margin;
+
+  // Added to samples_to_underrun() by streams nobody is reading from.
+  static const uint32_t kNotConsumed = 1 << 24;
+
   static void CloseAllOpenFiles() {
     for (AudioStreamWork *d = data_streams; d; d=d->next_)
       d->CloseFiles();
@@ -74,8 +157,32 @@ protected:
   virtual bool IsActive() { return false; }
   virtual void CloseFiles() = 0;
   virtual size_t space_available() = 0;
+  // Samples this stream can deliver before it runs dry. The mixer takes
+  // AUDIO_RATE samples per second from every playing stream, so this
+  // is also the time to underrun.
+  virtual uint32_t samples_to_underrun() = 0;
 
 private:
+#ifdef ARDUINO_ARCH_ESP32   // ESP architecture
+  static void FillTask(void* param) {
+    while (true) {
+      ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+      xSemaphoreTakeRecursive(sd_mutex_, portMAX_DELAY);
+      ProcessAudioStreams();
+      xSemaphoreGiveRecursive(sd_mutex_);
+      xSemaphoreGive(fill_done_);
+    }
+  }
+  static TaskHandle_t fill_task_;
+  static SemaphoreHandle_t sd_mutex_;
+  static SemaphoreHandle_t fill_done_;
+#endif
+
+  // Min-heap on fill_key_.
+  static bool MoreTime(const AudioStreamWork* a, const AudioStreamWork* b) {
+    return a->fill_key_ > b->fill_key_;
+  }
+
   static void ProcessAudioStreams() __attribute__((optimize("Ofast"))) {
     
     ScopedCycleCounter cc(wav_interrupt_cycles);
@@ -83,35 +190,48 @@ private:
       fill_buffers_pending_.set(false);
       return;
     }
-#if 1
-    // Yes, it's a selection sort, luckily there's not a lot of
-    // AudioStreamWork instances.
-    for (int i = 0; i < 50; i++) {
-      size_t max_space = 0;
-      for (AudioStreamWork *d = data_streams; d; d=d->next_)
-        max_space = std::max(max_space, d->space_available());
-      if (max_space == 0) break;
-      for (AudioStreamWork *d = data_streams; d; d=d->next_) {
-        if (d->space_available() >= max_space)
-          d->FillBuffer();
-      }
+    // Fill the stream that will run dry first. Each FillBuffer() tops up
+    // a stream completely, so reads come in the stream's own read size
+    // rather than a few samples at a time.
+    AudioStreamWork* heap[AUDIO_FILL_MAX_STREAMS];
+    int n = 0;
+    AudioStreamWork *overflow = data_streams;
+    for (; overflow && n < (int)NELEM(heap); overflow = overflow->next_) {
+      if (!overflow->space_available()) continue;
+      overflow->fill_key_ = overflow->samples_to_underrun();
+      heap[n++] = overflow;
     }
-#else
-    for (int i = 0; i < 10; i++) {
-      for (AudioStreamWork *d = data_streams; d; d=d->next_) {
-        d->FillBuffer();
-      }
+    std::make_heap(heap, heap + n, MoreTime);
+    if (n && heap[0]->fill_key_ < kNotConsumed) fill_margin.Add(heap[0]->fill_key_);
+    for (int i = 0; i < 50 && n; i++) {
+      std::pop_heap(heap, heap + n, MoreTime);
+      AudioStreamWork* d = heap[--n];
+      uint32_t key = d->fill_key_;
+      if (!d->FillBuffer()) continue;
+      d->fill_key_ = d->samples_to_underrun();
+      if (d->fill_key_ == key) continue;  // no progress
+      heap[n++] = d;
+      std::push_heap(heap, heap + n, MoreTime);
+    }
+    for (AudioStreamWork *d = overflow; d; d=d->next_) {
+      if (d->space_available()) d->FillBuffer();
     }
-#endif
     fill_buffers_pending_.set(false);
   }
 
   static POAtomic<bool> sd_locked;
   static POAtomic<bool> fill_buffers_pending_;
   AudioStreamWork* next_;
+  uint32_t fill_key_ = 0;
 };
 
 POAtomic<bool> AudioStreamWork::sd_locked (false);
+#ifdef ARDUINO_ARCH_ESP32   // ESP architecture
+TaskHandle_t AudioStreamWork::fill_task_ = nullptr;
+SemaphoreHandle_t AudioStreamWork::sd_mutex_ = nullptr;
+SemaphoreHandle_t AudioStreamWork::fill_done_ = nullptr;
+#endif
+RangeStats<int32_t, 4> AudioStreamWork::fill_margin;
 POAtomic<bool> AudioStreamWork::fill_buffers_pending_(false);
 #define LOCK_SD(X) AudioStreamWork::LockSD(X)
 
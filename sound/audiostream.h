@@ -3,6 +3,20 @@
 
 #include <stdint.h>
 
+// Stream gains are Q14.
+const int32_t kGainShift = 14;
+const int32_t kUnityGain = 1 << kGainShift;
+
+// Groups of streams that share a gain in the mixer, see mixer_buses.h.
+enum MixerBus : uint8_t {
+  BUS_HUM,
+  BUS_SWING,
+  BUS_EFFECTS,
+  BUS_VOICE,      // voice, menus and beeps; ducks all the others
+  BUS_TRACK,
+  NUM_MIXER_BUSES
+};
+
 class ProffieOSAudioStream {
 public:
   virtual int read(int16_t* data, int elements) = 0;
@@ -11,7 +25,41 @@ public:
   // Stop
   virtual void Stop() {}
 
-  
+  // Gain-aware read: like read(), but leaves the samples unscaled and
+  // returns the gain (Q14) the caller must apply, so the mixer can fold
+  // it into its accumulation instead of making a separate pass.
+  virtual int read_gain(int16_t* data, int elements, int32_t* gain) {
+    *gain = kUnityGain;
+    return read(data, elements);
+  }
+
+  // Ask the mixer to read from this stream. The mixer only reads streams
+  // that are on its active list: it links this one in at its next read()
+  // and unlinks it again once it reports eof(), so idle streams cost nothing.
+  // Safe to call from any context.
+  void Activate() {
+    activate_ = true;
+    activate_pending_ = true;
+  }
+
+  // Commands queued with AudioDynamicMixer::Schedule(). The mixer calls
+  // these from its read(), right before mixing the sample they were
+  // scheduled for. |seconds| is the fade time, 0 for right away.
+  virtual void ScheduledStart(float seconds) { Activate(); }
+  virtual void ScheduledStop(float seconds) { Stop(); }
+
+  // Which mixer bus this stream goes through. Only read by the mixer.
+  void set_bus(MixerBus bus) { bus_ = bus; }
+  MixerBus bus() const { return (MixerBus)bus_; }
+
+  // Owned by the mixer.
+  static volatile bool activate_pending_;
+  ProffieOSAudioStream* next_active_ = nullptr;
+  volatile bool activate_ = false;
+  bool active_ = false;
+  volatile uint8_t bus_ = BUS_EFFECTS;
 };
 
+volatile bool ProffieOSAudioStream::activate_pending_ = false;
+
 #endif
@@ -46,6 +46,7 @@ public:
       beeps_.next().f_ = freq == 0.0 ? 0 : AUDIO_RATE / freq / 2.0;
       beeps_.next().samples_ = AUDIO_RATE * length;
       beeps_.push();
+      Activate();
     }
   }
   void Silence(float length) {
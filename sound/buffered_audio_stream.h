@@ -11,8 +11,7 @@
 // To make this work, we need make sure that the end pointer for the buffer
 // is only modified in the FillBuffer() function and the begin pointer is
 // only modified in read();
-// N needs to be power of 2
-template<int N>
+// The buffer is supplied with SetBuffer(), its size needs to be a power of 2.
 class BufferedAudioStream : public ProffieOSAudioStream, public AudioStreamWork {
 public:
   BufferedAudioStream() : AudioStreamWork(),
@@ -32,8 +31,8 @@ public:
       int to_copy = buffered();
       if (!to_copy) break;
       to_copy = std::min(to_copy, bufsize);
-      int start_pos = buf_start_.get() & (N-1);
-      to_copy = std::min(to_copy, N - start_pos);
+      int start_pos = buf_start_.get() & (size_ - 1);
+      to_copy = std::min<int>(to_copy, size_ - start_pos);
       memcpy(buf, buffer_ + start_pos, sizeof(buf[0]) * to_copy);
       copied += to_copy;
       buf_start_ += to_copy;
@@ -63,6 +62,27 @@ public:
   size_t space_available() override {
     return real_space_available();
   }
+  uint32_t samples_to_underrun() override {
+    return buffered();
+  }
+  void SetBuffer(int16_t* buffer, size_t size) {
+    buffer_ = buffer;
+    size_ = size;
+  }
+  size_t buffer_size() const { return size_; }
+  int16_t* buffer() const { return buffer_; }
+  // Ring position of the next sample read() returns.
+  size_t read_pos() const { return buf_start_.get(); }
+  // Put samples in the buffer ahead of the stream. Only between clear()
+  // and SetStream(), when FillBuffer() leaves the buffer alone.
+  size_t Prefill(const int16_t* data, size_t n) {
+    n = std::min<size_t>(n, size_ - buffered());
+    for (size_t i = 0; i < n; i++) {
+      buffer_[(buf_end_.get() + i) & (size_ - 1)] = data[i];
+    }
+    buf_end_ += n;
+    return n;
+  }
   void SetStream(ProffieOSAudioStream* stream) {
     stop_requested_.set(false);
     eof_.set(false);
@@ -72,7 +92,7 @@ public:
 private:
   size_t real_space_available() const {
     if (eof_.get() || !stream_.get()) return 0;
-    return N - buffered();
+    return size_ - buffered();
   }
   bool FillBuffer() override {
     if (stream_.get())  {
@@ -80,10 +100,12 @@ private:
 	stop_requested_.set(false);
 	stream_.get()->Stop();
       }
+      // The stream decodes straight into the ring, one contiguous part
+      // at a time; go around again if it filled the part up to the end.
       size_t space = real_space_available();
-      if (space) {
-        size_t end_pos = buf_end_.get() & (N-1);
-        size_t to_read = std::min(space, N - end_pos);
+      while (space) {
+        size_t end_pos = buf_end_.get() & (size_ - 1);
+        size_t to_read = std::min(space, size_ - end_pos);
         int got = stream_.get()->read(buffer_ + end_pos, to_read);
         if (got) {
           eof_.set(false);
@@ -93,6 +115,8 @@ private:
 	  eof_.set(true);
         }
         buf_end_ += got;
+        if ((size_t)got < to_read) break;
+        space -= got;
       }
     }
     return stream_.get() && space_available() > 0 && !eof_.get();
@@ -103,7 +127,8 @@ private:
   POAtomic<size_t> buf_end_;
   POAtomic<bool> eof_;
   POAtomic<bool> stop_requested_;
-  int16_t buffer_[N];
+  int16_t* buffer_ = nullptr;
+  size_t size_ = 0;
 };
 
 #endif
@@ -7,26 +7,80 @@
 class BufferedWavPlayer;
 size_t WhatUnit(class BufferedWavPlayer* player);
 
+// Buffer sizes per player. Long players (hum, tracks, swing loops) get a
+// larger sample buffer and read several SD sectors per command; the rest
+// are for short, polyphonic effects like clashes and blasts.
+// Sample buffers are in samples and must be a power of 2, read sizes are
+// in bytes and should be a multiple of 512.
 #ifndef AUDIO_BUFFER_SIZE_BYTES
 #define AUDIO_BUFFER_SIZE_BYTES 512
 #endif
+#ifndef AUDIO_READ_SIZE
+#define AUDIO_READ_SIZE 512
+#endif
+#ifndef NUM_LONG_WAV_PLAYERS
+#define NUM_LONG_WAV_PLAYERS 3
+#endif
+#ifndef LONG_AUDIO_BUFFER_SIZE
+#define LONG_AUDIO_BUFFER_SIZE 1024
+#endif
+#ifndef LONG_AUDIO_READ_SIZE
+#define LONG_AUDIO_READ_SIZE 2048
+#endif
 
 
+// Per-player audio health, updated from the audio interrupt.
+struct WavPlayerStats {
+  uint32_t underflows;
+  RangeStats<int32_t, 6> fill;    // samples buffered at each mixer read
+  uint32_t fill_histogram[4];     // same, counted by quarter of the buffer
+  RangeStats<int32_t, 3> start_latency;  // us, PlayOnce() to first sound
+  uint32_t play_start;
+  bool waiting_for_sound;
+  uint32_t reset_time;
+  uint32_t reset_bytes;
+  uint32_t reset_reads;
+
+  // Preset change to the first sound of the new preset, any player.
+  // Armed by PropBase::SetPreset(), from the button event if there is one.
+  static uint32_t preset_change_start;
+  static POAtomic<bool> preset_change_pending;
+  static RangeStats<int32_t, 3> preset_change_latency;  // us
+
+  void Reset(uint32_t bytes_read, uint32_t reads) {
+    underflows = 0;
+    fill.Reset();
+    for (size_t i = 0; i < NELEM(fill_histogram); i++) fill_histogram[i] = 0;
+    start_latency.Reset();
+    waiting_for_sound = false;
+    reset_time = millis();
+    reset_bytes = bytes_read;
+    reset_reads = reads;
+  }
+};
+
+uint32_t WavPlayerStats::preset_change_start = 0;
+POAtomic<bool> WavPlayerStats::preset_change_pending(false);
+RangeStats<int32_t, 3> WavPlayerStats::preset_change_latency;
+
 // Combines a WavPlayer and a BufferedAudioStream into a
 // buffered wav player. When we start a new sample, we
 // make sure to fill up the buffer before we start playing it.
 // This minimizes latency while making sure to avoid any gaps.
-class BufferedWavPlayer : public VolumeOverlay<BufferedAudioStream<AUDIO_BUFFER_SIZE_BYTES> > {
+class BufferedWavPlayer : public VolumeOverlay<BufferedAudioStream> {
 public:
   void Play(const char* filename) {
     MountSDCard();
     EnableAmplifier();
+    LockSD_nomount(true);   // FillBuffer() is done and won't run
     pause_.set(true);
     clear();
     wav.Play(filename);
     SetStream(&wav);
+    LockSD_nomount(false);
     scheduleFillBuffer();
     pause_.set(false);
+    Activate();
   }
 
   bool PlayInCurrentDir(const char* name) {
@@ -70,47 +124,6 @@ public:
     return false;
   }
 
-// Looper task for repeating sounds at a time period longer than sound duration
-// TODO: scrap this whole mess and put a propper wav player instead
-class RepeatTask : public Looper {
-public: 
-  bool running;
-  uint32_t longRepeatTime;
-private: 
-  uint32_t lastRepeatTime;
-  BufferedWavPlayer* player;
-  Effect* effect;
-public:
-  RepeatTask () : Looper(1000) { running = false; }  // schedule by looper at 1 ms
-  
-  const char* name() override { return "WAV Repeat Task"; }
-
-  void Set(BufferedWavPlayer* player_, Effect* effect_, uint32_t repeatTime_) {
-    player = player_;
-    effect = effect_;
-    if (!repeatTime_) repeatTime_ = 1;
-    longRepeatTime = repeatTime_;
-    lastRepeatTime = millis();    // more or less...
-  }
-
-  void Start() {  running = true; }
-
-  void Stop() { running = false; }
-
-
-  void Loop() override { 
-    if (running) {
-      uint32_t timeNow = millis();
-      if (timeNow - lastRepeatTime >= longRepeatTime) {
-          lastRepeatTime = timeNow;
-          if (player)player->PlayOnce(effect);
-      }
-    }
-  };
-
-};
-
-    RepeatTask* repeater;
 
 
   void UpdateSaberBaseSoundInfo() {
@@ -124,33 +137,100 @@ public:
     EnableAmplifier();
     set_volume_now(volume_target() * effect->GetVolume() / 100);
     // STDOUT << "unit = " << WhatUnit(this) << " vol = " << volume() << ", ";
+    LockSD_nomount(true);   // FillBuffer() is done and won't run
     pause_.set(true);
     clear();
     ResetStopWhenZero();
+    stats_.play_start = micros();
+    stats_.waiting_for_sound = true;
+#if ATTACK_CACHE_FILES > 0
+    if (start == 0.0) {
+      if (const AttackCache::Entry* cached = attack_cache.Find(fileid)) {
+        // Start from RAM, the SD catches up while that plays.
+        size_t n = Prefill(attack_cache.data(cached), cached->samples);
+        wav.PlayOnce(fileid, 0.0, n);
+        SetStream(&wav);
+        LockSD_nomount(false);
+        scheduleFillBuffer();
+        Release();
+        if (SaberBase::sound_length == 0.0 && effect->GetFollowing() != effect) {
+          SaberBase::sound_length = cached->length;
+          SaberBase::sound_number = fileid.GetFileNum();
+        }
+        return;
+      }
+    }
+#endif
     wav.PlayOnce(fileid, start);
     SetStream(&wav);
+    LockSD_nomount(false);
     // Fill up the buffer, if possible.
     while (!wav.eof() && space_available()) {
-      scheduleFillBuffer();
+      FillBuffersAndWait();
     }
-    pause_.set(false);
+    Release();
     if (SaberBase::sound_length == 0.0 && effect->GetFollowing() != effect) {
       UpdateSaberBaseSoundInfo();
     }
   }
-  void PlayOnce(Effect* effect, float start = 0.0) override    // need to call this from volume_overlay
-  {
+  void PlayOnce(Effect* effect, float start = 0.0) {
     PlayOnce(effect->RandomFile(), start);
   }
 
+  // Play |effect| from sample |when| on (see
+  // AudioDynamicMixer::sample_count()), while |from| fades out over
+  // |seconds| and stops. The buffer fills up in the meantime.
+  void CrossfadeAt(BufferedWavPlayer* from, Effect* effect, uint32_t when, float seconds) {
+    start_pending_.set(true);
+    PlayOnce(effect);
+    if (!dynamic_mixer.Schedule(MixerCommand::Crossfade(from, this, when, seconds))) {
+      from->ScheduledStop(seconds);
+      ScheduledStart(seconds);
+    }
+  }
+
+  // Called by the mixer.
+  void ScheduledStart(float seconds) override {
+    if (!start_pending_.get()) return;   // stopped since
+    start_pending_.set(false);
+    if (seconds > 0.0) {
+      int target = volume_target();
+      set_volume_now(0);
+      set_fade_time(seconds);
+      set_volume(target);
+    }
+    stats_.play_start = micros();
+    pause_.set(false);
+    Activate();
+  }
+
+  void ScheduledStop(float seconds) override {
+    if (seconds > 0.0) {
+      set_fade_time(seconds);
+      VolumeOverlay::FadeAndStop();
+      return;
+    }
+    // Silent from this sample on; FillBuffer() stops the wav.
+    pause_.set(true);
+    start_pending_.set(false);
+    repeatingEff = 0;
+    wav.PlayNext(nullptr);
+    BufferedAudioStream::Stop();
+    scheduleFillBuffer();
+  }
+
   void Stop() override {
     // STDOUT.println("[BufferedWavPlayer.Stop]");
+    // Not from the mixer, which uses ScheduledStop().
+    LockSD_nomount(true);   // FillBuffer() is done and won't run
     pause_.set(true);
+    start_pending_.set(false);
     wav.Stop();
     wav.Close();
     clear();
     PlayNext(0);
     repeatingEff = 0;   // signal nothing is repeating
+    LockSD_nomount(false);
   }
 
 
@@ -159,7 +239,6 @@ public:
     pause_.set(true);
     wav.Stop();
   }
-  void ResetWav() override { wav.Reset();  }
   
 
 
@@ -175,28 +254,61 @@ public:
   
   bool isPlaying() const {
     if (repeatingEff) return true;    // keep active if repeating
+    if (start_pending_.get()) return true;
     return !pause_.get() && (wav.isPlaying() || buffered());
   }
 
   BufferedWavPlayer() : VolumeOverlay(),  pause_(true) { SetStream(&wav);  }
+
+  // Sample buffer (power of 2) and SD read buffer, set at startup, or
+  // by GetFreeWavPlayer() with WAV_BUFFER_POOL.
+  void SetBuffers(int16_t* samples, size_t num_samples,
+                  unsigned char* read_buffer, size_t read_size) {
+    SetBuffer(samples, num_samples);
+    wav.SetReadBuffer(read_buffer, read_size);
+  }
+  // Leaves the player without buffers; FillBuffer() must not be running.
+  void ClearBuffers() {
+    clear();
+    SetBuffers(nullptr, 0, nullptr, 0);
+  }
+  bool has_buffers() const { return buffer_size() != 0; }
+  size_t read_size() const { return wav.read_size(); }
+  unsigned char* read_buffer() const { return wav.read_buffer(); }
   
 
   
   // This makes a paused player report very little available space, which
-  // means that it will be low priority for reading.
+  // means that it will be low priority for reading. One waiting for a
+  // scheduled start fills up as usual.
   size_t space_available() override {
-    size_t ret = VolumeOverlay<BufferedAudioStream<AUDIO_BUFFER_SIZE_BYTES>>::space_available();
-    if (pause_.get() && ret) ret = 2; // still slightly higher than FromFileStyle<>
+    size_t ret = VolumeOverlay<BufferedAudioStream>::space_available();
+    if (pause_.get() && !start_pending_.get() && ret) ret = 2; // still slightly higher than FromFileStyle<>
+    return ret;
+  }
+
+  // A paused player is not being read from, so it is never urgent.
+  uint32_t samples_to_underrun() override {
+    uint32_t ret = VolumeOverlay<BufferedAudioStream>::samples_to_underrun();
+    if (pause_.get() && !start_pending_.get()) ret += kNotConsumed;
     return ret;
   }
 
   int read(int16_t* dest, int to_read) override {
     if (pause_.get()) return 0;
-    return VolumeOverlay<BufferedAudioStream<AUDIO_BUFFER_SIZE_BYTES> >::read(dest, to_read);
+    return VolumeOverlay<BufferedAudioStream>::read(dest, to_read);
+  }
+  int read_gain(int16_t* dest, int to_read, int32_t* gain) override {
+    *gain = kUnityGain;
+    if (pause_.get()) return 0;
+    int32_t fill = buffered();
+    int ret = VolumeOverlay<BufferedAudioStream>::read_gain(dest, to_read, gain);
+    UpdateStats(fill, dest, ret, to_read);
+    return ret;
   }
   bool eof() const override {
     if (pause_.get()) return true;
-    return VolumeOverlay<BufferedAudioStream<AUDIO_BUFFER_SIZE_BYTES> >::eof();
+    return VolumeOverlay<BufferedAudioStream>::eof();
   }
 
   float length() const { return wav.length(); }
@@ -209,11 +321,55 @@ public:
     return wav.filename();
   }
 
+  // Set by GetFreeWavPlayer(), for voice stealing.
+  void set_priority(uint8_t priority) {
+    priority_ = priority;
+    started_ = millis();
+  }
+  uint8_t priority() const { return priority_; }
+  uint32_t started() const { return started_; }
+
+#if VOICE_STEALING
+  // Hand the rest of the current sound to |fade|, which fades it out from
+  // the very next sample the mixer reads, and stop.
+  void StealInto(StolenVoiceFade* fade) {
+    LockSD_nomount(true);   // FillBuffer() is done and won't run
+    {
+      ScopedMixerLock lock;
+      if (!pause_.get() && has_buffers()) {
+        fade->Add(buffer(), buffer_size(), read_pos(), buffered(), volume() * kUnityGain);
+      }
+      pause_.set(true);
+    }
+    LockSD_nomount(false);
+    Stop();
+  }
+#endif
+
   void AddRef() { refs_++; }
   void SubRef() { refs_--; }
   bool Available() const { return refs_ == 0 && !isPlaying(); }
   uint32_t refs() const { return refs_; }
 
+  void ResetStats() { stats_.Reset(wav.bytes_read(), wav.reads()); }
+  const WavPlayerStats& stats() const { return stats_; }
+  uint32_t underflows() const { return stats_.underflows; }
+
+  void DumpStats() {
+    uint32_t ms = millis() - stats_.reset_time;
+    STDOUT << " underflows=" << stats_.underflows
+           << " fill min=" << stats_.fill.min << " avg=" << stats_.fill.avg
+           << " of " << buffer_size()
+           << " quarters=" << stats_.fill_histogram[0] << "/" << stats_.fill_histogram[1]
+           << "/" << stats_.fill_histogram[2] << "/" << stats_.fill_histogram[3]
+           << " bytes/s=" << (uint32_t)(ms ? (wav.bytes_read() - stats_.reset_bytes) * 1000ULL / ms : 0)
+           << " reads/s=" << (uint32_t)(ms ? (wav.reads() - stats_.reset_reads) * 1000ULL / ms : 0)
+           << " start latency us min=" << stats_.start_latency.min
+           << " avg=" << stats_.start_latency.avg
+           << " max=" << stats_.start_latency.max
+           << "\n";
+  }
+
   void dump() {
     STDOUT << " pause=" << pause_.get()
 	   << " buffered=" << buffered()
@@ -247,29 +403,12 @@ bool PlayEffect(Effect* soundEffect, int soundID=-1, uint16_t repeat=0, float vo
     if (soundID==-1) soundEffect->Select(-1);         // random
     if (volume==0) reset_volume();     // restore volume, might have faded out previously
     else set_volume_now(volume);            // .. or set to specified value
+    // 4. Set repeat. PlayWav times the repeats in samples.
     noInterrupts();
-    // PlayOnce(soundEffect);
-    
-    // 3. Set repeat
-    if (repeat) repeatingEff = soundEffect;  // store repeating effect for any type of repeat, so we can change rate later
-    else repeatingEff = 0;
-    if (repeater) repeater->Stop();           // stop long repeat task
-    wav.delayedRepeat = 0;                    // assume no repeat
-    wav.PlayNext(soundEffect);                // but assign an effect so SetRepeat knows what to work with
-    if (!repeat || repeat==1) {  // No repeat or loop: apply now
-        // if (repeater) repeater->Stop();        // stop repeat task, certainly not needed
-        wav.SetRepeat(repeat);
-    }
-    else { // Timed repeat: apply after start reading the file, so we can know its length
-        if (!repeater) repeater = new RepeatTask();       // prepare a repeat task now, just in case it's a long repeat  
-        repeater->Set(this, soundEffect, repeat);
-        soundEffect->SetFollowing(soundEffect);   // PlayOnce will set effect_ to soundEffect, the delayed SetRepeat will need it
-        wav.delayedRepeat = repeat;               // loop() will call SetRepeat later, triggered by ISR. delayedRepeat holds the requested repeat time
-        wav.longRepeat = &repeater->running;      // magic glue
-    }
+    repeatingEff = repeat ? soundEffect : 0;  // store repeating effect for any type of repeat, so we can change rate later
+    wav.PlayNext(soundEffect);                // so SetRepeat knows what to work with
+    wav.SetRepeat(repeat);
     interrupts();
-    // if (!pause_ && (wav.isPlaying() || buffered())) FadeAndPlay(soundEffect); 
-    // else PlayOnce(soundEffect);
     PlayOnce(soundEffect);
 
     return true;
@@ -279,77 +418,16 @@ bool PlayEffect(Effect* soundEffect, int soundID=-1, uint16_t repeat=0, float vo
   // 0 = not repeating, 1 = short repeat, 2 = loop, 3 = long repeat
   // uint8_t Repeating() { return wav.Repeating(); }
 
-  // 0: no repeat; 1: loop; >1: repeat at 'milli' milliseconds
+  // 0: no repeat; 1: loop; >1: repeat at 'milli' milliseconds.
+  // A new period applies from the next repeat on.
   void ChangeRepeatTime(uint16_t milli) {
-    // 1. Stop
     if (!repeatingEff) return;          // nothing to do, no repeat active 
-    if (!milli) {
-        // STDOUT.println("any repeat -> no repeat");
-        // if (repeater) repeater->Stop();
-        if (wav.longRepeat) *(wav.longRepeat) = 0;    //  stop repeater and prevent long repeat
-        wav.shortRepeatTime = 0;  // prevent short repeat
-        wav.effect_ = 0;          // prevent looping
-        wav.longRepeat = 0;       // signal no repeating
-        repeatingEff = 0;         
-        return;
-    }
-    
-    
     noInterrupts();
-    uint32_t soundDuration = 1000 * length();
-    // STDOUT.print("[ChangeRepeatTime] change to "); STDOUT.print(milli); STDOUT.print(", sound duration = "); STDOUT.print(soundDuration); STDOUT.print("[ms]: ");
-    if (*(wav.longRepeat)) { // currently on long repeat 
-        if (milli == 1 || milli == soundDuration) {
-            // STDOUT.println("long -> loop");
-            wav.effect_.set(repeatingEff);
-            wav.effect_.get()->SetFollowing(repeatingEff);
-            *(wav.longRepeat) = false ;    // stop RepeatTask
-            // repeater->Stop();
-        }
-        else if (milli > soundDuration) {
-            // STDOUT.println("long -> long");
-            repeater->longRepeatTime = milli;
-        }
-        else {
-            // STDOUT.println("long -> short");
-            PlayEffect(repeatingEff, 0, milli);  // TODO: smooth transition
-        }
-    }
-    else if (wav.shortRepeatTime) { // currently on short repeat
-        if (milli == 1 || milli == soundDuration) {
-            // STDOUT.println("short -> loop");
-            wav.shortRepeatTime = 0;
-        }
-        else if (milli > soundDuration) {
-            // STDOUT.println("short -> long");
-            wav.shortRepeatTime = 0;    // stop short
-            wav.effect_.get()->SetFollowing(0);
-            wav.effect_.set(nullptr);            // prevent looping 
-            if (!repeater) repeater = new RepeatTask();
-            else repeater->Stop();
-            repeater->Set(this, repeatingEff, milli);
-            wav.longRepeat = &repeater->running;      // magic glue
-            *(wav.longRepeat) = true;                 // also starts repeater
-            // repeater->Start();
-        }
-        else {
-            // STDOUT.println("short -> short");
-            wav.shortRepeatTime = milli+1;
-        }    
-    }
-    else { // currently looping
-        if (milli == 1 || milli == soundDuration) {
-            // STDOUT.println("loop -> loop, do nothing");
-        }
-        else if (milli > soundDuration) {
-            // STDOUT.println("loop -> long");
-            PlayEffect(repeatingEff, 0, milli);
-
-        }
-        else {
-            // STDOUT.println("loop -> short");
-            PlayEffect(repeatingEff, 0, milli);
-        }
+    if (!milli) {
+      wav.SetRepeat(0);     // the current repeat plays out
+      repeatingEff = 0;
+    } else {
+      wav.SetRepeat(milli == 1 ? 1 : milli + 1);
     }
     interrupts();
   }
@@ -357,10 +435,6 @@ bool PlayEffect(Effect* soundEffect, int soundID=-1, uint16_t repeat=0, float vo
   // Fade out volume over 'milli' [ms], then stop 
   void FadeAndStop(uint16_t speed = 125) {
     noInterrupts();
-    if (repeater) repeater->Stop();
-    wav.shortRepeatTime = 0;
-    if(repeater)
-    *(wav.longRepeat) = false;
     wav.PlayNext(0);  
     repeatingEff = 0;  
     set_speed(speed);
@@ -373,14 +447,45 @@ bool PlayEffect(Effect* soundEffect, int soundID=-1, uint16_t repeat=0, float vo
   private:
   Effect* repeatingEff;
 
+  // Start reading, unless the mixer is to start us (see CrossfadeAt()).
+  void Release() {
+    if (start_pending_.get()) return;
+    pause_.set(false);
+    Activate();
+  }
+
   
 
 
 private:
+  void UpdateStats(int32_t fill, const int16_t* data, int got, int wanted) {
+    if (!buffer_size()) return;
+    stats_.fill.Add(fill);
+    stats_.fill_histogram[std::min<size_t>(fill * 4 / buffer_size(), 3)]++;
+    if (got < wanted && !eof()) stats_.underflows++;
+    if (stats_.waiting_for_sound) {
+      for (int i = 0; i < got; i++) {
+        if (data[i]) {
+          stats_.start_latency.Add(micros() - stats_.play_start);
+          stats_.waiting_for_sound = false;
+          if (WavPlayerStats::preset_change_pending.get()) {
+            WavPlayerStats::preset_change_latency.Add(micros() - WavPlayerStats::preset_change_start);
+            WavPlayerStats::preset_change_pending.set(false);
+          }
+          break;
+        }
+      }
+    }
+  }
+
+  WavPlayerStats stats_;
   uint32_t refs_ = 0;
+  uint8_t priority_ = 0;
+  uint32_t started_ = 0;
 
   PlayWav wav;
   POAtomic<bool> pause_;
+  POAtomic<bool> start_pending_;   // waiting for a MixerCommand::Crossfade
 };
 
 
@@ -62,6 +62,7 @@ class LS_DAC : CommandParser, Looper, public PowerSubscriber {
                             // how maby bytes do we now have to send
                             int n = 0;
                             if (stream_) {
+                              ScopedCycleCounter cc(audio_dma_interrupt_cycles);
                               n = dynamic_mixer.read(data, AUDIO_BUFFER_SIZE);
                               // if(n < AUDIO_BUFFER_SIZE)
                               // {
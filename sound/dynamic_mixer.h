@@ -4,6 +4,118 @@
 #include <algorithm>
 #include "../common/atomic.h"
 
+// The mixer works in sub-blocks of AUDIO_MIXER_BLOCK samples: the compressor
+// envelope and the gain are computed once per sub-block and the gain is
+// linearly interpolated across it, instead of a square root and a division
+// for every sample.
+#ifndef AUDIO_MIXER_BLOCK
+#ifdef ARDUINO_ARCH_ESP32   // ESP architecture
+#define AUDIO_MIXER_BLOCK 16    // 128 = 8 x 16
+#else
+#define AUDIO_MIXER_BLOCK 11    // 44 = 4 x 11, 0.25 ms
+#endif
+#endif
+
+// Envelope decay over n samples, (255/256)^n in 1/256 units.
+constexpr int32_t MixerDecay(int n, int32_t d = 1 << 16) {
+  return n ? MixerDecay(n - 1, d * 255 / 256) : (d + 128) >> 8;
+}
+const int32_t kMixerBlockDecay = MixerDecay(AUDIO_MIXER_BLOCK);
+
+#if defined(__ARM_FEATURE_DSP)
+// Cortex-M4: single-cycle saturation
+#define MIXER_SAT16(X) __SSAT((X), 16)
+#else
+#define MIXER_SAT16(X) clamptoi16(X)
+#endif
+
+#include "post_mix.h"
+#include "mixer_buses.h"
+
+// Commands the mixer carries out at an exact output sample, see
+// AudioDynamicMixer::Schedule(). Only crossfades so far, used for the
+// monophonic hum swap. Preon, out and hum follow each other without a gap
+// through Effect::SetFollowing(); other starts and stops, SmoothSwing's
+// included, still happen whenever loop() gets to them.
+#ifndef MIXER_QUEUE_SIZE
+#define MIXER_QUEUE_SIZE 16    // power of 2
+#endif
+
+struct MixerCommand {
+  // |from| fades out and stops while |to| starts and fades in.
+  static MixerCommand Crossfade(ProffieOSAudioStream* from, ProffieOSAudioStream* to,
+                                uint32_t when, float seconds) {
+    return MixerCommand{when, from, to, seconds};
+  }
+
+  void Run() const {
+    from->ScheduledStop(seconds);
+    to->ScheduledStart(seconds);
+  }
+
+  uint32_t when;       // AudioDynamicMixer::sample_count() to run at
+  ProffieOSAudioStream* from;
+  ProffieOSAudioStream* to;
+  float seconds;
+};
+
+// Widen 16-bit samples into the 32-bit sum, either overwriting it (first
+// stream) or accumulating, and apply the stream's Q14 gain on the way.
+// Two samples per 32-bit load; src must be 4-byte aligned.
+template<bool ACCUMULATE>
+__attribute__((optimize("Ofast")))
+inline void MixerAdd(int32_t* sum, const int16_t* src, int n, int32_t gain) {
+  const uint32_t* s = (const uint32_t*)src;
+  int i = 0;
+  if (gain == kUnityGain) {
+    for (; i + 1 < n; i += 2) {
+      uint32_t w = *s++;
+      int32_t lo = (int16_t)w;            // SXTAH on Cortex-M4
+      int32_t hi = ((int32_t)w) >> 16;
+      if (ACCUMULATE) { sum[i] += lo; sum[i + 1] += hi; }
+      else { sum[i] = lo; sum[i + 1] = hi; }
+    }
+    if (i < n) {
+      if (ACCUMULATE) sum[i] += src[i];
+      else sum[i] = src[i];
+    }
+  } else {
+    for (; i + 1 < n; i += 2) {
+      uint32_t w = *s++;
+      int32_t lo = ((int16_t)w * gain) >> kGainShift;
+      int32_t hi = ((((int32_t)w) >> 16) * gain) >> kGainShift;
+      if (ACCUMULATE) { sum[i] += lo; sum[i + 1] += hi; }
+      else { sum[i] = lo; sum[i + 1] = hi; }
+    }
+    if (i < n) {
+      int32_t v = (src[i] * gain) >> kGainShift;
+      if (ACCUMULATE) sum[i] += v;
+      else sum[i] = v;
+    }
+  }
+}
+
+// Keeps the mixer from reading its streams while loop() changes what one
+// of them plays. Elsewhere the mixer runs in the audio DMA interrupt, so
+// turning interrupts off is enough. On ESP32 it runs in the I2S writer
+// task, which interrupts off doesn't keep out, so the mixer holds a mutex
+// while it reads.
+class ScopedMixerLock {
+public:
+#ifdef ARDUINO_ARCH_ESP32   // ESP architecture
+  ScopedMixerLock() { xSemaphoreTake(mutex(), portMAX_DELAY); }
+  ~ScopedMixerLock() { xSemaphoreGive(mutex()); }
+  static SemaphoreHandle_t mutex() {
+    static StaticSemaphore_t buffer;
+    static SemaphoreHandle_t mutex = xSemaphoreCreateMutexStatic(&buffer);
+    return mutex;
+  }
+#else
+  ScopedMixerLock() { noInterrupts(); }
+  ~ScopedMixerLock() { interrupts(); }
+#endif
+};
+
 // Audio compressor, takes N input channels, sums them and divides the
 // result by the square root of the average volume.
 template<int N> class AudioDynamicMixer : public ProffieOSAudioStream, Looper {
@@ -58,41 +170,199 @@ public:
   int last_square_ = 0;
 #endif
   
-  int read(int16_t* data, int elements) override __attribute__((optimize("Ofast")))  {
+  // Update the compressor envelope with the sum of |v| over one sub-block.
+  // Equivalent to running vol_ = ((vol_ + |v|) * 255) >> 8 on every sample
+  // of a block with constant level, but costs one multiply per block.
+  // Sub-blocks cut short by a scheduled command decay for |n| samples only.
+  void UpdateEnvelope(int32_t abs_sum, int n) {
+    int32_t target = abs_sum / n * 255;
+    int32_t decay = n == AUDIO_MIXER_BLOCK ? kMixerBlockDecay : MixerDecay(n);
+    vol_ += ((target - vol_) * (256 - decay)) >> 8;
+  }
 
+  // Gain for the current envelope, Q14.
+  int32_t BlockGain() {
+#ifdef ARDUINO_ARCH_ESP32   // ESP architecture
+    return (volume_ << 14) / ((int32_t)sqrtf(vol_) + 100);  // was my_sqrt
+#else
+    return (volume_ << 14) / (my_sqrt(vol_) + 100);
+#endif
+  }
+
+  // Link in all streams that called Activate() since the last read.
+  // Only the mixer touches the active list, so this needs no locking.
+  void LinkPendingStreams() {
+    ProffieOSAudioStream::activate_pending_ = false;
+    for (int i = 0; i < N; i++) {
+      ProffieOSAudioStream* s = streams_[i];
+      if (!s || !s->activate_) continue;
+      s->activate_ = false;
+      if (s->active_) continue;
+      s->active_ = true;
+      s->next_active_ = active_streams_;
+      active_streams_ = s;
+    }
+  }
+
+  // Sum all active streams into sum[0..to_do), each at its own gain times
+  // its bus gain. Streams that have reached eof() are dropped from the
+  // active list.
+  void SumStreams(int32_t* sum, int to_do) __attribute__((optimize("Ofast"))) {
+    int16_t tmp[AUDIO_BUFFER_SIZE] __attribute__((aligned(4)));
+    bool first = true;
+    if (ProffieOSAudioStream::activate_pending_) LinkPendingStreams();
+#if MIXER_BUSES
+    buses_.Update(to_do);
+#endif
+    ProffieOSAudioStream** prev = &active_streams_;
+    while (ProffieOSAudioStream* s = *prev) {
+      int32_t gain;
+      int e = s->read_gain(tmp, to_do, &gain);
+      if (e < to_do) {
+        if (s->eof()) {
+          *prev = s->next_active_;
+          s->active_ = false;
+        } else {
+          underflow_count_ += 1;
+        }
+      }
+      if (s->active_) prev = &s->next_active_;
+#if MIXER_BUSES
+      uint8_t bus = s->bus_;
+      gain = (gain * buses_.block_gain(bus)) >> kGainShift;
+      if (!e || !gain) continue;
+      if (bus == BUS_VOICE) {
+        int32_t peak = 0;
+        for (int j = 0; j < e; j++) peak = std::max<int32_t>(peak, abs(tmp[j]));
+        buses_.AddKey((peak * gain) >> kGainShift);
+      }
+#else
+      if (!e || !gain) continue;
+#endif
+      if (first) {
+        MixerAdd<false>(sum, tmp, e, gain);
+        for (int j = e; j < to_do; j++) sum[j] = 0;
+        first = false;
+      } else {
+        MixerAdd<true>(sum, tmp, e, gain);
+      }
+    }
+    if (first) for (int j = 0; j < to_do; j++) sum[j] = 0;
+  }
+
+  // Index of the next sample the mixer will produce. Schedule() commands
+  // relative to this; a command that is already due runs at the start of
+  // the next read().
+  uint32_t sample_count() const { return num_samples_.get(); }
+
+  // Queue a command to run right before sample |cmd.when| is mixed.
+  // Call from loop() only. Returns false if the queue is full.
+  bool Schedule(const MixerCommand& cmd) {
+    uint32_t head = queue_head_.get();
+    if (head - queue_tail_.get() >= MIXER_QUEUE_SIZE) return false;
+    incoming_[head & (MIXER_QUEUE_SIZE - 1)] = cmd;
+    queue_head_.set(head + 1);
+    return true;
+  }
+
+  // Move newly scheduled commands into pending_, which is kept sorted by
+  // time; commands for the same sample keep the order they were queued in.
+  void FetchCommands() {
+    uint32_t head = queue_head_.get();
+    uint32_t tail = queue_tail_.get();
+    for (; tail != head && num_pending_ < MIXER_QUEUE_SIZE; tail++) {
+      const MixerCommand& cmd = incoming_[tail & (MIXER_QUEUE_SIZE - 1)];
+      int i = num_pending_++;
+      for (; i > 0 && (int32_t)(pending_[i - 1].when - cmd.when) > 0; i--) {
+        pending_[i] = pending_[i - 1];
+      }
+      pending_[i] = cmd;
+    }
+    queue_tail_.set(tail);
+  }
+
+  // Run the commands that are due and return how many samples (at most
+  // |to_do|) can be mixed before the next one is.
+  int RunCommands(int to_do) {
+    if (queue_head_.get() != queue_tail_.get()) FetchCommands();
+    int done = 0;
+    uint32_t now = num_samples_.get();
+    for (; done < num_pending_; done++) {
+      int32_t delta = pending_[done].when - now;
+      if (delta > 0) {
+        to_do = std::min<int32_t>(to_do, delta);
+        break;
+      }
+      pending_[done].Run();
+    }
+    if (done) {
+      num_pending_ -= done;
+      for (int i = 0; i < num_pending_; i++) pending_[i] = pending_[i + done];
+    }
+    return to_do;
+  }
+
+  // Number of streams currently on the active list.
+  int active_streams() const {
+    int ret = 0;
+    for (ProffieOSAudioStream* s = active_streams_; s; s = s->next_active_) ret++;
+    return ret;
+  }
+
+  int read(int16_t* data, int elements) override __attribute__((optimize("Ofast")))  {
+#ifdef ARDUINO_ARCH_ESP32   // ESP architecture
+    ScopedMixerLock lock;   // elsewhere this is the interrupt
+#endif
     int32_t sum[AUDIO_BUFFER_SIZE];
     int ret = elements;
     int v = 0, v2 = 0;
-    num_samples_ += elements;
     while (elements) {
-      int to_do = std::min(elements, (int)NELEM(sum));
-      for (int i = 0; i < to_do; i++) sum[i] = 0;
-      for (int i = 0; i < N; i++) {
-	if (!streams_[i]) continue;
-        int e = streams_[i]->read(data, to_do);
-	if (e < to_do && !streams_[i]->eof()) {
-	  underflow_count_ += 1;
-	}
-        for (int j = 0; j < e; j++) {
-          sum[j] += data[j];
+      int to_do = RunCommands(std::min(elements, (int)NELEM(sum)));
+      SumStreams(sum, to_do);
+
+      for (int b = 0; b < to_do; b += AUDIO_MIXER_BLOCK) {
+        int n = std::min(to_do - b, AUDIO_MIXER_BLOCK);
+        int32_t* s = sum + b;
+        int32_t abs_sum = 0, peak = 0;
+        for (int i = 0; i < n; i++) {
+          int32_t a = abs(s[i]);
+          abs_sum += a;
+          peak = std::max(peak, a);
         }
-      }
+        peak_sum_ = std::max(peak, peak_sum_);
+        UpdateEnvelope(abs_sum, n);
 
-      for (int i = 0; i < to_do; i++) {
-        v = sum[i];
-        vol_ = ((vol_ + abs(v)) * 255) >> 8;
-		#ifdef ARDUINO_ARCH_ESP32   // ESP architecture
-        	v2 = v * volume_ / (sqrtf(vol_) + 100);  // was my_sqrt 
-		#else
-			v2 = v * volume_ / (my_sqrt(vol_) + 100);
-		#endif
-
-        data[i] = clamptoi16(v2);
-        peak_sum_ = std::max<int32_t>(abs(v), peak_sum_);
-        peak_ = std::max<int32_t>(abs(v2), peak_);
+#if POST_MIX_DSP
+        bool post = post_mix_.active();
+        int32_t g1 = post ? post_mix_.Gain(volume_) : BlockGain();
+#else
+        int32_t g1 = BlockGain();
+#endif
+        // Interpolate from the previous block's gain to this one.
+        int32_t g = gain_;
+        int32_t step = (g1 - g) / n;
+        int16_t* out = data + b;
+        for (int i = 0; i < n; i++) {
+          g += step;
+          v = s[i];
+          v2 = ((int64_t)v * g) >> 14;
+#if POST_MIX_DSP
+          if (post) {
+            s[i] = v2;
+            continue;
+          }
+#endif
+          out[i] = MIXER_SAT16(v2);
+        }
+#if POST_MIX_DSP
+        if (post) post_mix_.Process(s, out, n);
+#endif
+        peak_ = std::max<int32_t>(((int64_t)peak * g1) >> 14, peak_);
+        gain_ = g1;
       }
       data += to_do;
       elements -= to_do;
+      num_samples_ += to_do;
     }
     last_sample_ = v2;
     last_sum_ = v;
@@ -105,31 +375,32 @@ public:
   int read(float* data, int elements) {
     
     int32_t sum[AUDIO_BUFFER_SIZE];
-    int16_t tmp[AUDIO_BUFFER_SIZE];
     int ret = elements;
     int v = 0, v2 = 0;
-    num_samples_ += elements;
     while (elements) {
-      int to_do = std::min(elements, (int)NELEM(sum));
-      for (int i = 0; i < to_do; i++) sum[i] = 0;
-      for (int i = 0; i < N; i++) {
-	if (!streams_[i]) continue;
-        int e = streams_[i]->read(tmp, to_do);
-	if (e < to_do && !streams_[i]->eof()) {
-	  underflow_count_ += 1;
-	}
-        for (int j = 0; j < e; j++) {
-          sum[j] += tmp[j];
-        }
-      }
+      int to_do = RunCommands(std::min(elements, (int)NELEM(sum)));
+      SumStreams(sum, to_do);
+
+      for (int b = 0; b < to_do; b += AUDIO_MIXER_BLOCK) {
+        int n = std::min(to_do - b, AUDIO_MIXER_BLOCK);
+        int32_t* s = sum + b;
+        int32_t abs_sum = 0;
+        for (int i = 0; i < n; i++) abs_sum += abs(s[i]);
+        UpdateEnvelope(abs_sum, n);
 
-      for (int i = 0; i < to_do; i++) {
-        v = sum[i];
-        vol_ = ((vol_ + abs(v)) * 255) >> 8;
-	data[i] = v / (sqrtf(vol_) + 100.0f);
+        float g1 = 1.0f / (sqrtf(vol_) + 100.0f);
+        float g = fgain_;
+        float step = (g1 - g) / n;
+        for (int i = 0; i < n; i++) {
+          g += step;
+          v = s[i];
+          data[b + i] = v * g;
+        }
+        fgain_ = g1;
       }
       data += to_do;
       elements -= to_do;
+      num_samples_ += to_do;
     }
     last_sample_ = v2 * volume_;
     last_sum_ = v;
@@ -176,13 +447,31 @@ public:
   
   int32_t get_volume() const { return volume_; }
 
+  // All streams that may be activated; only scanned when one asks to be.
   ProffieOSAudioStream* streams_[N];
+  ProffieOSAudioStream* active_streams_ = nullptr;
   int32_t vol_ = 0;
+  int32_t gain_ = 0;      // gain applied at the end of the last sub-block, Q14
+  float fgain_ = 0.0f;
   int32_t last_sample_ = 0;
   int32_t last_sum_ = 0;
   int32_t peak_sum_ = 0;
   int32_t peak_ = 0;
-  int32_t num_samples_ = 0;
+  POAtomic<uint32_t> num_samples_;
+#if POST_MIX_DSP
+  PostMix post_mix_;
+#endif
+#if MIXER_BUSES
+  MixerBuses buses_;
+#endif
+
+  // Commands from Schedule(), which only writes incoming_ and queue_head_.
+  // The rest is only touched by read().
+  MixerCommand incoming_[MIXER_QUEUE_SIZE];
+  POAtomic<uint32_t> queue_head_;
+  POAtomic<uint32_t> queue_tail_;
+  MixerCommand pending_[MIXER_QUEUE_SIZE];
+  int num_pending_ = 0;
   int32_t volume_ = VOLUME;
   POAtomic<uint32_t> underflow_count_;
   uint32_t last_underflow_count_ = 0;
@@ -191,6 +480,6 @@ public:
 //  ClickAvoiderLin volume_;
 };
 
-AudioDynamicMixer<NUM_WAV_PLAYERS + 2> dynamic_mixer;
+AudioDynamicMixer<NUM_WAV_PLAYERS + 2 + PAIRED_SWING_PLAYER + VOICE_STEALING> dynamic_mixer;
 
 #endif
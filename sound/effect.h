@@ -8,6 +8,16 @@
 class Effect;
 Effect* all_effects = NULL;
 
+// Keep an index of what was found in each font, so that switching back
+// to it doesn't have to match every file against every effect again.
+#if defined(ENABLE_SD) && !defined(ENABLE_SERIALFLASH) && !defined(DISABLE_FONT_INDEX)
+#define ENABLE_FONT_INDEX
+#endif
+
+#ifndef FONT_INDEX_NAME
+#define FONT_INDEX_NAME "scan.idx"
+#endif
+
 // Zero-indexed
 int current_alternative = 0;
 // num_alternatives == 3 means alt000/, alt001/, alt002/
@@ -519,11 +529,12 @@ class Effect {
     char fname[128];
     const char* font_path_ptr;
 
-    bool isNameDigits(const char* prefix, const char* dir) const {
+    static bool isNameDigits(const char* prefix, const char* dir) {
       return startswith(prefix, dir) && isAllDigits(dir + strlen(prefix));
     }
 
-    bool ShouldScan(const char* dir) const {
+  public:
+    static bool ShouldScan(const char* dir) {
       if (isNameDigits("alt", dir) && strlen(dir) == 6) return true;
       if (isNameDigits("", dir)) return true;
       for (Effect* e = all_effects; e; e = e->next_) {
@@ -533,7 +544,8 @@ class Effect {
       }
       return false;
     }
-    
+
+  private:
     void ScanIterator(LSFS::Iterator& iter) {
       // fprintf(stderr, "SCANITER: %s\n", fname);
       char* fend = fname;
@@ -604,18 +616,279 @@ class Effect {
 #endif   // ENABLE_SD
   }
 
-  static void ScanCurrentDirectory() {
-    LOCK_SD(true);
+#ifdef ENABLE_FONT_INDEX
+  // The index is a header followed by one IndexEntry per effect found.
+  // It is only used if every font directory still holds sound files with
+  // the same names, in the same sound subdirectories, and the firmware is
+  // the same. What the scan finds only depends on the names, so replacing
+  // a file with another one of the same name needs no rescan.
+  static const uint32_t kIndexMagic = 0x58444950;  // "PIDX"
+
+  struct IndexHeader {
+    uint32_t magic;
+    uint32_t fingerprint;
+    uint16_t entry_size;
+    uint16_t entries;
+    uint8_t num_alternatives;
+  };
+
+  struct IndexEntry {
+    uint32_t name;           // checksum of name_
+    int16_t max_file;
+    int16_t num_files;
+    int8_t min_file;
+    uint8_t sub_files;
+    int8_t digits;
+    uint8_t flags;           // 1 = unnumbered file, 2 = found in alt dir
+    FilePattern file_pattern;
+    uint8_t ext;
+    uint8_t directory;       // which of the current directories
+  };
+
+  static uint32_t NameChecksum(const char* name) {
+    CheckSummer sum;
+    sum.Write((const uint8_t*)name, strlen(name));
+    return sum.checksum_;
+  }
+
+  // Adds the name of one directory entry, and of everything below it for
+  // a sound subdirectory. Returns false for entries the scanner skips.
+  // Only the directory entries are read; file sizes are left out, as they
+  // cost a stat() per file on the host and don't change what the scan
+  // finds.
+  static bool FingerprintEntry(CheckSummer& sum, LSFS::Iterator& iter) {
+    const char* name = iter.name();
+    if (name[0] == '.') return false;
+    bool dir = iter.isdir();
+    if (dir ? !Scanner::ShouldScan(name) : IdentifyExtension(name) == UNKNOWN) return false;
+    sum.Write((const uint8_t*)name, strlen(name) + 1);
+    if (dir) {
+      LSFS::Iterator sub(iter);
+      FingerprintIterator(sum, sub);
+    }
+    return true;
+  }
+
+  // Adds all entries, and the number of them, which also marks the end.
+  static void FingerprintIterator(CheckSummer& sum, LSFS::Iterator& iter) {
+    uint32_t entries = 0;
+    for (; iter; ++iter) entries += FingerprintEntry(sum, iter);
+    sum.Write((const uint8_t*)&entries, sizeof(entries));
+  }
+
+  // Computes IndexFingerprint() a few entries of the font directories at
+  // a time, so it can be spread over several calls; a sound subdirectory
+  // counts as one entry. Can also checksum the sizes of some other files
+  // in the font directories, like config files.
+  class FingerprintWalk {
+  public:
+    void Start(const char* dirs, const char* const* sized = nullptr, size_t num_sized = 0) {
+      dir_ = *dirs ? dirs : nullptr;
+      ok_ = !!dir_;
+      pos_ = 0;
+      entries_ = 0;
+      sum_ = CheckSummer();
+      sizes_ = CheckSummer();
+      sum_.Write((const uint8_t*)install_time, sizeof(install_time));
+      sized_ = sized;
+      num_sized_ = num_sized;
+    }
+
+    // Walks up to |entries| more entries. Returns true when done.
+    bool Step(uint32_t entries) {
+      if (!dir_) return true;
+      if (!pos_) {
+        if (!LSFS::Exists(dir_)) {
+          ok_ = false;
+          dir_ = nullptr;
+          return true;
+        }
+        sum_.Write((const uint8_t*)dir_, strlen(dir_) + 1);
+      }
+      LSFS::Iterator iter(dir_);
+      for (uint32_t i = 0; i < pos_ && iter; i++) ++iter;
+      for (; iter && entries; ++iter, entries--) {
+        pos_++;
+        if (FingerprintEntry(sum_, iter)) entries_++;
+        else AddSize(iter);
+      }
+      if (iter) return false;
+      sum_.Write((const uint8_t*)&entries_, sizeof(entries_));
+      dir_ = next_current_directory(dir_);
+      pos_ = 0;
+      entries_ = 0;
+      return !dir_;
+    }
+
+    // Same as IndexFingerprint(), once Step() returned true.
+    uint32_t fingerprint() const {
+      if (!ok_) return 0;
+      return sum_.checksum_ ? sum_.checksum_ : 1;
+    }
+    uint32_t sizes() const { return sizes_.checksum_; }
+
+  private:
+    void AddSize(LSFS::Iterator& iter) {
+      for (size_t i = 0; i < num_sized_; i++) {
+        if (strcmp(iter.name(), sized_[i])) continue;
+        uint32_t size = iter.size();
+        sizes_.Write((const uint8_t*)iter.name(), strlen(iter.name()) + 1);
+        sizes_.Write((const uint8_t*)&size, sizeof(size));
+        return;
+      }
+    }
+
+    const char* dir_ = nullptr;
+    uint32_t pos_ = 0;          // entries of dir_ done
+    uint32_t entries_ = 0;      // of those, the ones in the fingerprint
+    bool ok_ = false;
+    CheckSummer sum_;
+    CheckSummer sizes_;
+    const char* const* sized_ = nullptr;
+    size_t num_sized_ = 0;
+  };
+
+  // Checksum of what the index for the search path |dirs| depends on,
+  // 0 if it can't be used.
+  static uint32_t IndexFingerprint(const char* dirs = current_directory) {
+    FingerprintWalk walk;
+    walk.Start(dirs);
+    while (!walk.Step(0xFFFFFFFFu));
+    return walk.fingerprint();
+  }
+
+  void Restore(const IndexEntry& entry) {
+    min_file_ = entry.min_file;
+    max_file_ = entry.max_file;
+    sub_files_ = entry.sub_files;
+    digits_ = entry.digits;
+    num_files_ = entry.num_files;
+    unnumbered_file_found_ = !!(entry.flags & 1);
+    found_in_alt_dir_ = !!(entry.flags & 2);
+    file_pattern_ = entry.file_pattern;
+    ext_ = (Extension)entry.ext;
+    directory_ = current_directory;
+    for (int i = 0; i < entry.directory && directory_; i++) {
+      directory_ = next_current_directory(directory_);
+    }
+  }
+
+  // Opens the index and checks its header. Returns false, with |f|
+  // closed, if the index is missing or stale.
+  static bool OpenIndex(FileReader* f, const char* path, uint32_t fingerprint,
+                        IndexHeader* header) {
+    if (!f->OpenFast(path)) return false;
+    if (f->Read((uint8_t*)header, sizeof(*header)) != sizeof(*header) ||
+        header->magic != kIndexMagic ||
+        header->fingerprint != fingerprint ||
+        header->entry_size != sizeof(IndexEntry) ||
+        f->FileSize() != sizeof(*header) + header->entries * sizeof(IndexEntry)) {
+      f->Close();
+      return false;
+    }
+    return true;
+  }
+
+  static void RestoreIndex(const IndexEntry* entries, int n) {
+    for (int i = 0; i < n; i++) {
+      for (Effect* e = all_effects; e; e = e->next_) {
+        if (!e->persistent_ && NameChecksum(e->name_) == entries[i].name) {
+          e->Restore(entries[i]);
+          break;
+        }
+      }
+    }
+  }
+
+  // Returns false, with nothing restored, if the index is missing or stale.
+  static bool ReadIndex(const char* path, uint32_t fingerprint) {
+    FileReader f;
+    IndexHeader header;
+    IndexEntry entries[32];
+    if (!OpenIndex(&f, path, fingerprint, &header)) return false;
+    for (int left = header.entries; left > 0; ) {
+      int n = std::min<int>(left, NELEM(entries));
+      f.Read((uint8_t*)entries, n * sizeof(IndexEntry));
+      RestoreIndex(entries, n);
+      left -= n;
+    }
+    num_alternatives = header.num_alternatives;
+    f.Close();
+    return true;
+  }
+
+  static void WriteIndex(const char* path, uint32_t fingerprint) {
+    FileReader f;
+    if (!f.Create(path)) return;
+    IndexHeader header;
+    memset(&header, 0, sizeof(header));
+    header.magic = kIndexMagic;
+    header.fingerprint = fingerprint;
+    header.entry_size = sizeof(IndexEntry);
+    header.num_alternatives = num_alternatives;
+    for (Effect* e = all_effects; e; e = e->next_) {
+      if (!e->persistent_ && e->num_files_) header.entries++;
+    }
+    f.Write((const uint8_t*)&header, sizeof(header));
+    for (Effect* e = all_effects; e; e = e->next_) {
+      if (e->persistent_ || !e->num_files_) continue;
+      IndexEntry entry;
+      memset(&entry, 0, sizeof(entry));
+      entry.name = NameChecksum(e->name_);
+      entry.min_file = e->min_file_;
+      entry.max_file = e->max_file_;
+      entry.sub_files = e->sub_files_;
+      entry.digits = e->digits_;
+      entry.num_files = e->num_files_;
+      entry.flags = (e->unnumbered_file_found_ ? 1 : 0) | (e->found_in_alt_dir_ ? 2 : 0);
+      entry.file_pattern = e->file_pattern_;
+      entry.ext = e->ext_;
+      for (const char* dir = current_directory; dir && dir != e->directory_;
+           dir = next_current_directory(dir)) {
+        entry.directory++;
+      }
+      f.Write((const uint8_t*)&entry, sizeof(entry));
+    }
+    f.Close();
+  }
+#endif  // ENABLE_FONT_INDEX
+
+  static void ResetFontEffects() {
     current_alternative = 0;
     num_alternatives = 0;
     for (Effect* e = all_effects; e; e = e->next_) {
         if (!e->persistent_) e->reset();    // don't reset persistent effects
     }
+  }
 
+  static void ScanCurrentDirectory() {
+    LOCK_SD(true);
+    ResetFontEffects();
+
+#ifdef ENABLE_FONT_INDEX
+    PathHelper index_path(current_directory, FONT_INDEX_NAME);
+    uint32_t fingerprint = IndexFingerprint();
+    if (fingerprint && ReadIndex(index_path, fingerprint)) {
+  #if defined(DIAGNOSE_PRESETS)
+      STDOUT.print("Loaded font index ");
+      STDOUT.println(index_path);
+  #endif
+    } else {
+#endif
     for (const char* dir = current_directory; dir; dir = next_current_directory(dir)) {
       ScanOneDirectory(dir);
     }
+#ifdef ENABLE_FONT_INDEX
+      if (fingerprint) WriteIndex(index_path, fingerprint);
+    }
+#endif
 
+    CheckFontFiles();
+    LOCK_SD(false);
+  }
+
+  // Warn about effects with files missing.
+  static void CheckFontFiles() {
     bool warned = false;
     for (Effect* e = all_effects; e; e = e->next_) {
       if (!e->persistent_ && e->expected_files() != (size_t)(e->num_files_)) {
@@ -630,7 +903,6 @@ class Effect {
 	        e->Show();
       }
     }
-    LOCK_SD(false);
   }
 
 
@@ -776,6 +1048,7 @@ EFFECT2(swingl, swingl);  // Looped swing, LOW
 EFFECT2(swingh, swingh);  // Looped swing, HIGH
 EFFECT2(lswing, lswing);  // Looped swing, LOW (plecter naming)
 EFFECT2(hswing, hswing);  // Looped swing, HIGH (plecter naming)
+EFFECT2(swingp, swingp);  // Looped swing, LOW left and HIGH right (PairedWavPlayer)
 
 // Drag effect, replaces "lock/lockup" in drag mode if present.
 EFFECT(bgndrag);
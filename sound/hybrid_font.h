@@ -136,6 +136,12 @@ public:
   HybridFont() : SaberBase(NOLINK), Looper(NOLINK) { }
   void Activate() {
     SetupStandardAudio();
+#if OPEN_FILE_CACHE_SIZE > 0
+    open_file_cache.Invalidate();
+#endif
+#if ATTACK_CACHE_FILES > 0
+    attack_cache.Reload();
+#endif
     font_config.ReadInCurrentDir("config.ini");
     #if defined(DIAGNOSE_PRESETS) 
       STDOUT.print("Activating ");
@@ -235,37 +241,38 @@ public:
   RefPtr<BufferedWavPlayer> next_hum_player_;
   RefPtr<BufferedWavPlayer> swing_player_;
   RefPtr<BufferedWavPlayer> lock_player_;
+  // Accent swing volume, recomputed once per audio block, see SetSwingVolume().
+  float accent_volume_ = 0.0f;
+  uint32_t accent_update_ = 0;   // dynamic_mixer.sample_count()
+  bool accent_pending_ = false;  // new swing_player_
 
   void PlayMonophonic(Effect* f, Effect* loop)  {
     EnableAmplifier();
     if (!next_hum_player_) {
-      next_hum_player_ = GetFreeWavPlayer();
+      next_hum_player_ = GetFreeWavPlayer(true, BUS_HUM);
       if (!next_hum_player_) {
         STDOUT.println("Out of WAV players!");
         return;
       }
     }
+    next_hum_player_->set_volume_now(font_config.volEff / 16.0f);
     if (hum_player_) {
-      hum_player_->set_fade_time(0.003);
-      hum_player_->FadeAndStop();
+      // The mixer swaps them at one sample.
+      next_hum_player_->CrossfadeAt(hum_player_.get(), f, dynamic_mixer.sample_count(), 0.003);
       hum_player_.Free();
-      next_hum_player_->set_volume_now(0);
-      next_hum_player_->set_fade_time(0.003);
-      next_hum_player_->set_volume(font_config.volEff / 16.0f);
     } else {
-      next_hum_player_->set_volume_now(font_config.volEff / 16.0f);
+      next_hum_player_->PlayOnce(f);
     }
     hum_player_ = next_hum_player_;
     next_hum_player_.Free();
-    hum_player_->PlayOnce(f);
     current_effect_length_ = hum_player_->length();
     if (loop) hum_player_->PlayLoop(loop);
   }
 
-  RefPtr<BufferedWavPlayer> PlayPolyphonic(Effect* f)  {
+  RefPtr<BufferedWavPlayer> PlayPolyphonic(Effect* f, MixerBus bus = BUS_EFFECTS)  {
     EnableAmplifier();
     if (!f->files_found()) return RefPtr<BufferedWavPlayer>(nullptr);
-    RefPtr<BufferedWavPlayer> player = GetFreeWavPlayer();
+    RefPtr<BufferedWavPlayer> player = GetFreeWavPlayer(false, bus);
     if (player) {
       player->set_volume_now(font_config.volEff / 16.0f);
       player->PlayOnce(f);
@@ -329,13 +336,15 @@ public:
               float s = (rss - font_config.ProffieOSMinSwingAcceleration) / font_config.ProffieOSMaxSwingAcceleration;
 	      effect->SelectFloat(s);
             }
-            swing_player_ = PlayPolyphonic(effect);
+            swing_player_ = PlayPolyphonic(effect, BUS_SWING);
+            accent_pending_ = true;
             swinging_ = true;
           } else {
 #ifdef ENABLE_SPINS
             if (angle_ > font_config.ProffieOSSpinDegrees) {
               if (SFX_spin) {
-                swing_player_ = PlayPolyphonic(&SFX_spin);
+                swing_player_ = PlayPolyphonic(&SFX_spin, BUS_SWING);
+                accent_pending_ = true;
               }
               angle_ -= font_config.ProffieOSSpinDegrees;
             }
@@ -375,11 +384,18 @@ public:
   float SetSwingVolume(float swing_strength, float mixhum) override {
     if (swing_player_) {
       if (swing_player_->isPlaying()) {
-        float accent_volume = powf(
-          swing_strength, font_config.ProffieOSSwingVolumeSharpness) * font_config.ProffieOSMaxSwingVolume;
-        swing_player_->set_fade_time(0.04);
-        swing_player_->set_volume(accent_volume);
-        mixhum = mixhum - mixhum * (font_config.ProffieOSSmoothSwingDucking * accent_volume);
+        // SmoothSwing calls this for every motion sample, but the player
+        // only picks up a new volume once per audio block.
+        uint32_t now = dynamic_mixer.sample_count();
+        if (accent_pending_ || now - accent_update_ >= AUDIO_BUFFER_SIZE) {
+          accent_pending_ = false;
+          accent_update_ = now;
+          accent_volume_ = powf(
+            swing_strength, font_config.ProffieOSSwingVolumeSharpness) * font_config.ProffieOSMaxSwingVolume;
+          swing_player_->set_fade_time(0.04);
+          swing_player_->set_volume(accent_volume_);
+        }
+        mixhum = mixhum - mixhum * (font_config.ProffieOSSmoothSwingDucking * accent_volume_);
       } else {
         swing_player_.Free();
       }
@@ -405,6 +421,7 @@ public:
       if (monophonic_hum_) {
 	getOut()->SetFollowing(getHum());
 	hum_player_ = tmp;
+	if (hum_player_) hum_player_->set_bus(BUS_HUM);
       }
     }
     SaberBase::RequestMotion();
@@ -442,7 +459,7 @@ public:
     } else {
       state_ = STATE_OUT;
       if (!hum_player_) {
-	hum_player_ = GetFreeWavPlayer();
+	hum_player_ = GetFreeWavPlayer(true, BUS_HUM);
 	if (hum_player_) {
 	  hum_player_->set_volume_now(0);
 	  hum_player_->PlayOnce(SFX_humm ? &SFX_humm : &SFX_hum);
@@ -690,7 +707,7 @@ public:
   void SetHumVolume(float vol) override {
     if (!monophonic_hum_) {
       if (active_state() && !hum_player_) {
-        hum_player_ = GetFreeWavPlayer();
+        hum_player_ = GetFreeWavPlayer(true, BUS_HUM);
         if (hum_player_) {
           hum_player_->set_volume_now(0);
           hum_player_->PlayOnce(SFX_humm ? &SFX_humm : &SFX_hum);
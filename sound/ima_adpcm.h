@@ -0,0 +1,72 @@
+#ifndef SOUND_IMA_ADPCM_H
+#define SOUND_IMA_ADPCM_H
+
+// IMA/DVI ADPCM decoder (WAV format tag 0x11), 4 bits per sample.
+// Follows the IMA reference algorithm exactly, so output is bit-identical
+// to any conforming decoder.
+//
+// Data comes in blocks of nBlockAlign bytes. Each block starts with a
+// 4-byte header per channel (int16 predictor, uint8 step index, padding);
+// the predictor is also the first sample of the block. For stereo, the
+// rest of the block alternates 4 bytes (8 samples) of left and right.
+// Within a byte, the low nibble comes first.
+
+const uint16_t kWavFormatPCM = 1;
+const uint16_t kWavFormatImaAdpcm = 0x11;
+
+const int16_t ima_step_table[89] = {
+  7, 8, 9, 10, 11, 12, 13, 14, 16, 17, 19, 21, 23, 25, 28, 31, 34, 37, 41,
+  45, 50, 55, 60, 66, 73, 80, 88, 97, 107, 118, 130, 143, 157, 173, 190,
+  209, 230, 253, 279, 307, 337, 371, 408, 449, 494, 544, 598, 658, 724,
+  796, 876, 963, 1060, 1166, 1282, 1411, 1552, 1707, 1878, 2066, 2272,
+  2499, 2749, 3024, 3327, 3660, 4026, 4428, 4871, 5358, 5894, 6484, 7132,
+  7845, 8630, 9493, 10442, 11487, 12635, 13899, 15289, 16818, 18500,
+  20350, 22385, 24623, 27086, 29794, 32767
+};
+
+const int8_t ima_index_table[16] = {
+  -1, -1, -1, -1, 2, 4, 6, 8,
+  -1, -1, -1, -1, 2, 4, 6, 8
+};
+
+class ImaAdpcmChannel {
+public:
+  // Parse a block header, returns the first sample of the block.
+  int16_t Start(const unsigned char* header) {
+    predictor_ = (int16_t)(header[0] | (header[1] << 8));
+    index_ = std::min<int>(header[2], 88);
+    return predictor_;
+  }
+
+  int16_t Decode(uint8_t nibble) {
+    int32_t step = ima_step_table[index_];
+    int32_t diff = step >> 3;
+    if (nibble & 4) diff += step;
+    if (nibble & 2) diff += step >> 1;
+    if (nibble & 1) diff += step >> 2;
+    if (nibble & 8) predictor_ -= diff;
+    else predictor_ += diff;
+    predictor_ = clamptoi16(predictor_);
+    index_ = clampi32(index_ + ima_index_table[nibble], 0, 88);
+    return predictor_;
+  }
+
+private:
+  int32_t predictor_ = 0;
+  int32_t index_ = 0;
+};
+
+// Samples per block, including the header sample.
+inline uint32_t ImaSamplesPerBlock(uint32_t block_align, uint32_t channels) {
+  return (block_align - 4 * channels) * 2 / channels + 1;
+}
+
+// PlayWav reads and decodes in units of 4 * channels bytes, blocks must
+// be made of whole units. (All common encoders use 256 * channels or more.)
+inline bool ImaValidBlockAlign(uint32_t block_align, uint32_t channels) {
+  if (channels < 1 || channels > 2) return false;
+  if (block_align <= 4 * channels) return false;
+  return block_align % (4 * channels) == 0;
+}
+
+#endif
@@ -28,7 +28,7 @@ public:
   void SB_On() override {
     // Starts hum, etc.
     delegate_->SB_On();
-    low_ = GetFreeWavPlayer();
+    low_ = GetFreeWavPlayer(false, BUS_SWING);
     if (low_) {
       low_->set_volume_now(0);
       low_->PlayOnce(&SFX_swingl);
@@ -36,7 +36,7 @@ public:
     } else {
       STDOUT.println("Looped swings cannot allocate wav player.");
     }
-    high_ = GetFreeWavPlayer();
+    high_ = GetFreeWavPlayer(false, BUS_SWING);
     if (high_) {
       high_->set_volume_now(0);
       high_->PlayOnce(&SFX_swingh);
@@ -0,0 +1,109 @@
+#ifndef SOUND_MIXER_BUSES_H
+#define SOUND_MIXER_BUSES_H
+
+// Mixer buses: every stream belongs to one bus (ProffieOSAudioStream::bus_),
+// and each bus has a gain that the mixer folds into the stream gains, once
+// per block. While anything plays on BUS_VOICE, the other buses are ducked:
+// the voice bus is the sidechain, its level is measured once per block and
+// the duck gain ramps linearly towards the ducked or unducked level.
+// The measurement comes from the previous block, so ducking starts at most
+// one block (AUDIO_BUFFER_SIZE samples) after the voice does.
+#ifndef MIXER_BUSES
+#ifdef ARDUINO_ARCH_ESP32   // ESP architecture
+#define MIXER_BUSES 1
+#else
+#define MIXER_BUSES 0
+#endif
+#endif
+
+#if MIXER_BUSES
+
+// How far the other buses go down while the voice bus plays.
+#ifndef MIXER_DUCK_DB
+#define MIXER_DUCK_DB 10
+#endif
+
+// Time to go all the way down, and back up after the voice stops.
+#ifndef MIXER_DUCK_ATTACK_MS
+#define MIXER_DUCK_ATTACK_MS 20
+#endif
+
+#ifndef MIXER_DUCK_RELEASE_MS
+#define MIXER_DUCK_RELEASE_MS 300
+#endif
+
+// Voice bus peak (after stream gains) that counts as playing.
+#ifndef MIXER_DUCK_THRESHOLD
+#define MIXER_DUCK_THRESHOLD 256
+#endif
+
+class MixerBuses {
+public:
+  MixerBuses() {
+    for (int i = 0; i < NUM_MIXER_BUSES; i++) {
+      bus_gain_[i] = kUnityGain;
+      gain_[i] = kUnityGain;
+    }
+    set_ducking(MIXER_DUCK_DB, MIXER_DUCK_ATTACK_MS, MIXER_DUCK_RELEASE_MS);
+  }
+
+  // |gain| 0 ... 1
+  void set_gain(MixerBus bus, float gain) {
+    bus_gain_[bus] = clampi32(gain * kUnityGain, 0, kUnityGain);
+  }
+  float gain(MixerBus bus) const {
+    return bus_gain_[bus] * (1.0f / kUnityGain);
+  }
+
+  // |db| = 0 turns ducking off.
+  void set_ducking(float db, float attack_ms, float release_ms) {
+    attack_ms = std::max(attack_ms, 1.0f);
+    release_ms = std::max(release_ms, 1.0f);
+    duck_level_ = lroundf(powf(10.0f, -fabsf(db) / 20.0f) * kUnityGain);
+    int32_t range = kUnityGain - duck_level_;
+    attack_ = std::max<int32_t>(1, range * 1000.0f / (attack_ms * AUDIO_RATE) * kStepOne);
+    release_ = std::max<int32_t>(1, range * 1000.0f / (release_ms * AUDIO_RATE) * kStepOne);
+  }
+
+  // Voice bus peak of the block just mixed.
+  void AddKey(int32_t peak) { key_ = std::max(key_, peak); }
+
+  // Called once per block of |n| samples, before the streams are mixed.
+  // Moves the duck gain and works out the gain of every bus.
+  void Update(int n) {
+    if (key_ > MIXER_DUCK_THRESHOLD) {
+      duck_ = std::max<int32_t>(duck_ - attack_ * n, duck_level_ * kStepOne);
+    } else {
+      // Never below the ducked level, which set_ducking() may have raised.
+      duck_ = clampi32(duck_ + release_ * n, duck_level_ * kStepOne, kUnityGain * kStepOne);
+    }
+    key_ = 0;
+    int32_t duck = duck_ / kStepOne;
+    for (int i = 0; i < NUM_MIXER_BUSES; i++) {
+      gain_[i] = i == BUS_VOICE ? bus_gain_[i] : (bus_gain_[i] * duck) >> kGainShift;
+    }
+  }
+
+  // Gain of |bus| for the current block, Q14.
+  int32_t block_gain(uint8_t bus) const { return gain_[bus]; }
+
+  // Current duck gain, Q14.
+  int32_t duck() const { return duck_ / kStepOne; }
+
+private:
+  // duck_ and the per-sample steps keep 8 more bits, so slow
+  // releases don't round down to no movement at all.
+  static const int32_t kStepOne = 256;
+
+  int32_t bus_gain_[NUM_MIXER_BUSES];   // set by the user, Q14
+  int32_t gain_[NUM_MIXER_BUSES];       // bus_gain_ and ducking, Q14
+  int32_t duck_level_;
+  int32_t attack_;
+  int32_t release_;
+  int32_t duck_ = kUnityGain * kStepOne;
+  int32_t key_ = 0;
+};
+
+#endif  // MIXER_BUSES
+
+#endif
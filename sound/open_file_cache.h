@@ -0,0 +1,123 @@
+#ifndef SOUND_OPEN_FILE_CACHE_H
+#define SOUND_OPEN_FILE_CACHE_H
+
+#include "../common/file_reader.h"
+#include "audio_stream_work.h"
+
+// Keeps the last few files PlayWav was done with open, so that playing
+// the same clash or blast again doesn't walk the directory again.
+// Entries are keyed by Effect::FileID and evicted least recently used.
+// Only used from the fill context (PendSV or the fill task), except
+// Invalidate(), which locks the SD first.
+#ifndef OPEN_FILE_CACHE_SIZE
+#ifdef ARDUINO_ARCH_ESP32   // ESP architecture
+#define OPEN_FILE_CACHE_SIZE 4    // SD_MMC allows 16 open files
+#else
+#define OPEN_FILE_CACHE_SIZE 2
+#endif
+#endif
+
+#if OPEN_FILE_CACHE_SIZE > 0
+
+class OpenFileCache : public AudioStreamWork {
+public:
+  // Move a cached handle for |id| into |dest|, rewound.
+  bool Take(const Effect::FileID& id, FileReader* dest) {
+    if (id) {
+      for (size_t i = 0; i < NELEM(slots_); i++) {
+        Slot& s = slots_[i];
+        if (s.id == id) {
+          s.file.MoveTo(*dest);
+          s.id = Effect::FileID();
+          dest->Rewind();
+          hits_++;
+          return true;
+        }
+      }
+    }
+    misses_++;
+    return false;
+  }
+
+  // Keep the file in |src| open for later, closing the least recently
+  // used one if all slots are taken. |src| is left closed.
+  void Put(const Effect::FileID& id, FileReader* src) {
+    if (!id || !src->IsOpen()) return;
+    Slot* victim = slots_;
+    for (size_t i = 0; i < NELEM(slots_); i++) {
+      Slot& s = slots_[i];
+      if (!s.id) { victim = &s; break; }
+      if (s.last_used < victim->last_used) victim = &s;
+    }
+    src->MoveTo(victim->file);
+    victim->id = id;
+    victim->last_used = ++clock_;
+  }
+
+  // File IDs are only meaningful within a font.
+  void Invalidate() {
+    LockSD_nomount(true);
+    Clear();
+    LockSD_nomount(false);
+  }
+
+  // Time of an uncached open, and a histogram of it:
+  // < 1 ms, < 4 ms, < 16 ms and longer.
+  void AddOpenTime(uint32_t us) {
+    open_time_.Add(us);
+    size_t bucket = 0;
+    for (uint32_t limit = 1000; bucket < 3 && us >= limit; limit *= 4) bucket++;
+    open_histogram_[bucket]++;
+  }
+
+  void DumpStats() {
+    STDOUT << "Open file cache hits: " << hits_
+           << " misses: " << misses_
+           << " open us min=" << open_time_.min
+           << " avg=" << open_time_.avg
+           << " max=" << open_time_.max
+           << " <1/<4/<16/more ms=" << open_histogram_[0] << "/" << open_histogram_[1]
+           << "/" << open_histogram_[2] << "/" << open_histogram_[3]
+           << "\n";
+  }
+
+  void ResetStats() {
+    hits_ = misses_ = 0;
+    open_time_.Reset();
+    for (size_t i = 0; i < NELEM(open_histogram_); i++) open_histogram_[i] = 0;
+  }
+
+protected:
+  // Never has anything to fill; it's only on the list so that
+  // CloseAllOpenFiles() gets to it.
+  bool FillBuffer() override { return false; }
+  size_t space_available() override { return 0; }
+  uint32_t samples_to_underrun() override { return 0xFFFFFFFFu; }
+  void CloseFiles() override { Clear(); }
+
+private:
+  void Clear() {
+    for (size_t i = 0; i < NELEM(slots_); i++) {
+      slots_[i].file.Close();
+      slots_[i].id = Effect::FileID();
+    }
+  }
+
+  struct Slot {
+    Effect::FileID id;
+    FileReader file;
+    uint32_t last_used = 0;
+  };
+  Slot slots_[OPEN_FILE_CACHE_SIZE];
+  uint32_t clock_ = 0;
+  uint32_t hits_ = 0;
+  uint32_t misses_ = 0;
+  RangeStats<int32_t, 3> open_time_;   // us
+  uint32_t open_histogram_[4] = {};
+};
+
+OpenFileCache open_file_cache;
+
+#endif  // OPEN_FILE_CACHE_SIZE > 0
+
+#endif
@@ -0,0 +1,313 @@
+#ifndef SOUND_PAIRED_WAV_PLAYER_H
+#define SOUND_PAIRED_WAV_PLAYER_H
+
+#if PAIRED_SWING_PLAYER
+
+// Frames (one low and one high sample each) in the ring, a power of 2.
+#ifndef PAIRED_SWING_BUFFER_SIZE
+#define PAIRED_SWING_BUFFER_SIZE 1024
+#endif
+
+// Plays the low and high swing loops of SmoothSwing V2 in lockstep.
+// One FillBuffer() decodes the same number of samples from both files into
+// a single ring of interleaved (low, high) frames, so the two can never
+// drift apart, and every read is LONG_AUDIO_READ_SIZE bytes. If the font
+// has a stereo "swingp" file for the swing (left = low, right = high),
+// both channels come from that one file with one read. Otherwise, both
+// files start over together when the low one ends, so a high file of
+// another length is cut short or padded with silence; CheckPairs() warns
+// about such fonts when they are loaded.
+// The mixer gets the two channels mixed down, each with its own volume.
+class PairedWavPlayer : public ProffieOSAudioStream, public AudioStreamWork {
+public:
+  PairedWavPlayer() : playing_(false), ended_(false), stop_when_zero_(false),
+                      buf_start_(0), buf_end_(0) {
+    for (int c = 0; c < 2; c++) {
+      volume_[c].set_speed(kDefaultSpeed);
+      volume_[c].set(0);
+      volume_[c].set_target(0);
+    }
+  }
+
+  // Play file |file| of |low| and |high|, or of SFX_swingp if the font has
+  // a pair file for every swing, looping, from |start| seconds in.
+  // Both channels start silent.
+  void Play(Effect* low, Effect* high, int file, float start) {
+    MountSDCard();
+    EnableAmplifier();
+    playing_.set(false);
+    LockSD_nomount(true);   // FillBuffer() is done and won't run
+    for (int c = 0; c < 2; c++) {
+      wav_[c].Stop();
+      volume_[c].set_speed(kDefaultSpeed);
+      volume_[c].set(0);
+      volume_[c].set_target(0);
+    }
+    buf_start_.set(buf_end_.get());
+    stop_when_zero_.set(false);
+    ended_.set(false);
+    stereo_ = SFX_swingp.files_found() && SFX_swingp.files_found() == low->files_found();
+    if (stereo_) {
+      wav_[0].SetStereo(true);
+      wav_[0].SetReadBuffer(read_buffer_, sizeof(read_buffer_));
+      Start(0, &SFX_swingp, file, start);
+      wav_[0].PlayNext(&SFX_swingp);
+    } else {
+      for (int c = 0; c < 2; c++) {
+        wav_[c].SetStereo(false);
+        wav_[c].SetReadBuffer(read_buffer_ + c * LONG_AUDIO_READ_SIZE, LONG_AUDIO_READ_SIZE);
+      }
+      Start(0, low, file, start);
+      Start(1, high, file, start);
+    }
+    playing_.set(true);
+    LockSD_nomount(false);
+    scheduleFillBuffer();
+    Activate();
+  }
+
+  // Safe from any context; the files stay open until the next Play().
+  void Stop() override {
+    playing_.set(false);
+  }
+
+  bool isPlaying() const {
+    return playing_.get() && !(ended_.get() && !buffered());
+  }
+
+  // |channel|: 0 = low, 1 = high.
+  void set_volume(int channel, int vol) { volume_[channel].set_target(vol); }
+  void set_volume_now(int channel, int vol) {
+    volume_[channel].set(vol);
+    volume_[channel].set_target(vol);
+  }
+  bool isOff(int channel) const {
+    return volume_[channel].isConstant() && volume_[channel].value() == 0;
+  }
+  void set_fade_time(float t) {
+    uint32_t speed = std::max<int>(1, (int)(kMaxVolume / t / AUDIO_RATE));
+    volume_[0].set_speed(speed);
+    volume_[1].set_speed(speed);
+  }
+  void FadeAndStop() {
+    volume_[0].set_target(0);
+    volume_[1].set_target(0);
+    stop_when_zero_.set(true);
+  }
+
+  int read_gain(int16_t* data, int elements, int32_t* gain) override {
+    *gain = kUnityGain;
+    if (!playing_.get()) return 0;
+    int32_t low = volume_[0].value();
+    int32_t high = volume_[1].value();
+    int n = std::min<int>(elements, buffered());
+    size_t pos = buf_start_.get();
+    for (int i = 0; i < n; i++) {
+      const int16_t* frame = ring_ + 2 * ((pos + i) & (kFrames - 1));
+      data[i] = clamptoi16((frame[0] * low + frame[1] * high) >> kGainShift);
+    }
+    buf_start_ += n;
+    if (n < elements && !ended_.get()) underflows_++;
+    volume_[0].advance();
+    volume_[1].advance();
+    if (stop_when_zero_.get() && isOff(0) && isOff(1)) {
+      stop_when_zero_.set(false);
+      playing_.set(false);
+    }
+    scheduleFillBuffer();
+    return n;
+  }
+
+  int read(int16_t* data, int elements) override {
+    int32_t gain;
+    return read_gain(data, elements, &gain);
+  }
+
+  bool eof() const override { return !isPlaying(); }
+
+  // Warn about swing pairs whose low and high files differ in length.
+  // Only reads the headers. Returns the number of such pairs.
+  int CheckPairs(Effect* low, Effect* high) {
+    mismatched_pairs_ = 0;
+    if (SFX_swingp.files_found() && SFX_swingp.files_found() == low->files_found()) return 0;
+    int files = std::min(low->files_found(), high->files_found());
+    char name[128];
+    for (int i = 0; i < files; i++) {
+      Effect::FileID(low, i, 0).GetName(name);
+      uint32_t low_frames = WavFrames(name);
+      Effect::FileID(high, i, 0).GetName(name);
+      uint32_t high_frames = WavFrames(name);
+      if (low_frames == high_frames) continue;
+      mismatched_pairs_++;
+      STDOUT << "Warning: " << name << " has " << high_frames
+             << " samples, the low swing " << low_frames << "\n";
+    }
+    return mismatched_pairs_;
+  }
+
+  void ResetStats() {
+    underflows_ = 0;
+    loops_ = 0;
+    reset_time_ = millis();
+    reset_reads_ = reads();
+    reset_bytes_ = bytes_read();
+  }
+
+  void DumpStats() {
+    uint32_t ms = millis() - reset_time_;
+    STDOUT << "Swing pair (" << (stereo_ ? "swingp" : "swingl+swingh") << "):"
+           << " underflows=" << underflows_
+           << " bytes/s=" << (uint32_t)(ms ? (bytes_read() - reset_bytes_) * 1000ULL / ms : 0)
+           << " reads/s=" << (uint32_t)(ms ? (reads() - reset_reads_) * 1000ULL / ms : 0)
+           << " loops=" << loops_
+           << " mismatched pairs=" << mismatched_pairs_
+           << "\n";
+  }
+
+protected:
+  bool FillBuffer() override {
+    if (!playing_.get() || ended_.get()) return false;
+    size_t space = space_available();
+    bool restarted = false;   // and nothing read since
+    while (space) {
+      size_t end_pos = buf_end_.get() & (kFrames - 1);
+      size_t n = std::min(space, kFrames - end_pos);
+      int16_t* dest = ring_ + 2 * end_pos;
+      size_t got;
+      if (stereo_) {
+        got = ReadAll(wav_[0], dest, 2 * n) / 2;
+      } else {
+        // Low first; high then has to deliver exactly as many samples,
+        // or silence if it is shorter.
+        n = std::min<size_t>(n, kChunk);
+        int16_t tmp[2][kChunk];
+        got = ReadAll(wav_[0], tmp[0], n);
+        size_t high = ReadAll(wav_[1], tmp[1], got);
+        for (size_t i = high; i < got; i++) tmp[1][i] = 0;
+        for (size_t i = 0; i < got; i++) {
+          dest[2 * i] = tmp[0][i];
+          dest[2 * i + 1] = tmp[1][i];
+        }
+      }
+      buf_end_ += got;
+      space -= got;
+      if (got < n && !wav_[0].isPlaying()) {
+        if (stereo_ || restarted) {
+          ended_.set(true);
+          break;
+        }
+        // The low file ended: start both over.
+        for (int c = 0; c < 2; c++) {
+          wav_[c].Stop();
+          wav_[c].PlayOnce(file_[c]);
+          wav_[c].PlayNext(nullptr);
+        }
+        loops_++;
+        restarted = true;
+      } else if (!got) {
+        break;
+      } else {
+        restarted = false;
+      }
+    }
+    return space_available() > 0;
+  }
+
+  size_t space_available() override {
+    if (!playing_.get() || ended_.get()) return 0;
+    return kFrames - buffered();
+  }
+  uint32_t samples_to_underrun() override { return buffered(); }
+
+  void CloseFiles() override {
+    wav_[0].Close();
+    wav_[1].Close();
+  }
+
+private:
+  static const size_t kFrames = PAIRED_SWING_BUFFER_SIZE;
+  static const size_t kChunk = 128;
+
+  void Start(int channel, Effect* effect, int file, float start) {
+    effect->Select(file);
+    file_[channel] = effect->RandomFile();
+    wav_[channel].PlayOnce(file_[channel], start);
+    wav_[channel].PlayNext(nullptr);   // FillBuffer() does the looping
+  }
+
+  // Samples in a wav file, from its header; 0 if it can't be read.
+  static uint32_t WavFrames(const char* filename) {
+    FileReader f;
+    uint32_t header[4];
+    uint32_t frame_bytes = 0, samples_per_block = 0, frames = 0;
+    if (!f.Open(filename)) return 0;
+    if (f.Read((uint8_t*)header, 12) != 12 ||
+        header[0] != 0x46464952 || header[2] != 0x45564157) {  // RIFF, WAVE
+      f.Close();
+      return 0;
+    }
+    while (f.Read((uint8_t*)header, 8) == 8) {
+      uint32_t len = header[1];
+      if (header[0] == 0x20746D66 && len >= 16) {  // 'fmt '
+        if (f.Read((uint8_t*)header, 16) != 16) break;
+        uint32_t channels = header[0] >> 16;
+        uint32_t block_align = header[3] & 0xffff;
+        if ((header[0] & 0xffff) == kWavFormatImaAdpcm) {
+          frame_bytes = block_align;
+          samples_per_block = ImaSamplesPerBlock(block_align, channels);
+        } else {
+          frame_bytes = std::max<uint32_t>(1, channels * (header[3] >> 16) / 8);
+        }
+        f.Skip(len - 16);
+      } else if (header[0] == 0x61746164 && frame_bytes) {  // 'data'
+        frames = samples_per_block ? len / frame_bytes * samples_per_block : len / frame_bytes;
+        break;
+      } else {
+        f.Skip(len);
+      }
+    }
+    f.Close();
+    return frames;
+  }
+
+  // PlayWav::read() returns early at the end of a file; going on to the
+  // next one of a loop takes a few calls.
+  static size_t ReadAll(PlayWav& wav, int16_t* dest, size_t n) {
+    size_t got = 0;
+    for (int tries = 0; got < n && tries < 4; tries++) {
+      got += wav.read(dest + got, n - got);
+    }
+    return got;
+  }
+
+  size_t buffered() const { return buf_end_.get() - buf_start_.get(); }
+  uint32_t reads() const { return wav_[0].reads() + wav_[1].reads(); }
+  uint32_t bytes_read() const { return wav_[0].bytes_read() + wav_[1].bytes_read(); }
+
+  PlayWav wav_[2];
+  Effect::FileID file_[2];
+  bool stereo_ = false;        // wav_[0] plays a swingp file
+  POAtomic<bool> playing_;
+  POAtomic<bool> ended_;       // the files ran out
+  POAtomic<bool> stop_when_zero_;
+  ClickAvoiderLin volume_[2];
+
+  // Written by FillBuffer() and read() respectively, like BufferedAudioStream.
+  POAtomic<size_t> buf_start_;
+  POAtomic<size_t> buf_end_;
+  int16_t ring_[2 * kFrames];
+  unsigned char read_buffer_[2 * LONG_AUDIO_READ_SIZE] __attribute__((aligned(4)));
+
+  uint32_t underflows_ = 0;
+  uint32_t loops_ = 0;
+  int mismatched_pairs_ = 0;
+  uint32_t reset_time_ = 0;
+  uint32_t reset_reads_ = 0;
+  uint32_t reset_bytes_ = 0;
+};
+
+PairedWavPlayer paired_swing_player;
+
+#endif  // PAIRED_SWING_PLAYER
+
+#endif
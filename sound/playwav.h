@@ -4,69 +4,20 @@
 #include "../common/file_reader.h"
 #include "../common/state_machine.h"
 #include "audiostream.h"
+#include "resampler.h"
+#include "ima_adpcm.h"
+#include "open_file_cache.h"
 
 
 #define PlayLoop(x) PlayNext(x)   // "loop" = "continuously repeated"
 
-
-// Simple upsampler code, doubles the number of samples with
-// 2-lobe lanczos upsampling.
-#define UPSCALE_C1 24757
-#define UPSCALE_C2 -8191
-
-#if 1
-#define UPSAMPLE_FUNC(NAME, EMIT)                               \
-  void NAME(int16_t sample) {                                   \
-    upsample_buf_##NAME##_a_ = upsample_buf_##NAME##_b_;        \
-    upsample_buf_##NAME##_b_ = upsample_buf_##NAME##_c_;        \
-    upsample_buf_##NAME##_c_ = upsample_buf_##NAME##_d_;        \
-    upsample_buf_##NAME##_d_ = sample;                          \
-    EMIT(clamptoi16((upsample_buf_##NAME##_a_ * UPSCALE_C2 +            \
-          upsample_buf_##NAME##_b_ * UPSCALE_C1 +                       \
-          upsample_buf_##NAME##_c_ * UPSCALE_C1 +                       \
-                   upsample_buf_##NAME##_d_ * UPSCALE_C2) >> 15));      \
-    EMIT(upsample_buf_##NAME##_c_);                             \
-  }                                                             \
-  void clear_##NAME() {                                         \
-    upsample_buf_##NAME##_a_ = 0;                               \
-    upsample_buf_##NAME##_b_ = 0;                               \
-    upsample_buf_##NAME##_c_ = 0;                               \
-    upsample_buf_##NAME##_d_ = 0;                               \
-  }                                                             \
-  int16_t upsample_buf_##NAME##_a_ = 0;                         \
-  int16_t upsample_buf_##NAME##_b_ = 0;                         \
-  int16_t upsample_buf_##NAME##_c_ = 0;                         \
-  int16_t upsample_buf_##NAME##_d_ = 0
-#else
-#define UPSAMPLE_FUNC(NAME, EMIT)               \
-  void NAME(int16_t sample) {                   \
-      EMIT(sample);      EMIT(sample);          \
-  }                                             \
-  void clear_##NAME() {                         \
-  }
+// When a sound loops into itself, crossfade this many samples of its end
+// with its start instead of butting them together. 0 = off.
+// Only for files that are resumable().
+#ifndef WAV_LOOP_CROSSFADE
+#define WAV_LOOP_CROSSFADE 0
 #endif
 
-#define DOWNSAMPLE_FUNC(NAME, EMIT)                     \
-  void NAME(int16_t sample) {                           \
-    if (downsample_flag_##NAME##_) {                    \
-      EMIT((downsample_buf_##NAME##_ + sample) >> 1);   \
-      downsample_flag_##NAME##_ = false;                \
-    } else {                                            \
-      downsample_buf_##NAME##_ = sample;                \
-      downsample_flag_##NAME##_ = true;                 \
-    }                                                   \
-  }                                                     \
-  void clear_##NAME() {                                 \
-    downsample_buf_##NAME##_ = 0;                       \
-    downsample_flag_##NAME##_ = false;                  \
-  }                                                     \
-  int16_t downsample_buf_##NAME##_ = 0;                 \
-  bool downsample_flag_##NAME##_ = false
-
-
-
-
-
 
 // PlayWav reads a file from serialflash or SD and converts
 // it into a stream of samples. Note that because it can
@@ -76,12 +27,15 @@ class PlayWav : StateMachine, public ProffieOSAudioStream {
 public:
 
   friend class BufferedWavPlayer;
+  friend class PairedWavPlayer;
   PlayWav() : run_(false), effect_(nullptr), sample_bytes_(0) {}
 
   void Play(const char* filename) {
     if (!*filename) return;
     strcpy(filename_, filename);
     new_file_id_ = Effect::FileID();
+    resampler_.Clear();
+    carry_pos_ = carry_len_ = 0;
     run_.set(true);
   }
 
@@ -89,13 +43,20 @@ public:
     return filename_;
   }
 
-  void PlayOnce(const Effect::FileID& file_id, float start = 0.0) {
+  // skip_samples: start this many samples in, exactly. Only for files
+  // that are resumable().
+  void PlayOnce(const Effect::FileID& file_id, float start = 0.0,
+                uint32_t skip_samples = 0) {
     sample_bytes_.set(0);
     new_file_id_ = file_id;
     if (new_file_id_) {
       new_file_id_.GetName(filename_);
       start_ = start;
+      skip_samples_ = skip_samples;
       effect_.set(nullptr);
+      // A new sound starts from silence; only loops keep the history.
+      resampler_.Clear();
+      carry_pos_ = carry_len_ = 0;
       run_.set(true);
     }
      PlayLoop(file_id.GetEffect()->GetFollowing());
@@ -115,68 +76,47 @@ public:
     noInterrupts();
     run_.set(false);
     state_machine_.reset_state_machine();
-    written_ = num_samples_ = 0;
+    carry_pos_ = carry_len_ = 0;
+#if WAV_LOOP_CROSSFADE > 0
+    xfade_capture_ = xfade_tail_ = xfade_done_ = false;
+    xfade_effect_ = nullptr;
+#endif
     interrupts();
 
   }
   void Stop() override {
     noInterrupts();
     effect_.set(nullptr);
-    shortRepeatTime = 0;
-    if (longRepeat) *longRepeat = false;
-    longRepeat = 0;
+    repeat_samples_.set(0);
     Reset();
     // interrupts();    // released by Reset()
   }
 
 
   // 0: no repeat; 1: loop; >1: repeat at 'msm1'-1 milliseconds
-  // Return false for long repeat (needs additional action from BufferedWavPlayer )
+  // Repeats are timed in samples: each pass is cut off, or padded with
+  // silence, to exactly one period.
   bool SetRepeat(uint16_t msm1) {
-    // Stop repeat
-    // STDOUT.print("[SetRepeat] effect_ = "); STDOUT.print((uint32_t)effect_); STDOUT.print(", len [ms] = "); STDOUT.println((uint16_t)(1000*length()));
     if (msm1 && !effect_.get()) {
         // STDOUT.println("[PlayWav.SetRepeat] Cannot repeat, effect not assigned");
         return false;     
     }
-    effect_.get()->SetFollowing(0);   // nothing follows
-    shortRepeatTime = 0;
-    lastRepeatTime = millis();    
-    if (longRepeat)*longRepeat = false;
-    // repeating = msm1;
-    if (msm1) {  
-      if (msm1 == 1) { // loop at sound's duration
-        effect_.get()->SetFollowing(effect_.get()); 
-      }
-      else { // repeat at fixed period
-        uint32_t soundLen = 1000*length();
-        // STDOUT.println(1000*length());
-        if (msm1-1 < soundLen) { // short repeat (before sound end, by loop)
-            effect_.get()->SetFollowing(effect_.get()); 
-            shortRepeatTime = msm1-1;  
-        }
-        else if (msm1-1 == soundLen) { // loop
-          effect_.get()->SetFollowing(effect_.get()); 
-        }
-        else { // long repeat (by RepeatTask)
-          if (longRepeat)*longRepeat = true;  // this starts the RepeatTask, since longRepeat points to its .running
-          effect_.set(nullptr);         // unassign effect to prevent looping
-          // repeater->Start(msm1-1);
-        }    
-      }
-    } 
-    else effect_.set(nullptr);   // prevent double play
-
+    repeat_samples_.set(msm1 > 1 ? (msm1 - 1) * (uint32_t)AUDIO_RATE / 1000 : 0);
+    if (msm1) effect_.get()->SetFollowing(effect_.get());
+    else if (effect_.get()) {
+      effect_.get()->SetFollowing(0);   // nothing follows
+      effect_.set(nullptr);   // prevent double play
+    }
     return true;
   }
 
   // 0 = not repeating, 1 = short repeat, 2 = loop, 3 = long repeat
   uint8_t GetRepeat() {
-    if (*longRepeat) return 3;    
-    if (shortRepeatTime) return 1;
-    if (effect_.get())
-      if (effect_.get() == effect_.get()->GetFollowing()) return 2;   
-    return 0;
+    Effect* e = effect_.get();
+    if (!e || e->GetFollowing() != e) return 0;
+    uint32_t period = repeat_samples_.get();
+    if (!period) return 2;
+    return period < length() * AUDIO_RATE ? 1 : 3;
   }
   
 
@@ -187,16 +127,57 @@ public:
     return run_.get();
   }
 
+  // Must hold at least 16 bytes; a multiple of 512 lets one read
+  // cover several SD sectors.
+  void SetReadBuffer(unsigned char* read_buffer, size_t size) {
+    buffer = read_buffer;
+    buffer_size_ = size;
+  }
+  size_t read_size() const { return buffer_size_; }
+  unsigned char* read_buffer() const { return buffer; }
+  uint32_t bytes_read() const { return bytes_read_; }
+  uint32_t reads() const { return reads_; }
+
+  // Output both channels of a stereo file, interleaved, instead of
+  // mixing them down. Only 8 or 16 bit PCM at AUDIO_RATE; read() then
+  // always returns whole frames.
+  void SetStereo(bool stereo) { stereo_ = stereo; }
+
+  // True if output sample N is input frame N, so playback can start at
+  // any sample.
+  bool resumable() const {
+    return format_ == kWavFormatPCM && rate_ == AUDIO_RATE;
+  }
+
+  // Number of file reads by all players, for diagnostics.
+  static uint32_t file_reads_;
+
 private:
-  void Emit1(uint16_t sample) {
-    samples_[num_samples_++] = sample;
+  // Decoded samples go straight to dest_. Only when the resampler may
+  // produce more than fits do they go through carry_.
+  template<bool resample> void Emit(int16_t sample) {
+    if (!resample) {
+      *(dest_++) = sample;
+      to_read_--;
+    } else if (to_read_ >= kMaxResampleOutput) {
+      int n = resampler_.Push(sample, dest_);
+      dest_ += n;
+      to_read_ -= n;
+    } else {
+      carry_pos_ = 0;
+      carry_len_ = resampler_.Push(sample, carry_);
+      DrainCarry();
+    }
+  }
+
+  void DrainCarry() {
+    int n = std::min<int>(carry_len_ - carry_pos_, to_read_);
+    for (int i = 0; i < n; i++) *(dest_++) = carry_[carry_pos_++];
+    to_read_ -= n;
   }
-  UPSAMPLE_FUNC(Emit2, Emit1);
-  UPSAMPLE_FUNC(Emit4, Emit2);
-  DOWNSAMPLE_FUNC(Emit05, Emit1);
 
   uint32_t header(int n) const {
-    return ((uint32_t *)buffer)[n+2];
+    return ((uint32_t *)buffer)[n];
   }
 
   template<int bits> int16_t read2() {
@@ -216,10 +197,9 @@ private:
     effect_.set(nullptr);
   }
 
-  template<int bits, int channels, int rate>
+  template<int bits, int channels, bool resample>
   void DecodeBytes4() {
-    while (ptr_ < end_ - channels * bits / 8 &&
-           num_samples_ < (int)NELEM(samples_)) {
+    while (ptr_ < end_ && to_read_ > 0) {
       int v = 0;
       if (channels == 1) {
         v = read2<bits>();
@@ -228,30 +208,62 @@ private:
         v += read2<bits>();
         v >>= 1;
       }
-      if (rate == AUDIO_RATE) {
-        Emit1(v);
-      } else if (rate == AUDIO_RATE / 2) {
-        Emit2(v);
-      } else if (rate == AUDIO_RATE / 4) {
-        Emit4(v);
-      } else if (rate == AUDIO_RATE * 2) {
-        Emit05(v);
+      Emit<resample>(v);
+    }
+  }
+
+  // Decodes one sample (per channel) at a time, so that it can stop
+  // anywhere when dest_ is full. Chunks always hold whole units of
+  // 4 * channels bytes, so block headers and stereo groups never straddle.
+  template<int channels, bool resample>
+  void DecodeAdpcm2() {
+    while (ptr_ < end_ && to_read_ > 0) {
+      if (!adpcm_left_) {
+        // Block header
+        int v = 0;
+        for (int c = 0; c < channels; c++) {
+          v += adpcm_[c].Start(ptr_);
+          ptr_ += 4;
+        }
+        adpcm_left_ = block_align_ - 4 * channels;
+        Emit<resample>(v / channels);
+      } else if (channels == 1) {
+        uint8_t b = *ptr_;
+        Emit<resample>(adpcm_[0].Decode(adpcm_nibble_ ? b >> 4 : b & 15));
+        if ((adpcm_nibble_ ^= 1)) continue;
+        ptr_++;
+        adpcm_left_--;
       } else {
-	AbortDecodeBytes("Unsupported rate.");
+        // 4 bytes left, then 4 bytes right, 8 samples each.
+        uint8_t l = ptr_[adpcm_nibble_ >> 1];
+        uint8_t r = ptr_[4 + (adpcm_nibble_ >> 1)];
+        if (adpcm_nibble_ & 1) {
+          l >>= 4;
+          r >>= 4;
+        }
+        Emit<resample>((adpcm_[0].Decode(l & 15) + adpcm_[1].Decode(r & 15)) >> 1);
+        if (++adpcm_nibble_ < 8) continue;
+        adpcm_nibble_ = 0;
+        ptr_ += 8;
+        adpcm_left_ -= 8;
       }
     }
   }
 
+  template<int channels>
+  void DecodeAdpcm() {
+    if (rate_ == AUDIO_RATE)
+      DecodeAdpcm2<channels, false>();
+    else
+      DecodeAdpcm2<channels, true>();
+  }
+
   template<int bits, int channels>
   void DecodeBytes3() {
-    if (rate_ == 44100)
-      DecodeBytes4<bits, channels, 44100>();
-    else if (rate_ == 22050)
-      DecodeBytes4<bits, channels, 22050>();
-    else if (rate_ == 11025)
-      DecodeBytes4<bits, channels, 11025>();
+    if (rate_ == AUDIO_RATE)
+      DecodeBytes4<bits, channels, false>();
     else
-      AbortDecodeBytes("Unsupported rate.");
+      DecodeBytes4<bits, channels, true>();
   }
 
   template<int bits>
@@ -261,8 +273,25 @@ private:
     else AbortDecodeBytes("unsupported number of channels");
   }
 
+  template<int bits>
+  void DecodeStereo() {
+    while (ptr_ < end_ && to_read_ > 0) {
+      *(dest_++) = read2<bits>();
+      *(dest_++) = read2<bits>();
+      to_read_ -= 2;
+    }
+  }
+
   void DecodeBytes() {
-    if (bits_ == 8) DecodeBytes2<8>();
+    if (stereo_) {
+      if (bits_ == 8) DecodeStereo<8>();
+      else DecodeStereo<16>();
+    }
+    else if (format_ == kWavFormatImaAdpcm) {
+      if (channels_ == 1) DecodeAdpcm<1>();
+      else DecodeAdpcm<2>();
+    }
+    else if (bits_ == 8) DecodeBytes2<8>();
     else if (bits_ == 16) DecodeBytes2<16>();
 //    else if (bits_ == 24) DecodeBytes2<24>();
 //    else if (bits_ == 32) DecodeBytes2<32>();
@@ -270,28 +299,111 @@ private:
   }
 
   int ReadFile(int n) {
-    
-    return file_.Read(buffer + 8, n);
+    file_reads_++;
+    reads_++;
+    int ret = file_.Read(buffer, n);
+    if (ret > 0) bytes_read_ += ret;
+    return ret;
   }
 
-  void loop() {
+  // Open filename_, reusing a handle from the open file cache if the
+  // file was played recently. The file we had open goes into the cache.
+  bool OpenFile() {
+    header_cached_ = false;
+#if WAV_LOOP_CROSSFADE > 0
+    xfade_head_len_ = 0;
+#endif
+#if OPEN_FILE_CACHE_SIZE > 0
+    open_file_cache.Put(old_file_id_, &file_);
+    old_file_id_ = Effect::FileID();
+    if (open_file_cache.Take(new_file_id_, &file_)) return true;
+    uint32_t start = micros();
+    if (!file_.OpenFast(filename_)) return false;
+    open_file_cache.AddOpenTime(micros() - start);
+    return true;
+#else
+    return file_.OpenFast(filename_);
+#endif
+  }
 
-    // auto-repeat at fixed intervals 'shortRepeatTime' [ms], if smaller than file duration. If longer, state machine will stop so repeating is handled by PlayWavLooper
-    if (effect_.get() && shortRepeatTime && !(*longRepeat)) {
-      uint32_t timeNow = millis();
-      if (timeNow - lastRepeatTime >= shortRepeatTime) {
-        file_.Rewind();   // start over
-        state_machine_.next_state_ = switchwavs_state;    // hack into the state machine!
-        lastRepeatTime = timeNow;
+#if WAV_LOOP_CROSSFADE > 0
+  bool CanCrossfade() const {
+    return resumable() && !stereo_ && header_cached_ && !repeat_samples_.get() &&
+      data_len_ % frame_bytes_ == 0 &&
+      data_len_ >= 2u * WAV_LOOP_CROSSFADE * frame_bytes_;
+  }
+
+  // Picks the next file now, and returns true if it's this one again.
+  bool LoopsIntoItself() {
+    xfade_effect_ = effect_.get();
+    if (!xfade_effect_) return false;
+    xfade_next_ = old_file_id_.GetFollowing(xfade_effect_);
+    return xfade_next_ == old_file_id_;
+  }
+
+  // Post-process samples decoded to [from, dest_): keep the first
+  // WAV_LOOP_CROSSFADE samples of the file and fade the last ones into them.
+  void Crossfade(int16_t* from) {
+    const int N = WAV_LOOP_CROSSFADE;
+    for (int16_t* p = from; p < dest_; p++) {
+      if (xfade_capture_) {
+        xfade_head_[xfade_head_len_++] = *p;
+        xfade_capture_ = xfade_head_len_ < N;
+      }
+      if (xfade_tail_) {
+        int t = ++xfade_pos_;
+        *p = (*p * (N + 1 - t) + xfade_head_[t - 1] * t) / (N + 1);
+        if (t == N) {
+          xfade_tail_ = false;
+          xfade_done_ = true;
+        }
       }
     }
+  }
+#endif
+
+  // Data chunk bytes that decode to |samples| output samples.
+  size_t PeriodBytes(uint32_t samples) const {
+    uint64_t frames = (uint64_t)samples * rate_ / AUDIO_RATE;
+    if (format_ == kWavFormatImaAdpcm) {
+      // Whole blocks only.
+      uint32_t per_block = ImaSamplesPerBlock(block_align_, channels_);
+      return (frames + per_block - 1) / per_block * block_align_;
+    }
+    return frames * frame_bytes_;
+  }
+
+  // Output samples for |bytes| of the data chunk.
+  uint32_t PeriodSamples(size_t bytes) const {
+    uint64_t frames = format_ == kWavFormatImaAdpcm ?
+      (uint64_t)bytes / block_align_ * ImaSamplesPerBlock(block_align_, channels_) :
+      bytes / frame_bytes_;
+    return frames * AUDIO_RATE / rate_;
+  }
+
+  void loop() {
     STATE_MACHINE_BEGIN();
     while (true) {
       while (!run_.get() && !effect_.get()) YIELD();      
 
       // if (!shortRepeatTime) { 
         if (!run_.get()) {  
+#if WAV_LOOP_CROSSFADE > 0
+          // The next file was already picked for the crossfade.
+          if (xfade_effect_ && xfade_effect_ == effect_.get()) {
+            new_file_id_ = xfade_next_;
+            if (xfade_done_) {
+              // The start of it has already been played.
+              skip_samples_ = WAV_LOOP_CROSSFADE;
+              xfade_skipped_ = true;
+            }
+          } else
+#endif
           new_file_id_ = old_file_id_.GetFollowing(effect_.get());  // Random()
+#if WAV_LOOP_CROSSFADE > 0
+          xfade_effect_ = nullptr;
+          xfade_done_ = false;
+#endif
           if (!new_file_id_) goto fail;
           new_file_id_.GetName(filename_);
           run_.set(true);
@@ -299,7 +411,7 @@ private:
         }
         if (new_file_id_ && new_file_id_ == old_file_id_) file_.Rewind();
         else {
-          if (!file_.OpenFast(filename_)) {
+          if (!OpenFile()) {
             #if defined(DIAGNOSE_AUDIO) 
               default_output->print("File ");            
               default_output->print(filename_);
@@ -307,7 +419,6 @@ private:
             #endif
             goto fail;
           }
-          switchwavs_state = __LINE__ + 1;    // while repeating we'll inject into the state machine on the next YIELD
           YIELD();
           old_file_id_ = new_file_id_;
         }
@@ -316,6 +427,8 @@ private:
 
 
       wav_ = endswith(".wav", filename_);
+      // Same file again: the format and where the data is are known.
+      if (header_cached_) goto header_done;
       if (wav_) {
         if (ReadFile(12) != 12) {
           #if defined(DIAGNOSE_AUDIO)
@@ -361,26 +474,56 @@ private:
           goto fail;
         }
         if (len_ > 16) file_.Skip(len_ - 16);
-        if ((header(0) & 0xffff) != 1) {
+        format_ = header(0) & 0xffff;
+        channels_ = header(0) >> 16;
+        rate_ = header(1);
+        block_align_ = header(3) & 0xffff;
+        bits_ = header(3) >> 16;
+        if (format_ != kWavFormatPCM &&
+            !(format_ == kWavFormatImaAdpcm && bits_ == 4 &&
+              ImaValidBlockAlign(block_align_, channels_))) {
           #if defined(DIAGNOSE_AUDIO) 
             default_output->println("Wrong format.");
           #endif
           goto fail;
         }
-        channels_ = header(0) >> 16;
-        rate_ = header(1);
-        bits_ = header(3) >> 16;
       } else {
+         format_ = kWavFormatPCM;
          channels_ = 1;
          rate_ = 44100;
          bits_ = 16;
       }
+      if (!resampler_.Setup(rate_)) {
+        #if defined(DIAGNOSE_AUDIO) 
+          default_output->println("Unsupported rate.");
+        #endif
+        goto fail;
+      }
+      if (stereo_ && !(channels_ == 2 && resumable() && (bits_ == 8 || bits_ == 16))) {
+        #if defined(DIAGNOSE_AUDIO) 
+          default_output->println("Not 8 or 16 bit stereo at 44.1kHz.");
+        #endif
+        goto fail;
+      }
+
+      frame_bytes_ = format_ == kWavFormatImaAdpcm ? 4 * channels_ : channels_ * bits_ / 8;
 
-      ptr_ = buffer + 8;
-      end_ = buffer + 8;
+  header_done:
+      ptr_ = buffer;
+      end_ = buffer;
+      cached_pass_ = header_cached_;
+      data_chunks_ = 0;
+      pass_bytes_ = 0;
+      period_cut_ = false;
       
       while (true) {
-        if (wav_) {
+        // Cut short by the repeat period, the rest of the file is skipped.
+        if (period_cut_) break;
+        if (cached_pass_) {
+          if (data_chunks_) break;
+          file_.Seek(data_offset_);
+          len_ = data_len_;
+        } else if (wav_) {
           if (ReadFile(8) != 8) break;
           len_ = header(1);
           if (header(0) != 0x61746164) {
@@ -391,54 +534,114 @@ private:
           if (file_.Tell() >= file_.FileSize()) break;
           len_ = file_.FileSize() - file_.Tell();
         }
-        sample_bytes_.set(len_);
-
-        if (delayedRepeat) {
-            SetRepeat(delayedRepeat);   // set repeat now, it was delayed for not knowing length
-            delayedRepeat = 0;
+        if (!cached_pass_) {
+          // Only files with a single data chunk can skip the header.
+          data_offset_ = file_.Tell();
+          data_len_ = len_;
+          header_cached_ = !data_chunks_;
         }
+        data_chunks_++;
+        sample_bytes_.set(len_);
+        adpcm_left_ = 0;
+        adpcm_nibble_ = 0;
 
         if (start_ != 0.0) {
           int samples = Fmod(start_, length()) * rate_;
           int bytes_to_skip = samples * channels_ * bits_ / 8;
+          if (format_ == kWavFormatImaAdpcm) {
+            // Can only start decoding at a block boundary.
+            bytes_to_skip = samples / ImaSamplesPerBlock(block_align_, channels_) * block_align_;
+          }
           file_.Skip(bytes_to_skip);
           len_ -= bytes_to_skip;
           start_ = 0.0;
+        } else if (skip_samples_ && resumable()) {
+          size_t bytes_to_skip = std::min<size_t>(skip_samples_ * frame_bytes_, len_);
+          file_.Skip(bytes_to_skip);
+          len_ -= bytes_to_skip;
+        }
+        skip_samples_ = 0;
+        if (uint32_t period = repeat_samples_.get()) {
+          // Play no more than one repeat period; what's skipped counts too.
+          size_t max_bytes = PeriodBytes(period);
+          pass_bytes_ += file_.Tell() - data_offset_;
+          size_t left = max_bytes > pass_bytes_ ? max_bytes - pass_bytes_ : 0;
+          if (len_ > left) {
+            len_ = left;
+            period_cut_ = true;
+          }
+          pass_bytes_ += len_;
+        }
+#if WAV_LOOP_CROSSFADE > 0
+        // Keep the start of the file, unless we're past it already.
+        if (file_.Tell() == data_offset_ && CanCrossfade()) {
+          xfade_head_len_ = 0;
+          xfade_capture_ = true;
+        } else if (!xfade_skipped_) {
+          xfade_head_len_ = 0;
         }
+        xfade_skipped_ = false;
+#endif
 
+        // Reads hold whole frames, so nothing is left over between chunks.
+        // If the data is not frame-aligned to SD sectors, give up sector
+        // alignment rather than splitting frames.
+        aligned_ = file_.Tell() % frame_bytes_ == 0;
         while (len_) {
           {
-            int bytes_read = ReadFile(file_.AlignRead(std::min<size_t>(len_, 512u)));
+            int n = std::min<size_t>(len_, buffer_size_);
+#if WAV_LOOP_CROSSFADE > 0
+            // Read the last WAV_LOOP_CROSSFADE frames on their own.
+            if (xfade_head_len_ == WAV_LOOP_CROSSFADE && !xfade_tail_ &&
+                !xfade_done_ && CanCrossfade()) {
+              size_t tail = WAV_LOOP_CROSSFADE * frame_bytes_;
+              if (len_ > tail) {
+                n = std::min<size_t>(n, len_ - tail);
+              } else if (len_ == tail && LoopsIntoItself()) {
+                xfade_tail_ = true;
+                xfade_pos_ = 0;
+              }
+            }
+#endif
+            if (aligned_) n = file_.AlignRead(n);
+            n -= n % frame_bytes_;
+            if (!n) break;
+            int bytes_read = ReadFile(n);
             if (bytes_read <= 0)
               break;
             len_ -= bytes_read;
-            end_ = buffer + 8 + bytes_read;
+            ptr_ = buffer;
+            end_ = buffer + bytes_read;
           }
-          while (ptr_ < end_ - channels_ * bits_ / 8) {
+          while (ptr_ < end_) {
+            // Preload should go to here...
+            while (to_read_ == 0) YIELD();
+#if WAV_LOOP_CROSSFADE > 0
+            xfade_from_ = dest_;
             DecodeBytes();
-
-            while (written_ < num_samples_) {
-              // Preload should go to here...
-              while (to_read_ == 0) YIELD();
-
-              int n = std::min<int>(num_samples_ - written_, to_read_);
-              memcpy(dest_, samples_ + written_, n * 2);
-              dest_ += n;
-              written_ += n;
-              to_read_ -= n;
-            }
-            written_ = num_samples_ = 0;
-          }
-          if (ptr_ < end_) {
-            memmove(buffer + 8 - (end_ - ptr_),
-                    ptr_,
-                    end_ - ptr_);
+            if (xfade_capture_ || xfade_tail_) Crossfade(xfade_from_);
+#else
+            DecodeBytes();
+#endif
           }
-          ptr_ = buffer + 8 - (end_ - ptr_);
         }
         YIELD();
       }
 
+      // Shorter than the repeat period: pad with silence.
+      gap_samples_ = 0;
+      if (effect_.get() && repeat_samples_.get() > PeriodSamples(pass_bytes_)) {
+        gap_samples_ = repeat_samples_.get() - PeriodSamples(pass_bytes_);
+      }
+      while (gap_samples_ && effect_.get()) {
+        while (to_read_ == 0) YIELD();
+        tmp_ = std::min<uint32_t>(gap_samples_, to_read_);
+        memset(dest_, 0, tmp_ * sizeof(dest_[0]));
+        dest_ += tmp_;
+        to_read_ -= tmp_;
+        gap_samples_ -= tmp_;
+      }
+
       // EOF;
       run_.set(false);
       continue;
@@ -458,7 +661,8 @@ public:
   int read(int16_t* dest, int to_read) override {
     
     dest_ = dest;
-    to_read_ = to_read;
+    to_read_ = stereo_ ? to_read & ~1 : to_read;
+    DrainCarry();
     loop();
     return dest_ - dest;
   }
@@ -469,6 +673,11 @@ public:
 
   // Length, seconds.
   float length() const {
+    if (format_ == kWavFormatImaAdpcm) {
+      // Whole blocks only; a trailing partial block is ignored.
+      return (float)(sample_bytes_.get() / block_align_) *
+        ImaSamplesPerBlock(block_align_, channels_) / rate_;
+    }
     return (float)(sample_bytes_.get()) * 8 / (bits_ * rate_ * channels_);
   }
 
@@ -480,6 +689,7 @@ public:
 
   void Close() {
     file_.Close();
+    header_cached_ = false;
     old_file_id_ = new_file_id_ = Effect::FileID();
   }
 
@@ -510,9 +720,50 @@ private:
   int to_read_ = 0;
   int tmp_;
   float start_ = 0.0;
+  uint32_t skip_samples_ = 0;
   int rate_;
   uint8_t channels_;
   uint8_t bits_;
+  uint16_t format_ = kWavFormatPCM;
+  uint16_t block_align_ = 0;
+
+  // Bytes per decode unit: one frame for PCM, 4 * channels for ADPCM.
+  uint8_t frame_bytes_ = 2;
+  bool aligned_ = true;
+  bool stereo_ = false;
+
+  // Where the data chunk of the open file is, so that looping it
+  // doesn't have to read and walk the header again.
+  bool header_cached_ = false;
+  bool cached_pass_ = false;
+  uint8_t data_chunks_ = 0;
+  uint32_t data_offset_ = 0;
+  uint32_t data_len_ = 0;
+
+  // Fixed period repeats, see SetRepeat().
+  POAtomic<uint32_t> repeat_samples_;
+  size_t pass_bytes_ = 0;        // data bytes played or skipped this pass
+  bool period_cut_ = false;
+  uint32_t gap_samples_ = 0;
+
+#if WAV_LOOP_CROSSFADE > 0
+  int16_t xfade_head_[WAV_LOOP_CROSSFADE];
+  uint16_t xfade_head_len_ = 0;
+  uint16_t xfade_pos_ = 0;
+  bool xfade_capture_ = false;   // filling xfade_head_
+  bool xfade_tail_ = false;      // fading the end into xfade_head_
+  bool xfade_done_ = false;
+  bool xfade_skipped_ = false;   // this pass started after xfade_head_
+  Effect* xfade_effect_ = nullptr;
+  Effect::FileID xfade_next_;
+  int16_t* xfade_from_;
+#endif
+
+  // IMA ADPCM: bytes left in the current block, next nibble within the
+  // current byte (mono) or 8-byte group (stereo), decoder state per channel.
+  uint16_t adpcm_left_ = 0;
+  uint8_t adpcm_nibble_ = 0;
+  ImaAdpcmChannel adpcm_[2];
 
   bool wav_;
 
@@ -522,27 +773,23 @@ private:
   POAtomic<size_t> sample_bytes_;
   unsigned char* ptr_;
   unsigned char* end_;
-  unsigned char buffer[512 + 8]  __attribute__((aligned(4)));
-
-  // Number of samples_ in samples that has been
-  // sent out already.
-  int written_ = 0;
-  
-  // Number of samples in samples_
-  int num_samples_ = 0;
-  int16_t samples_[32];
+  unsigned char* buffer = nullptr;
+  size_t buffer_size_ = 0;
+  uint32_t bytes_read_ = 0;
+  uint32_t reads_ = 0;
 
+  // Resampler output that did not fit in dest_.
+  int16_t carry_[kMaxResampleOutput];
+  uint8_t carry_pos_ = 0;
+  uint8_t carry_len_ = 0;
 
-// private:
-    uint16_t switchwavs_state;    // state machine's state which swithces wiches
-    uint32_t shortRepeatTime;          // auto-repeat period [ms]
-    uint32_t lastRepeatTime;          // millis() when repeated last time
-    bool* longRepeat;              // pointer to .running of the RepeatTask assigned
-    uint16_t delayedRepeat;
+  PolyphaseResampler resampler_;
 
 
 };
 
+uint32_t PlayWav::file_reads_ = 0;
+
 
 
 
@@ -0,0 +1,161 @@
+#ifndef SOUND_POST_MIX_H
+#define SOUND_POST_MIX_H
+
+// Optional processing of the mixed signal: an EQ of up to POST_MIX_EQ_BANDS
+// biquads for speaker correction, then a look-ahead peak limiter.
+// It is off until SetUserProfile() finds a post-mix entry in the profile
+// COD file; without one, the mixer's compressor runs as before. Once on, it
+// replaces the compressor: the mix gets a fixed gain, the one the
+// compressor would apply at a reference level, and the limiter keeps the
+// peaks below full scale.
+#ifndef POST_MIX_DSP
+#ifdef ARDUINO_ARCH_ESP32   // ESP architecture
+#define POST_MIX_DSP 1
+#else
+#define POST_MIX_DSP 0
+#endif
+#endif
+
+#if POST_MIX_DSP
+
+#define POST_MIX_EQ_BANDS 5
+
+// Highest COD ID searched for the post-mix entry.
+#ifndef POST_MIX_MAXID
+#define POST_MIX_MAXID 32
+#endif
+
+// COD struct entry with handler HANDLER_PostMix, in the profile file.
+struct postMixData_t {
+  uint8_t nBands;                 // EQ bands used, 0 ... POST_MIX_EQ_BANDS
+  float referenceLevel;           // average |sample| the fixed gain is matched at
+  float limiterThreshold;         // fraction of full scale, 0 ... 1
+  float limiterRelease;           // seconds, time constant
+  float coefficients[POST_MIX_EQ_BANDS][5];   // b0, b1, b2, a1, a2 (a0 = 1), each within +/-2
+} __attribute__((packed));
+
+CPUprobe post_mix_cycles;
+
+class PostMix {
+public:
+  bool active() const { return active_; }
+
+  // Returns false, and leaves the current settings alone, if |d| is not valid.
+  bool Set(const postMixData_t& d) {
+    if (d.nBands > POST_MIX_EQ_BANDS) return false;
+    if (!(d.referenceLevel > 0.0f)) return false;
+    if (!(d.limiterThreshold > 0.0f && d.limiterThreshold <= 1.0f)) return false;
+    Biquad bands[POST_MIX_EQ_BANDS] = {};
+    for (int b = 0; b < d.nBands; b++) {
+      int32_t* c = &bands[b].b0;
+      for (int i = 0; i < 5; i++) {
+        float v = d.coefficients[b][i];
+        if (!(v > -2.0f && v < 2.0f)) return false;
+        c[i] = lroundf(v * (1 << 30));
+      }
+    }
+    float release = d.limiterRelease > 0.0f ?
+      1.0f - expf(-AUDIO_MIXER_BLOCK / (d.limiterRelease * AUDIO_RATE)) : 1.0f;
+
+    noInterrupts();
+    for (int b = 0; b < POST_MIX_EQ_BANDS; b++) bands_[b] = bands[b];
+    num_bands_ = d.nBands;
+    divisor_ = sqrtf(255.0f * d.referenceLevel) + 100;
+    threshold_ = d.limiterThreshold * (32767 << kFracBits);
+    release_ = release * 32768;
+    for (int i = 0; i < AUDIO_MIXER_BLOCK; i++) delay_[i] = 0;
+    gain_ = kUnityGain;
+    active_ = true;
+    interrupts();
+    return true;
+  }
+
+  void Disable() { active_ = false; }
+
+  // Mixer gain to use instead of the compressor's, Q14.
+  int32_t Gain(int32_t volume) const {
+    return (volume << 14) / divisor_;
+  }
+
+  // Equalize and limit n <= AUDIO_MIXER_BLOCK samples of the mix, after the
+  // mixer's gain, into out. Output is late by AUDIO_MIXER_BLOCK samples, so
+  // the limiter is down to the right gain before a peak gets out.
+  void Process(int32_t* s, int16_t* out, int n) __attribute__((optimize("Ofast"))) {
+    ScopedCycleCounter cc(post_mix_cycles);
+    for (int i = 0; i < n; i++) {
+      s[i] = clampi32(s[i], -kMaxInput, kMaxInput) * (1 << kFracBits);
+    }
+    for (int b = 0; b < num_bands_; b++) bands_[b].Run(s, n);
+
+    // Peak of what goes out now and of everything after it.
+    int32_t peak = 0;
+    for (int i = 0; i < AUDIO_MIXER_BLOCK; i++) peak = std::max<int32_t>(peak, abs(delay_[i]));
+    for (int i = 0; i < n; i++) peak = std::max<int32_t>(peak, abs(s[i]));
+    int32_t g1 = gain_ + (((kUnityGain - gain_) * release_) >> 15);
+    if (peak > threshold_) {
+      g1 = std::min<int32_t>(g1, ((int64_t)threshold_ << kGainShift) / peak);
+    }
+
+    int32_t g = gain_;
+    int32_t step = (g1 - g) / n;
+    for (int i = 0; i < n; i++) {
+      g += step;
+      int32_t x = delay_[pos_];
+      delay_[pos_] = s[i];
+      if (++pos_ == AUDIO_MIXER_BLOCK) pos_ = 0;
+      int32_t y = ((int64_t)x * g) >> kGainShift;
+      out[i] = MIXER_SAT16((y + (1 << (kFracBits - 1))) >> kFracBits);
+    }
+    gain_ = g1;
+  }
+
+  // Limiter gain, Q14.
+  int32_t limiter_gain() const { return gain_; }
+
+private:
+  // Samples run through the EQ and limiter with kFracBits more precision.
+  // Inputs are clamped to 32 x full scale, which leaves 12 dB of headroom
+  // for EQ boost.
+  static const int kFracBits = 8;
+  static const int32_t kMaxInput = 1 << 20;
+
+  // Direct form I, Q30 coefficients, 64-bit accumulation (SMLAL).
+  // What is truncated off one output is added to the next, so low
+  // frequency filters don't amplify the rounding noise. Outputs saturate,
+  // since bands that boost by more than the 12 dB of headroom would
+  // otherwise wrap around.
+  struct Biquad {
+    int32_t b0, b1, b2, a1, a2;
+    int32_t x1, x2, y1, y2;
+    uint32_t error;
+
+    void Run(int32_t* s, int n) {
+      for (int i = 0; i < n; i++) {
+        int32_t x = s[i];
+        int64_t acc = (int64_t)b0 * x + (int64_t)b1 * x1 + (int64_t)b2 * x2
+          - (int64_t)a1 * y1 - (int64_t)a2 * y2 + error;
+        x2 = x1;
+        x1 = x;
+        y2 = y1;
+        int64_t y = acc >> 30;
+        y1 = y > INT32_MAX ? INT32_MAX : y < -INT32_MAX ? -INT32_MAX : y;
+        error = acc & ((1 << 30) - 1);
+        s[i] = y1;
+      }
+    }
+  };
+
+  bool active_ = false;
+  Biquad bands_[POST_MIX_EQ_BANDS];
+  int num_bands_ = 0;
+  int32_t divisor_ = 1;
+  int32_t threshold_ = 32767 << kFracBits;
+  int32_t release_ = 0;       // Q15, per AUDIO_MIXER_BLOCK samples
+  int32_t gain_ = kUnityGain;
+  int32_t delay_[AUDIO_MIXER_BLOCK] = {};
+  int pos_ = 0;
+};
+
+#endif  // POST_MIX_DSP
+
+#endif
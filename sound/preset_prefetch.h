@@ -0,0 +1,243 @@
+#ifndef SOUND_PRESET_PREFETCH_H
+#define SOUND_PRESET_PREFETCH_H
+
+// While the saber is off and quiet, reads what changing to the next or
+// previous preset needs from the SD card: the font index (see
+// Effect::ReadIndex()) and the font's config files. PropBase::chdir() then
+// restores the effects from RAM and the config files are parsed from RAM.
+// A font is only prefetched once it has an index, i.e. it has been
+// selected at least once. Apply() walks the font directories again, and
+// rescans as usual if the sound files or the config file sizes changed
+// since the prefetch.
+#ifndef PRESET_PREFETCH
+#ifdef ARDUINO_ARCH_ESP32   // ESP architecture
+#define PRESET_PREFETCH 1
+#else
+#define PRESET_PREFETCH 0     // ~5 kB of RAM
+#endif
+#endif
+
+#ifndef ENABLE_FONT_INDEX
+#undef PRESET_PREFETCH
+#define PRESET_PREFETCH 0
+#endif
+
+#if PRESET_PREFETCH
+
+// Per prefetched preset.
+#ifndef PRESET_PREFETCH_ENTRIES
+#define PRESET_PREFETCH_ENTRIES 48
+#endif
+#ifndef PRESET_PREFETCH_TEXT
+#define PRESET_PREFETCH_TEXT 1536
+#endif
+// Directory entries looked at per Loop() while checking the index.
+#ifndef PRESET_PREFETCH_WALK
+#define PRESET_PREFETCH_WALK 8
+#endif
+
+class PresetPrefetch : public Looper, public ConfigFileCache {
+public:
+  PresetPrefetch() : Looper(20000) { config_file_cache = this; }
+  const char* name() override { return "PresetPrefetch"; }
+
+  // Start fetching these presets' fonts, in preset format ("font;common").
+  void SetTargets(const char* next, const char* previous) {
+    active_ = nullptr;
+    slots_[0].Set(next);
+    slots_[1].Set(previous);
+  }
+
+  // Restore the effects for current_directory, if prefetched. Until the
+  // next SetTargets(), config files are then read from the same slot.
+  bool Apply() {
+    active_ = nullptr;
+    for (size_t i = 0; i < NELEM(slots_); i++) {
+      Slot& s = slots_[i];
+      if (s.state != DONE || !SameDirs(s.dirs, current_directory)) continue;
+      if (!Unchanged(s)) {
+#if defined(DIAGNOSE_PRESETS)
+        STDOUT.print("Prefetched font changed ");
+        STDOUT.println(current_directory);
+#endif
+        s.state = FAILED;
+        break;
+      }
+      Effect::ResetFontEffects();
+      Effect::RestoreIndex(s.entries, s.header.entries);
+      num_alternatives = s.header.num_alternatives;
+      Effect::CheckFontFiles();
+      active_ = &s;
+      hits_++;
+#if defined(DIAGNOSE_PRESETS)
+      STDOUT.print("Using prefetched font ");
+      STDOUT.println(current_directory);
+#endif
+      return true;
+    }
+    misses_++;
+    return false;
+  }
+
+  bool OpenCached(const char* path, FileReader* f) override {
+    if (!active_) return false;
+    uint32_t key = Effect::NameChecksum(path);
+    for (int i = 0; i < active_->num_files; i++) {
+      const CachedFile& c = active_->files[i];
+      if (c.path != key) continue;
+      if (c.exists) f->OpenMem((const uint8_t*)active_->text + c.offset, c.length);
+      return true;
+    }
+    return false;
+  }
+
+  uint32_t hits() const { return hits_; }
+  uint32_t misses() const { return misses_; }
+  // Prefetched fonts that changed before they were used.
+  uint32_t stale() const { return stale_; }
+
+protected:
+  void Loop() override {
+    if (SaberBase::IsOn() || SoundActive()) return;
+    for (size_t i = 0; i < NELEM(slots_); i++) {
+      if (slots_[i].state != DONE && slots_[i].state != FAILED) {
+        LOCK_SD(true);
+        Step(slots_[i]);
+        LOCK_SD(false);
+        return;
+      }
+    }
+  }
+
+private:
+  static const char* const config_names_[3];
+
+  enum State : uint8_t { EMPTY, INDEX, FILES, DONE, FAILED };
+
+  struct CachedFile {
+    uint32_t path;      // Effect::NameChecksum() of the path
+    uint16_t offset;
+    uint16_t length;
+    bool exists;
+  };
+
+  struct Slot {
+    void Set(const char* font) {
+      if (strlen(font) + 2 > sizeof(dirs)) {
+        state = FAILED;
+        return;
+      }
+      MakeDirectoryList(dirs, font);
+      walk.Start(dirs, config_names_, NELEM(config_names_));
+      state = INDEX;
+    }
+
+    State state = EMPTY;
+    char dirs[32];
+    Effect::FingerprintWalk walk;
+    uint32_t config_sizes;
+    Effect::IndexHeader header;
+    Effect::IndexEntry entries[PRESET_PREFETCH_ENTRIES];
+    CachedFile files[8];
+    int num_files;
+    uint16_t text_used;
+    const char* dir;       // next directory to read config files from
+    int name;              // next config file in |dir|
+    char text[PRESET_PREFETCH_TEXT];
+  };
+
+  static bool SameDirs(const char* a, const char* b) {
+    while (true) {
+      if (strcmp(a, b)) return false;
+      a = next_current_directory(a);
+      b = next_current_directory(b);
+      if (!a || !b) return a == b;
+    }
+  }
+
+  // Walks all of the font directories, under the SD lock.
+  bool Unchanged(const Slot& s) {
+    Effect::FingerprintWalk walk;
+    LOCK_SD(true);
+    walk.Start(s.dirs, config_names_, NELEM(config_names_));
+    while (!walk.Step(0xFFFFFFFFu));
+    LOCK_SD(false);
+    if (walk.fingerprint() == s.header.fingerprint &&
+        walk.sizes() == s.config_sizes) {
+      return true;
+    }
+    stale_++;
+    return false;
+  }
+
+  // A few SD operations per call, so that loop() is never held up for long.
+  void Step(Slot& s) {
+    switch (s.state) {
+      case INDEX: {
+        if (!s.walk.Step(PRESET_PREFETCH_WALK)) return;
+        s.config_sizes = s.walk.sizes();
+        FileReader f;
+        PathHelper path(s.dirs, FONT_INDEX_NAME);
+        if (!Effect::OpenIndex(&f, path, s.walk.fingerprint(), &s.header) ||
+            s.header.entries > PRESET_PREFETCH_ENTRIES) {
+          f.Close();
+          s.state = FAILED;
+          return;
+        }
+        f.Read((uint8_t*)s.entries, s.header.entries * sizeof(Effect::IndexEntry));
+        f.Close();
+        s.num_files = 0;
+        s.text_used = 0;
+        s.dir = s.dirs;
+        s.name = 0;
+        s.state = FILES;
+        return;
+      }
+      case FILES: {
+        // Files that aren't cached are read from the SD as usual.
+        if (!s.dir || s.num_files == (int)NELEM(s.files)) {
+          s.state = DONE;
+          return;
+        }
+        PathHelper path(s.dir, config_names_[s.name]);
+        CachedFile& c = s.files[s.num_files];
+        FileReader f;
+        c.path = Effect::NameChecksum(path);
+        c.offset = s.text_used;
+        c.length = 0;
+        c.exists = f.Open(path);
+        if (!c.exists) {
+          s.num_files++;
+        } else if (f.FileSize() <= sizeof(s.text) - s.text_used) {
+          c.length = f.Read((uint8_t*)s.text + s.text_used, f.FileSize());
+          s.text_used += c.length;
+          s.num_files++;
+        }
+        f.Close();
+        if (++s.name == (int)NELEM(config_names_)) {
+          s.name = 0;
+          s.dir = next_current_directory(s.dir);
+        }
+        return;
+      }
+      default:
+        return;
+    }
+  }
+
+  Slot slots_[2];
+  Slot* active_ = nullptr;
+  uint32_t hits_ = 0;
+  uint32_t misses_ = 0;
+  uint32_t stale_ = 0;
+};
+
+const char* const PresetPrefetch::config_names_[3] = {
+  "config.ini", "smoothsw.ini", "font_config.txt"
+};
+
+PresetPrefetch preset_prefetch;
+
+#endif  // PRESET_PREFETCH
+
+#endif
@@ -0,0 +1,260 @@
+#ifndef SOUND_RESAMPLER_H
+#define SOUND_RESAMPLER_H
+
+// Table-driven fixed-point polyphase resampler. Converts any WAV sample
+// rate from 8 kHz to 96 kHz to AUDIO_RATE, with a bounded cost of
+// 2 x 8 (upsampling, up to 48 kHz) or 2 x 16 (88.2/96 kHz) multiply-adds
+// per output sample.
+//
+// Each table holds a Kaiser windowed sinc (beta = 6) sampled at
+// kResamplePhases + 1 fractional offsets, one row per offset, Q15, rows
+// normalized to unity DC gain. Output samples between two rows are
+// linearly interpolated. The cutoff is 0.92 x the lower of the input and
+// output Nyquist frequencies. Tables were generated offline.
+
+const int kResamplePhases = 32;
+
+// Most output samples a single input sample can produce (8 kHz -> 44.1 kHz).
+const int kMaxResampleOutput = 6;
+
+// Upsampling, cutoff 0.92 x input Nyquist: 8 taps
+const int16_t resample_up[33][8] = {
+  { 388, -1210, 2175, 30062, 2175, -1210, 388, 0 },
+  { 331, -968, 1346, 30051, 3061, -1462, 449, -40 },
+  { 275, -735, 569, 29921, 3994, -1719, 510, -47 },
+  { 222, -512, -152, 29697, 4975, -1979, 573, -56 },
+  { 172, -302, -815, 29384, 5998, -2240, 635, -64 },
+  { 126, -105, -1420, 28984, 7060, -2500, 696, -73 },
+  { 84, 77, -1966, 28497, 8156, -2754, 756, -82 },
+  { 45, 244, -2452, 27929, 9282, -3001, 812, -91 },
+  { 11, 395, -2880, 27281, 10433, -3238, 865, -99 },
+  { -19, 530, -3250, 26558, 11602, -3460, 914, -107 },
+  { -46, 649, -3562, 25765, 12785, -3666, 957, -114 },
+  { -68, 751, -3819, 24907, 13976, -3850, 992, -121 },
+  { -87, 838, -4022, 23987, 15168, -4010, 1020, -126 },
+  { -102, 908, -4173, 23013, 16355, -4143, 1039, -129 },
+  { -114, 964, -4275, 21991, 17530, -4245, 1048, -131 },
+  { -122, 1005, -4330, 20923, 18688, -4312, 1046, -130 },
+  { -128, 1032, -4342, 19823, 19821, -4342, 1032, -128 },
+  { -130, 1046, -4312, 18688, 20923, -4330, 1005, -122 },
+  { -131, 1048, -4245, 17530, 21991, -4275, 964, -114 },
+  { -129, 1039, -4143, 16355, 23013, -4173, 908, -102 },
+  { -126, 1020, -4010, 15168, 23987, -4022, 838, -87 },
+  { -121, 992, -3850, 13976, 24907, -3819, 751, -68 },
+  { -114, 957, -3666, 12785, 25765, -3562, 649, -46 },
+  { -107, 914, -3460, 11602, 26558, -3250, 530, -19 },
+  { -99, 865, -3238, 10433, 27281, -2880, 395, 11 },
+  { -91, 812, -3001, 9282, 27929, -2452, 244, 45 },
+  { -82, 756, -2754, 8156, 28497, -1966, 77, 84 },
+  { -73, 696, -2500, 7060, 28984, -1420, -105, 126 },
+  { -64, 635, -2240, 5998, 29384, -815, -302, 172 },
+  { -56, 573, -1979, 4975, 29697, -152, -512, 222 },
+  { -47, 510, -1719, 3994, 29921, 569, -735, 275 },
+  { -40, 449, -1462, 3061, 30051, 1346, -968, 331 },
+  { 0, 388, -1210, 2175, 30062, 2175, -1210, 388 },
+};
+
+// 48 kHz and below (down to 44.1 kHz): 8 taps
+const int16_t resample_48k[33][8] = {
+  { 564, -2075, 4086, 27618, 4086, -2075, 564, 0 },
+  { 526, -1876, 3294, 27618, 4923, -2277, 600, -40 },
+  { 487, -1675, 2536, 27512, 5790, -2472, 634, -44 },
+  { 447, -1475, 1817, 27335, 6688, -2661, 664, -47 },
+  { 407, -1279, 1141, 27088, 7613, -2842, 690, -50 },
+  { 366, -1087, 508, 26773, 8561, -3012, 711, -52 },
+  { 327, -900, -80, 26385, 9531, -3169, 727, -53 },
+  { 288, -721, -624, 25935, 10516, -3311, 737, -52 },
+  { 251, -550, -1121, 25419, 11514, -3434, 740, -51 },
+  { 215, -388, -1573, 24843, 12520, -3537, 736, -48 },
+  { 181, -236, -1979, 24209, 13530, -3617, 724, -44 },
+  { 149, -95, -2339, 23522, 14538, -3672, 702, -37 },
+  { 120, 36, -2653, 22782, 15540, -3699, 671, -29 },
+  { 93, 155, -2924, 21996, 16532, -3696, 631, -19 },
+  { 68, 263, -3152, 21167, 17509, -3660, 579, -6 },
+  { 46, 359, -3338, 20300, 18465, -3590, 517, 9 },
+  { 26, 444, -3483, 19397, 19397, -3483, 444, 26 },
+  { 9, 517, -3590, 18465, 20300, -3338, 359, 46 },
+  { -6, 579, -3660, 17509, 21167, -3152, 263, 68 },
+  { -19, 631, -3696, 16532, 21996, -2924, 155, 93 },
+  { -29, 671, -3699, 15540, 22782, -2653, 36, 120 },
+  { -37, 702, -3672, 14538, 23522, -2339, -95, 149 },
+  { -44, 724, -3617, 13530, 24209, -1979, -236, 181 },
+  { -48, 736, -3537, 12520, 24843, -1573, -388, 215 },
+  { -51, 740, -3434, 11514, 25419, -1121, -550, 251 },
+  { -52, 737, -3311, 10516, 25935, -624, -721, 288 },
+  { -53, 727, -3169, 9531, 26385, -80, -900, 327 },
+  { -52, 711, -3012, 8561, 26773, 508, -1087, 366 },
+  { -50, 690, -2842, 7613, 27088, 1141, -1279, 407 },
+  { -47, 664, -2661, 6688, 27335, 1817, -1475, 447 },
+  { -44, 634, -2472, 5790, 27512, 2536, -1675, 487 },
+  { -40, 600, -2277, 4923, 27618, 3294, -1876, 526 },
+  { 0, 564, -2075, 4086, 27618, 4086, -2075, 564 },
+};
+
+// 88.2 kHz and below: 16 taps
+const int16_t resample_88k[33][16] = {
+  { -64, 194, 515, -606, -2168, 1089, 9898, 15052, 9898, 1089, -2168, -606, 515, 194, -64, 0 },
+  { -65, 180, 520, -545, -2164, 878, 9622, 15053, 10181, 1307, -2169, -668, 510, 209, -63, -18 },
+  { -65, 165, 523, -484, -2155, 673, 9338, 15037, 10455, 1531, -2164, -732, 502, 225, -61, -20 },
+  { -65, 151, 524, -425, -2140, 476, 9050, 15007, 10725, 1762, -2153, -796, 493, 240, -59, -22 },
+  { -65, 137, 524, -367, -2121, 285, 8760, 14968, 10989, 1998, -2136, -860, 482, 255, -57, -24 },
+  { -65, 124, 522, -311, -2098, 101, 8468, 14917, 11248, 2241, -2114, -925, 469, 271, -54, -26 },
+  { -65, 111, 519, -256, -2071, -76, 8173, 14859, 11501, 2488, -2086, -990, 454, 286, -51, -28 },
+  { -64, 98, 515, -203, -2039, -245, 7878, 14781, 11749, 2742, -2051, -1055, 437, 302, -47, -30 },
+  { -63, 86, 510, -151, -2004, -408, 7581, 14697, 11989, 3000, -2010, -1121, 419, 318, -43, -32 },
+  { -62, 74, 504, -101, -1966, -563, 7284, 14603, 12223, 3263, -1963, -1186, 398, 333, -39, -34 },
+  { -60, 63, 496, -52, -1924, -710, 6986, 14493, 12450, 3531, -1909, -1250, 376, 348, -34, -36 },
+  { -59, 52, 488, -6, -1880, -850, 6688, 14379, 12669, 3803, -1848, -1314, 351, 363, -29, -39 },
+  { -57, 42, 478, 39, -1832, -983, 6392, 14250, 12880, 4079, -1781, -1377, 324, 378, -23, -41 },
+  { -55, 32, 468, 81, -1782, -1108, 6095, 14114, 13083, 4358, -1706, -1440, 296, 392, -17, -43 },
+  { -54, 23, 457, 122, -1730, -1226, 5801, 13966, 13278, 4641, -1625, -1501, 265, 406, -10, -45 },
+  { -52, 14, 445, 161, -1675, -1337, 5507, 13807, 13464, 4928, -1536, -1561, 232, 420, -2, -47 },
+  { -50, 6, 433, 198, -1619, -1440, 5216, 13640, 13640, 5216, -1440, -1619, 198, 433, 6, -50 },
+  { -47, -2, 420, 232, -1561, -1536, 4928, 13464, 13807, 5507, -1337, -1675, 161, 445, 14, -52 },
+  { -45, -10, 406, 265, -1501, -1625, 4641, 13278, 13966, 5801, -1226, -1730, 122, 457, 23, -54 },
+  { -43, -17, 392, 296, -1440, -1706, 4358, 13083, 14114, 6095, -1108, -1782, 81, 468, 32, -55 },
+  { -41, -23, 378, 324, -1377, -1781, 4079, 12880, 14250, 6392, -983, -1832, 39, 478, 42, -57 },
+  { -39, -29, 363, 351, -1314, -1848, 3803, 12669, 14379, 6688, -850, -1880, -6, 488, 52, -59 },
+  { -36, -34, 348, 376, -1250, -1909, 3531, 12450, 14493, 6986, -710, -1924, -52, 496, 63, -60 },
+  { -34, -39, 333, 398, -1186, -1963, 3263, 12223, 14603, 7284, -563, -1966, -101, 504, 74, -62 },
+  { -32, -43, 318, 419, -1121, -2010, 3000, 11989, 14697, 7581, -408, -2004, -151, 510, 86, -63 },
+  { -30, -47, 302, 437, -1055, -2051, 2742, 11749, 14781, 7878, -245, -2039, -203, 515, 98, -64 },
+  { -28, -51, 286, 454, -990, -2086, 2488, 11501, 14859, 8173, -76, -2071, -256, 519, 111, -65 },
+  { -26, -54, 271, 469, -925, -2114, 2241, 11248, 14917, 8468, 101, -2098, -311, 522, 124, -65 },
+  { -24, -57, 255, 482, -860, -2136, 1998, 10989, 14968, 8760, 285, -2121, -367, 524, 137, -65 },
+  { -22, -59, 240, 493, -796, -2153, 1762, 10725, 15007, 9050, 476, -2140, -425, 524, 151, -65 },
+  { -20, -61, 225, 502, -732, -2164, 1531, 10455, 15037, 9338, 673, -2155, -484, 523, 165, -65 },
+  { -18, -63, 209, 510, -668, -2169, 1307, 10181, 15053, 9622, 878, -2164, -545, 520, 180, -65 },
+  { 0, -64, 194, 515, -606, -2168, 1089, 9898, 15052, 9898, 1089, -2168, -606, 515, 194, -64 },
+};
+
+// 96 kHz and below: 16 taps
+const int16_t resample_96k[33][16] = {
+  { 13, 282, 222, -1039, -1739, 2046, 9685, 13828, 9685, 2046, -1739, -1039, 222, 282, 13, 0 },
+  { 9, 273, 241, -989, -1769, 1845, 9460, 13831, 9918, 2253, -1706, -1090, 201, 292, 18, -19 },
+  { 4, 263, 258, -939, -1794, 1648, 9225, 13821, 10142, 2464, -1667, -1139, 179, 300, 23, -20 },
+  { 1, 254, 275, -889, -1813, 1456, 8988, 13797, 10361, 2678, -1624, -1188, 156, 309, 28, -21 },
+  { -3, 244, 289, -838, -1829, 1269, 8748, 13767, 10576, 2897, -1575, -1237, 131, 317, 34, -22 },
+  { -6, 234, 303, -788, -1840, 1086, 8506, 13726, 10786, 3120, -1521, -1285, 105, 325, 40, -23 },
+  { -9, 224, 315, -738, -1847, 909, 8261, 13676, 10991, 3346, -1461, -1331, 78, 332, 46, -24 },
+  { -12, 214, 326, -689, -1850, 737, 8015, 13618, 11191, 3575, -1396, -1377, 48, 339, 53, -24 },
+  { -14, 203, 335, -640, -1849, 571, 7766, 13552, 11386, 3808, -1326, -1422, 18, 345, 60, -25 },
+  { -17, 193, 344, -591, -1844, 410, 7517, 13474, 11574, 4044, -1250, -1465, -14, 351, 67, -25 },
+  { -19, 183, 351, -543, -1835, 254, 7266, 13391, 11756, 4282, -1169, -1507, -47, 356, 75, -26 },
+  { -20, 173, 357, -496, -1824, 104, 7015, 13299, 11932, 4523, -1082, -1547, -82, 360, 82, -26 },
+  { -22, 163, 362, -450, -1808, -40, 6763, 13194, 12102, 4767, -989, -1585, -118, 364, 91, -26 },
+  { -23, 154, 365, -405, -1790, -179, 6511, 13086, 12265, 5012, -891, -1621, -156, 367, 99, -26 },
+  { -24, 144, 368, -361, -1768, -312, 6259, 12969, 12420, 5259, -786, -1656, -194, 369, 107, -26 },
+  { -25, 135, 370, -317, -1744, -439, 6008, 12842, 12569, 5507, -676, -1688, -234, 370, 116, -26 },
+  { -25, 125, 370, -275, -1717, -561, 5757, 12710, 12710, 5757, -561, -1717, -275, 370, 125, -25 },
+  { -26, 116, 370, -234, -1688, -676, 5507, 12569, 12842, 6008, -439, -1744, -317, 370, 135, -25 },
+  { -26, 107, 369, -194, -1656, -786, 5259, 12420, 12969, 6259, -312, -1768, -361, 368, 144, -24 },
+  { -26, 99, 367, -156, -1621, -891, 5012, 12265, 13086, 6511, -179, -1790, -405, 365, 154, -23 },
+  { -26, 91, 364, -118, -1585, -989, 4767, 12102, 13194, 6763, -40, -1808, -450, 362, 163, -22 },
+  { -26, 82, 360, -82, -1547, -1082, 4523, 11932, 13299, 7015, 104, -1824, -496, 357, 173, -20 },
+  { -26, 75, 356, -47, -1507, -1169, 4282, 11756, 13391, 7266, 254, -1835, -543, 351, 183, -19 },
+  { -25, 67, 351, -14, -1465, -1250, 4044, 11574, 13474, 7517, 410, -1844, -591, 344, 193, -17 },
+  { -25, 60, 345, 18, -1422, -1326, 3808, 11386, 13552, 7766, 571, -1849, -640, 335, 203, -14 },
+  { -24, 53, 339, 48, -1377, -1396, 3575, 11191, 13618, 8015, 737, -1850, -689, 326, 214, -12 },
+  { -24, 46, 332, 78, -1331, -1461, 3346, 10991, 13676, 8261, 909, -1847, -738, 315, 224, -9 },
+  { -23, 40, 325, 105, -1285, -1521, 3120, 10786, 13726, 8506, 1086, -1840, -788, 303, 234, -6 },
+  { -22, 34, 317, 131, -1237, -1575, 2897, 10576, 13767, 8748, 1269, -1829, -838, 289, 244, -3 },
+  { -21, 28, 309, 156, -1188, -1624, 2678, 10361, 13797, 8988, 1456, -1813, -889, 275, 254, 1 },
+  { -20, 23, 300, 179, -1139, -1667, 2464, 10142, 13821, 9225, 1648, -1794, -939, 258, 263, 4 },
+  { -19, 18, 292, 201, -1090, -1706, 2253, 9918, 13831, 9460, 1845, -1769, -989, 241, 273, 9 },
+  { 0, 13, 282, 222, -1039, -1739, 2046, 9685, 13828, 9685, 2046, -1739, -1039, 222, 282, 13 },
+};
+
+class PolyphaseResampler {
+public:
+  // Prepare to convert from |rate|. Keeps the filter history if the rate
+  // did not change, so looped files stay seamless. Call Clear() before
+  // a file that doesn't follow on from the last one.
+  // Returns false if the rate is not supported.
+  bool Setup(uint32_t rate) {
+    if (rate == rate_) return true;
+    if (rate < 8000 || rate > 96000) return false;
+    uint32_t g = gcd(rate, AUDIO_RATE);
+    step_ = rate / g;
+    period_ = AUDIO_RATE / g;
+    phase_mul_ = (kResamplePhases << 16) / period_;
+    if (rate < AUDIO_RATE) {
+      table_ = resample_up[0]; taps_ = 8;
+    } else if (rate <= 48000) {
+      table_ = resample_48k[0]; taps_ = 8;
+    } else if (rate <= 88200) {
+      table_ = resample_88k[0]; taps_ = 16;
+    } else {
+      table_ = resample_96k[0]; taps_ = 16;
+    }
+    rate_ = rate;
+    Clear();
+    return true;
+  }
+
+  void Clear() {
+    frac_ = 0;
+    pos_ = 0;
+    for (size_t i = 0; i < NELEM(hist_); i++) hist_[i] = 0;
+  }
+
+  // Feed one input sample. Writes up to kMaxResampleOutput samples
+  // to |out| and returns how many were written.
+  int Push(int16_t sample, int16_t* out) __attribute__((optimize("Ofast"))) {
+    // History is stored twice so that the taps are always contiguous.
+    hist_[pos_] = hist_[pos_ + taps_] = sample;
+    if (++pos_ == taps_) pos_ = 0;
+    const int16_t* x = hist_ + pos_;    // oldest .. newest
+    int n = 0;
+    while (frac_ < period_) {
+      uint32_t p = frac_ * phase_mul_;
+      const int16_t* c = table_ + (p >> 16) * taps_;
+      int32_t a, b;
+      if (taps_ == 8) {
+        a = Dot<8>(x, c);
+        b = Dot<8>(x, c + 8);
+      } else {
+        a = Dot<16>(x, c);
+        b = Dot<16>(x, c + 16);
+      }
+      int32_t f = (p & 0xffff) >> 1;      // Q15 position between rows
+      int32_t v = a + (((int64_t)(b - a) * f) >> 15);
+      out[n++] = clamptoi16(v >> 15);
+      frac_ += step_;
+    }
+    frac_ -= period_;
+    return n;
+  }
+
+  uint32_t rate() const { return rate_; }
+
+private:
+  template<int TAPS>
+  static int32_t Dot(const int16_t* x, const int16_t* c) {
+    int32_t sum = 0;
+    for (int j = 0; j < TAPS; j++) sum += x[j] * c[j];
+    return sum;
+  }
+
+  static uint32_t gcd(uint32_t a, uint32_t b) {
+    while (b) {
+      uint32_t t = a % b;
+      a = b;
+      b = t;
+    }
+    return a;
+  }
+
+  const int16_t* table_ = resample_up[0];
+  uint32_t rate_ = 0;
+  // Output time within the current input interval, in 1/period_ units.
+  uint32_t frac_ = 0;
+  uint32_t step_ = 1;       // input rate / gcd
+  uint32_t period_ = 1;     // output rate / gcd
+  uint32_t phase_mul_ = 0;  // frac_ -> table row, Q16
+  int taps_ = 8;
+  int pos_ = 0;
+  int16_t hist_[32];
+};
+
+#endif
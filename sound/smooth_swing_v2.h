@@ -5,6 +5,36 @@
 // For more details, see:
 // http://therebelarmory.com/thread/9138/smoothswing-v2-algorithm-description
 //
+// Runs on every motion sample, so it is done in fixed point: speeds are
+// 1/16 degrees per second, swing strength and volumes are Q15 (32768 = 1.0)
+// and angles are millidegrees.
+
+// x^SwingSharpness for x in [0, 1], Q15, from a table that is only
+// rebuilt when the sharpness changes.
+class SwingCurve {
+public:
+  static const int kSteps = 64;
+
+  void Update(float sharpness) {
+    if (sharpness == sharpness_) return;
+    sharpness_ = sharpness;
+    for (int i = 0; i <= kSteps; i++) {
+      table_[i] = powf(i / (float)kSteps, sharpness) * 32768.0f + 0.5f;
+    }
+  }
+
+  int32_t Get(int32_t x) const {
+    int i = x >> 9;   // 32768 / kSteps
+    if (i >= kSteps) return table_[kSteps];
+    int32_t f = x & 511;
+    return table_[i] + (((table_[i + 1] - table_[i]) * f) >> 9);
+  }
+
+private:
+  float sharpness_ = -1.0f;
+  int32_t table_[kSteps + 1];
+};
+
 class SmoothSwingV2 : public SaberBasePassThrough {
 public:
   SmoothSwingV2() : SaberBasePassThrough() {}
@@ -26,6 +56,9 @@ public:
         STDOUT.println("Warning, swingl and swingh should have the same number of files.");
       #endif
     }
+#if PAIRED_SWING_PLAYER
+    paired_swing_player.CheckPairs(L, H);
+#endif
 
 
     // check for swngxx files to use as accent swings
@@ -85,21 +118,27 @@ public:
     if (!on_) return;
     uint32_t m = millis();
     // No point in picking a new random so soon after picking one.
-    if (A.player && m - last_random_ < 1000) return;
+    if (A.has_player() && m - last_random_ < 1000) return;
     last_random_ = m;
     int swing = random(L->files_found());
     float start = m / 1000.0;
     A.Stop();
     B.Stop();
+#if PAIRED_SWING_PLAYER
+    paired_swing_player.Play(L, H, swing, start);
+    A.channel = 0;
+    B.channel = 1;
+#else
     L->Select(swing);
     H->Select(swing);
     A.Play(L, start);
     B.Play(H, start);
+#endif
     if (random(2)) Swap();
-    float t1_offset = random(1000) / 1000.0 * 50 + 10;
-    A.SetTransition(t1_offset, smooth_swing_config.Transition1Degrees);
-    B.SetTransition(t1_offset + 180.0,
-      smooth_swing_config.Transition2Degrees);
+    int32_t t1_offset = random(1000) * 50 + 10000;
+    A.SetTransition(t1_offset, smooth_swing_config.Transition1Degrees * 1000);
+    B.SetTransition(t1_offset + 180000,
+      smooth_swing_config.Transition2Degrees * 1000);
   }
 
   void SB_On() override {
@@ -107,7 +146,7 @@ public:
     // Starts hum, etc.
     delegate_->SB_On();
     PickRandomSwing();
-    if (!A.player || !B.player) {
+    if (!A.has_player() || !B.has_player()) {
       STDOUT.println("SmoothSwing V2 cannot allocate wav player.");
     }
   }
@@ -141,19 +180,23 @@ public:
       gyro_filter_.filter(raw_gyro);
     }
     Vec3 gyro = gyro_filter_.filter(raw_gyro);
-    // degrees per second
     // May not need to smooth gyro since volume is smoothed.
-    float speed = sqrtf(gyro.z * gyro.z + gyro.y * gyro.y);
+    // 1/8 degrees per second, so that the squares fit in 32 bits.
+    int32_t y = clampi32(gyro.y * 8, -32767, 32767);
+    int32_t z = clampi32(gyro.z * 8, -32767, 32767);
+    speed_root_ = SquareRoot((uint32_t)(y * y) + (uint32_t)(z * z), speed_root_);
+    int32_t speed = speed_root_ * 2;   // 1/16 degrees per second
     uint32_t t = micros();
     uint32_t delta = t - last_micros_;
     if (delta > 1000000) delta = 1;
     last_micros_ = t;
-    float hum_volume = 1.0;
+    int32_t hum_volume = 32768;
+    int32_t threshold = smooth_swing_config.SwingStrengthThreshold * 16;
 
     switch (state_) {
       case SwingState::OFF:
           if (paused) break;
-        if (speed < smooth_swing_config.SwingStrengthThreshold) {
+        if (speed < threshold) {
           break;
         }
         state_ = SwingState::ON;
@@ -164,34 +207,39 @@ public:
           delegate_->StartSwing(gyro, smooth_swing_config.AccentSwingSpeedThreshold,
           smooth_swing_config.AccentSlashAccelerationThreshold);
         }
-        if (speed >= smooth_swing_config.SwingStrengthThreshold * 0.9) {
-          float swing_strength =
-            std::min<float>(1.0, speed / smooth_swing_config.SwingSensitivity);
-          A.rotate(-speed * delta / 1000000.0);
+        if (speed * 10 >= threshold * 9) {
+          int32_t sensitivity = std::max<int32_t>(1, smooth_swing_config.SwingSensitivity * 16);
+          int32_t swing_strength = std::min<int32_t>(32768, (speed << 15) / sensitivity);
+          // millidegrees; keep speed * delta within 32 bits
+          A.rotate(-(int32_t)(delta < 65536 ?
+                              ((uint32_t)speed * delta + 8000) / 16000 :
+                              (uint32_t)speed * (delta / 1000) / 16));
           // If the current transition is done, switch A & B,
           // and set the next transition to be 180 degrees from the one
           // that is done.
-          while (A.end() < 0.0) {
-            B.midpoint = A.midpoint + 180.0;
+          while (A.end() < 0) {
+            B.midpoint = A.midpoint + 180000;
 	    Swap();
           }
-          float mixab = 0.0;
-          if (A.begin() < 0.0)
-            mixab = clamp(- A.begin() / A.width, 0.0, 1.0);
+          int32_t mixab = 0;
+          if (A.begin() < 0)
+            mixab = std::min<int32_t>(32768, ((uint32_t)-A.begin() * A.inv_width) >> 15);
 
-          float mixhum =
-            powf(swing_strength, smooth_swing_config.SwingSharpness);
+          curve_.Update(smooth_swing_config.SwingSharpness);
+          int32_t mixhum = curve_.Get(swing_strength);
 
-          hum_volume =
-            1.0 - mixhum * smooth_swing_config.MaximumHumDucking / 100.0;
+          int32_t ducking = smooth_swing_config.MaximumHumDucking * 327.68f;
+          hum_volume = 32768 - ((mixhum * ducking) >> 15);
 
-          mixhum *= smooth_swing_config.MaxSwingVolume;
+          int32_t max_volume = smooth_swing_config.MaxSwingVolume * 256;
+          mixhum = (mixhum * max_volume) >> 8;
 
           if (on_) {
             // We need to stop setting the volume when off, or playback may never stop.
-            mixhum = delegate_->SetSwingVolume(swing_strength, mixhum);
-            A.set_volume(mixhum * mixab);
-            B.set_volume(mixhum * (1.0 - mixab));
+            mixhum = delegate_->SetSwingVolume(swing_strength * (1.0f / 32768),
+                                               mixhum * (1.0f / 32768)) * 32768;
+            A.set_volume(((int64_t)mixhum * mixab) >> 15);
+            B.set_volume(((int64_t)mixhum * (32768 - mixab)) >> 15);
           }
           break;
         }
@@ -204,23 +252,63 @@ public:
         state_ = SwingState::OFF;
     }
     // Must always set hum volume, or fade-out doesn't work.
-    delegate_->SetHumVolume(hum_volume);
+    delegate_->SetHumVolume(hum_volume * (1.0f / 32768));
   }
 
 private:
+  // Integer square root of |x|, by Newton's method from |guess|. The swing
+  // speed changes little between motion samples, so starting from the last
+  // one takes a couple of steps.
+  static uint32_t SquareRoot(uint32_t x, uint32_t guess) {
+    if (!x) return 0;
+    // One step from anywhere ends up at or above the root.
+    uint32_t r = std::max<uint32_t>(guess, 1);
+    r = (r + x / r) >> 1;
+    while (true) {
+      uint32_t next = (r + x / r) >> 1;
+      if (next >= r) return r;
+      r = next;
+    }
+  }
+
   struct Data {
-    void set_volume(float v) {
-      if (player) player->set_volume(v);
+#if PAIRED_SWING_PLAYER
+    // Q15, 32768 = kDefaultVolume
+    void set_volume(int32_t v) {
+      if (channel >= 0) paired_swing_player.set_volume(channel, (int)(((int64_t)v * kDefaultVolume) >> 15));
+    }
+    bool has_player() const { return channel >= 0; }
+    bool isPlaying() {
+      return channel >= 0 && paired_swing_player.isPlaying();
+    }
+    void Off() {
+      if (channel < 0) return;
+      paired_swing_player.set_fade_time(0.2);  // Read from config file?
+      paired_swing_player.FadeAndStop();
+    }
+    void Free() { channel = -1; }
+    void Stop() {
+      if (channel >= 0) paired_swing_player.Stop();
+    }
+    bool isOff() {
+      return channel < 0 || paired_swing_player.isOff(channel);
+    }
+    int channel = -1;   // of paired_swing_player, 0 = low, 1 = high
+#else
+    // Q15, 32768 = kDefaultVolume
+    void set_volume(int32_t v) {
+      if (player) player->set_volume((int)(((int64_t)v * kDefaultVolume) >> 15));
     }
     void Play(Effect* effect, float start = 0.0) {
       if (!player) {
-	player = GetFreeWavPlayer();
+	player = GetFreeWavPlayer(false, BUS_SWING);
 	if (!player) return;
       }
       player->set_volume(0.0f);
       player->PlayOnce(effect, start);
       player->PlayLoop(effect);
     }
+    bool has_player() const { return (bool)player; }
     bool isPlaying() {
       if (!player) return false;
       return player->isPlaying();
@@ -242,18 +330,22 @@ private:
       if (!player) return true;
       return player->isOff();
     }
-    void SetTransition(float mp, float w) {
+    RefPtr<BufferedWavPlayer> player;
+#endif
+    // Millidegrees.
+    void SetTransition(int32_t mp, int32_t w) {
       midpoint = mp;
-      width = w;
+      width = std::max<int32_t>(1, w);
+      inv_width = (1u << 30) / width;
     }
-    float begin() const { return midpoint - width / 2; }
-    float end() const { return midpoint + width / 2; }
-    void rotate(float degrees) {
-      midpoint += degrees;
+    int32_t begin() const { return midpoint - width / 2; }
+    int32_t end() const { return midpoint + width / 2; }
+    void rotate(int32_t millidegrees) {
+      midpoint += millidegrees;
     }
-    RefPtr<BufferedWavPlayer> player;
-    float midpoint = 0.0;
-    float width = 0.0;
+    int32_t midpoint = 0;
+    int32_t width = 1;
+    uint32_t inv_width = 1u << 30;   // 2^30 / width
   };
   Data A;
   Data B;
@@ -263,7 +355,9 @@ private:
   bool accent_swings_present = false;
   bool accent_slashes_present = false;
   BoxFilter<Vec3, 3> gyro_filter_;
+  SwingCurve curve_;
   uint32_t last_micros_;
+  uint32_t speed_root_ = 0;   // last SquareRoot(), 1/8 degrees per second
   SwingState state_ = SwingState::OFF;;
   Effect *L, *H;
 };
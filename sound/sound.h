@@ -7,7 +7,29 @@
 #define AUDIO_BUFFER_SIZE 44
 #endif
 #define AUDIO_RATE 44100
+// Idle players are not on the mixer's active list, so more of them
+// only cost RAM, not interrupt time.
+#ifndef NUM_WAV_PLAYERS
 #define NUM_WAV_PLAYERS 8
+#endif
+// SmoothSwing V2 plays swingl/swingh from one PairedWavPlayer, which is an
+// extra mixer stream.
+#ifndef PAIRED_SWING_PLAYER
+#ifdef ARDUINO_ARCH_ESP32   // ESP architecture
+#define PAIRED_SWING_PLAYER 1
+#else
+#define PAIRED_SWING_PLAYER 0     // ~8 kB of RAM
+#endif
+#endif
+// When all wav players are busy, GetFreeWavPlayer() takes one away from
+// a lower or equal priority sound, which fades out in an extra mixer stream.
+#ifndef VOICE_STEALING
+#ifdef ARDUINO_ARCH_ESP32   // ESP architecture
+#define VOICE_STEALING 1
+#else
+#define VOICE_STEALING 0
+#endif
+#endif
 
 
 
@@ -22,6 +44,8 @@
 #include "dynamic_mixer.h"
 #ifdef ARDUINO_ARCH_ESP32   // ESP architecture
 #include "dac_os.h"
+#elif defined(PROFFIE_TEST)
+// tests/host.h provides dac.
 #else
 #include "dac.h"
 #endif
@@ -34,23 +58,200 @@ Beeper beeper;
 Talkie talkie;
 
 #include "buffered_audio_stream.h"
+#if VOICE_STEALING
+#include "stolen_voice_fade.h"
+StolenVoiceFade stolen_voice_fade;
+#endif
 
 size_t WhatUnit(class BufferedWavPlayer* player);
 
 #include "effect.h"
+#include "attack_cache.h"
 #include "buffered_wav_player.h"
+#include "paired_wav_player.h"
+#include "wav_buffer_pool.h"
 
 BufferedWavPlayer wav_players[NUM_WAV_PLAYERS];
 RefPtr<BufferedWavPlayer> track_player_;
 
-RefPtr<BufferedWavPlayer> GetFreeWavPlayer()  {
-  // Find a free wave playback unit.
-  for (size_t unit = 0; unit < NELEM(wav_players); unit++) {
+#if WAV_BUFFER_POOL
+WavBufferPool wav_buffer_pool;
+
+void SetupWavPlayerBuffers() {}
+
+void FreeWavPlayerBuffers(BufferedWavPlayer* player) {
+  wav_buffer_pool.Free(player->buffer(), player->buffer_size() * sizeof(int16_t));
+  wav_buffer_pool.Free(player->read_buffer(), player->read_size());
+  player->ClearBuffers();
+}
+
+// Hands the buffers of the players that are done back to the pool.
+void ReclaimWavPlayerBuffers() {
+  bool locked = false;
+  for (size_t i = 0; i < NELEM(wav_players); i++) {
+    if (!wav_players[i].has_buffers() || !wav_players[i].Available()) continue;
+    if (!locked) {
+      AudioStreamWork::LockSD_nomount(true);   // FillBuffer() is done and won't run
+      locked = true;
+    }
+    FreeWavPlayerBuffers(wav_players + i);
+  }
+  if (locked) AudioStreamWork::LockSD_nomount(false);
+}
+
+bool AllocWavPlayerBuffers(BufferedWavPlayer* player, size_t samples, size_t read_size) {
+  void* s = wav_buffer_pool.Alloc(samples * sizeof(int16_t));
+  if (!s) return false;
+  void* r = wav_buffer_pool.Alloc(read_size);
+  if (!r) {
+    wav_buffer_pool.Free(s, samples * sizeof(int16_t));
+    return false;
+  }
+  player->SetBuffers((int16_t*)s, samples, (unsigned char*)r, read_size);
+  return true;
+}
+
+// Players other than |player| that have long buffers.
+int WavPlayersWithLongBuffers(BufferedWavPlayer* player) {
+  int ret = 0;
+  for (size_t i = 0; i < NELEM(wav_players); i++) {
+    if (wav_players + i != player && wav_players[i].buffer_size() >= LONG_AUDIO_BUFFER_SIZE) ret++;
+  }
+  return ret;
+}
+
+// Give the (available) |player| buffers for a long or a short sound.
+// Like with fixed buffers, at most NUM_LONG_WAV_PLAYERS players get long
+// ones, so a pool of the default size always has room for all players.
+// A long sound gets short buffers if there is no room for long ones.
+bool SetupPooledWavPlayerBuffers(BufferedWavPlayer* player, bool long_sound) {
+  if (long_sound && WavPlayersWithLongBuffers(player) >= NUM_LONG_WAV_PLAYERS) {
+    long_sound = false;
+  }
+  size_t samples = long_sound ? LONG_AUDIO_BUFFER_SIZE : AUDIO_BUFFER_SIZE_BYTES;
+  size_t read_size = long_sound ? LONG_AUDIO_READ_SIZE : AUDIO_READ_SIZE;
+  bool ok = player->buffer_size() >= samples;
+  if (!ok) {
+    if (player->has_buffers()) {
+      AudioStreamWork::LockSD_nomount(true);
+      FreeWavPlayerBuffers(player);
+      AudioStreamWork::LockSD_nomount(false);
+    }
+    ok = AllocWavPlayerBuffers(player, samples, read_size);
+  }
+  if (!ok) {
+    ReclaimWavPlayerBuffers();
+    ok = AllocWavPlayerBuffers(player, samples, read_size) ||
+      (long_sound && AllocWavPlayerBuffers(player, AUDIO_BUFFER_SIZE_BYTES, AUDIO_READ_SIZE));
+  }
+  if (!ok) wav_buffer_pool.NoteFailure();
+  return ok;
+}
+
+// Returns buffers as soon as their sound is done, so that the pool's
+// high water mark is what actually plays at the same time.
+class WavBufferReclaimer : public Looper {
+public:
+  const char* name() override { return "WavBufferReclaimer"; }
+  void Loop() override { ReclaimWavPlayerBuffers(); }
+};
+
+WavBufferReclaimer wav_buffer_reclaimer;
+#else
+// The first NUM_LONG_WAV_PLAYERS players get the long buffers.
+#if NUM_LONG_WAV_PLAYERS > NUM_WAV_PLAYERS
+#error NUM_LONG_WAV_PLAYERS cannot be larger than NUM_WAV_PLAYERS
+#endif
+#define NUM_SHORT_WAV_PLAYERS (NUM_WAV_PLAYERS - NUM_LONG_WAV_PLAYERS)
+int16_t long_wav_samples[NUM_LONG_WAV_PLAYERS][LONG_AUDIO_BUFFER_SIZE];
+unsigned char long_wav_reads[NUM_LONG_WAV_PLAYERS][LONG_AUDIO_READ_SIZE] __attribute__((aligned(4)));
+int16_t short_wav_samples[NUM_SHORT_WAV_PLAYERS][AUDIO_BUFFER_SIZE_BYTES];
+unsigned char short_wav_reads[NUM_SHORT_WAV_PLAYERS][AUDIO_READ_SIZE] __attribute__((aligned(4)));
+
+void SetupWavPlayerBuffers() {
+  for (size_t i = 0; i < NELEM(wav_players); i++) {
+    if (wav_players[i].has_buffers()) continue;
+    if (i < NUM_LONG_WAV_PLAYERS) {
+      wav_players[i].SetBuffers(long_wav_samples[i], LONG_AUDIO_BUFFER_SIZE,
+                                long_wav_reads[i], LONG_AUDIO_READ_SIZE);
+    } else {
+      size_t j = i - NUM_LONG_WAV_PLAYERS;
+      wav_players[i].SetBuffers(short_wav_samples[j], AUDIO_BUFFER_SIZE_BYTES,
+                                short_wav_reads[j], AUDIO_READ_SIZE);
+    }
+  }
+}
+#endif  // WAV_BUFFER_POOL
+
+// GetFreeWavPlayer() calls that found a player by stealing one, and
+// that found none at all.
+uint32_t wav_players_stolen = 0;
+uint32_t wav_players_dropped = 0;
+
+// Sounds can only steal players from sounds of the same or a lower
+// priority. Effects (clashes, blasts...) are lowest, then swings;
+// hum, voice and tracks are never stolen.
+const uint8_t kWavPlayerNotStolen = 2;
+uint8_t WavPlayerPriority(MixerBus bus) {
+  switch (bus) {
+    case BUS_EFFECTS: return 0;
+    case BUS_SWING: return 1;
+    default: return kWavPlayerNotStolen;
+  }
+}
+
+#if VOICE_STEALING
+// Of the playing players nobody holds a reference to, the one with the
+// lowest priority, and of those the one that started first.
+BufferedWavPlayer* PickWavPlayerToSteal(uint8_t priority) {
+  BufferedWavPlayer* best = nullptr;
+  for (size_t i = 0; i < NELEM(wav_players); i++) {
+    BufferedWavPlayer* p = wav_players + i;
+    if (p->refs() || !p->isPlaying()) continue;
+    if (p->priority() > priority || p->priority() >= kWavPlayerNotStolen) continue;
+    if (!best || p->priority() < best->priority() ||
+        (p->priority() == best->priority() && (int32_t)(p->started() - best->started()) < 0)) {
+      best = p;
+    }
+  }
+  return best;
+}
+#endif
+
+RefPtr<BufferedWavPlayer> AcquireWavPlayer(BufferedWavPlayer* player, bool long_sound, MixerBus bus) {
+#if WAV_BUFFER_POOL
+  if (!SetupPooledWavPlayerBuffers(player, long_sound)) return RefPtr<BufferedWavPlayer>();
+#endif
+  player->reset_volume();
+  player->set_bus(bus);
+  player->set_priority(WavPlayerPriority(bus));
+  return RefPtr<BufferedWavPlayer>(player);
+}
+
+// Find a free wave playback unit. Long sounds (hum, tracks, swing loops)
+// prefer players with long buffers, everything else tries the short ones
+// first, so that clashes don't take the long buffers away.
+// The player is put on mixer bus |bus|.
+RefPtr<BufferedWavPlayer> GetFreeWavPlayer(bool long_sound = false, MixerBus bus = BUS_EFFECTS)  {
+  for (size_t i = 0; i < NELEM(wav_players); i++) {
+    size_t unit = long_sound ? i : (i + NUM_LONG_WAV_PLAYERS) % NELEM(wav_players);
     if (wav_players[unit].Available()) {
-      wav_players[unit].reset_volume();
-      return RefPtr<BufferedWavPlayer>(wav_players + unit);
+      RefPtr<BufferedWavPlayer> ret = AcquireWavPlayer(wav_players + unit, long_sound, bus);
+      if (ret) return ret;
+      break;   // out of buffers
+    }
+  }
+#if VOICE_STEALING
+  if (BufferedWavPlayer* victim = PickWavPlayerToSteal(WavPlayerPriority(bus))) {
+    victim->StealInto(&stolen_voice_fade);
+    RefPtr<BufferedWavPlayer> ret = AcquireWavPlayer(victim, long_sound, bus);
+    if (ret) {
+      wav_players_stolen++;
+      return ret;
     }
   }
+#endif
+  wav_players_dropped++;
   return RefPtr<BufferedWavPlayer>();
 }
 
@@ -64,9 +265,9 @@ RefPtr<BufferedWavPlayer> GetWavPlayerPlaying(Effect* effect) {
   return RefPtr<BufferedWavPlayer>();
 }
 
-RefPtr<BufferedWavPlayer> RequireFreeWavPlayer()  {
+RefPtr<BufferedWavPlayer> RequireFreeWavPlayer(bool long_sound = false, MixerBus bus = BUS_EFFECTS)  {
   while (true) {
-    RefPtr<BufferedWavPlayer> ret = GetFreeWavPlayer();
+    RefPtr<BufferedWavPlayer> ret = GetFreeWavPlayer(long_sound, bus);
     if (ret) return ret;
     STDOUT.println("Failed to get hum player, trying again!");
     delay(100);
@@ -80,6 +281,7 @@ size_t WhatUnit(class BufferedWavPlayer* player) {
 
 void SetupStandardAudioLow() {
 //  audio_splicer.Deactivate();
+  SetupWavPlayerBuffers();
   for (size_t i = 0; i < NELEM(wav_players); i++) {
     if (wav_players[i].refs() != 0) {
       STDOUT.println("WARNING, wav player still referenced!");
@@ -88,12 +290,26 @@ void SetupStandardAudioLow() {
     wav_players[i].reset_volume();
   }
   dynamic_mixer.streams_[NELEM(wav_players)] = &beeper;
+  beeper.set_bus(BUS_VOICE);
   dynamic_mixer.streams_[NELEM(wav_players)+1] = &talkie;
+  talkie.set_bus(BUS_VOICE);
+#if PAIRED_SWING_PLAYER
+  dynamic_mixer.streams_[NELEM(wav_players)+2] = &paired_swing_player;
+  paired_swing_player.set_bus(BUS_SWING);
+#endif
+#if VOICE_STEALING
+  dynamic_mixer.streams_[NELEM(wav_players)+2+PAIRED_SWING_PLAYER] = &stolen_voice_fade;
+#endif
+  // Anything already playing gets linked in; the rest drops out at eof.
+  for (size_t i = 0; i < NELEM(dynamic_mixer.streams_); i++) {
+    dynamic_mixer.streams_[i]->Activate();
+  }
 }
 
 void SetupStandardAudio() {
 #ifdef ARDUINO_ARCH_ESP32   // ESP architecture
   SetupStandardAudioLow();
+  AudioStreamWork::SetupFillTask();
   dac_OS.SetStream(&dynamic_mixer);
 #else
   dac.SetStream(NULL);
@@ -124,7 +340,9 @@ uint8_t GetNrOFPlayingPlayers(bool excludeTrack = false)
     dac.RequestPower();
     #endif 
     }
+#endif
 
+// Also used by the preset prefetch, on all boards.
   bool SoundActive() {
     if (!dynamic_mixer.get_volume()) return false;    // muted
     for (size_t i = 0; i < NELEM(wav_players); i++)
@@ -132,8 +350,16 @@ uint8_t GetNrOFPlayingPlayers(bool excludeTrack = false)
         return true;
     if (beeper.isPlaying()) return true;
     if (talkie.isPlaying()) return true;
+#if PAIRED_SWING_PLAYER
+    if (paired_swing_player.isPlaying()) return true;
+#endif
+#if VOICE_STEALING
+    if (!stolen_voice_fade.eof()) return true;
+#endif
     return false;
   } 
+
+#ifdef ULTRAPROFFIE
   const auto AmplifierIsActive = SoundActive;   
 
   // Stubs (for backward compatibility only)
@@ -146,6 +372,7 @@ uint8_t GetNrOFPlayingPlayers(bool excludeTrack = false)
 
 
 #include "../common/config_file.h"
+#include "preset_prefetch.h"
 #include "hybrid_font.h"
 
 HybridFont hybrid_font;
@@ -0,0 +1,53 @@
+#ifndef SOUND_STOLEN_VOICE_FADE_H
+#define SOUND_STOLEN_VOICE_FADE_H
+
+// Samples a stolen voice fades out over, ~3 ms.
+#ifndef STOLEN_VOICE_FADE
+#define STOLEN_VOICE_FADE 128
+#endif
+
+// Plays the fade-out of wav players that GetFreeWavPlayer() took away
+// from a sound that was still playing. Stealing copies the next samples
+// from the player's buffer, already decoded, with the player's gain and a
+// linear ramp down to zero. The mixer then reads them from here, starting
+// exactly where it stopped reading the player, and the player is free
+// for the new sound right away.
+class StolenVoiceFade : public ProffieOSAudioStream {
+public:
+  // Take up to STOLEN_VOICE_FADE of the |n| samples starting at |start|
+  // in the ring |ring| (|size|, a power of 2), at Q14 |gain|.
+  // Call under ScopedMixerLock, together with pausing the player: read()
+  // runs in the mixer, and fade_, pos_ and left_ are shared with it.
+  void Add(const int16_t* ring, size_t size, size_t start, int n, int32_t gain) {
+    n = std::min<int>(n, STOLEN_VOICE_FADE);
+    int32_t step = gain / (n + 1);
+    int32_t g = gain;
+    for (int i = 0; i < n; i++) {
+      g -= step;
+      int32_t s = ring[(start + i) & (size - 1)];
+      fade_[(pos_ + i) % STOLEN_VOICE_FADE] += (s * g) >> kGainShift;
+    }
+    left_ = std::max(left_, n);
+    Activate();
+  }
+
+  int read(int16_t* data, int elements) override {
+    int n = std::min(elements, left_);
+    for (int i = 0; i < n; i++) {
+      data[i] = clamptoi16(fade_[pos_]);
+      fade_[pos_] = 0;
+      pos_ = (pos_ + 1) % STOLEN_VOICE_FADE;
+    }
+    left_ -= n;
+    return n;
+  }
+
+  bool eof() const override { return left_ == 0; }
+
+private:
+  int32_t fade_[STOLEN_VOICE_FADE] = {};
+  int pos_ = 0;
+  int left_ = 0;
+};
+
+#endif
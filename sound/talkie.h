@@ -625,6 +625,21 @@ const int32_t lanc2_11[] = {
 class Frame {
 public:
   bool voiced() const { return period != 0; }
+  // Energy and pitch period only, see Talkie::RenderBlock().
+  void lerp_source(const Frame &A, const Frame &B,
+      int count, int maxcount) {
+    if (!A.inited) {
+      energy = period = 0;
+    } else if (A.voiced() != B.voiced() || !B.inited) {
+      energy = A.energy;
+      period = A.period;
+    } else {
+      int b = count * 16384 / maxcount;
+      int a = 16384 - b;
+      energy = (A.energy * a + B.energy * b) >> 14;
+      period = (A.period * a + B.period * b) >> 14;
+    }
+  }
   void lerp(const Frame &A, const Frame &B,
       int count, int maxcount) {
     if (!A.inited) {
@@ -648,7 +663,7 @@ public:
   }
   int32_t energy;
   int32_t period;
-  int32_t k[10];
+  int32_t k[10];     // Q15
   bool inited = false;
 };
 
@@ -690,10 +705,12 @@ public:
       rate_ = rate;
       coeffs_ = coeffs;
       count_ = rate_ - 1;
+      block_len_ = block_pos_ = 0;
       ptrAddr = addr;
       ptrBit = 0;
     }
     interrupts();
+    Activate();
   }
 
   void SayDigit(int digit) {
@@ -829,10 +846,10 @@ public:
       // A repeat frame uses the last coefficients
       if (!repeat) {
 	for (int i = 0; i < 4; i++)
-	  new_frame.k[i] = coeffs_->ktable[i][getBits(coeffs_->kbits[i])];
+	  new_frame.k[i] = coeffs_->ktable[i][getBits(coeffs_->kbits[i])] << 6;
 	if (new_frame.period) {
 	  for (int i = 4; i < 10; i++)
-	    new_frame.k[i] = coeffs_->ktable[i][getBits(coeffs_->kbits[i])];
+	    new_frame.k[i] = coeffs_->ktable[i][getBits(coeffs_->kbits[i])] << 6;
 	} else {
 	  for (int i = 4; i < 10; i++)
 	    new_frame.k[i] = 0;
@@ -841,18 +858,35 @@ public:
     }
   }
   
-  int16_t Get8kHz() {
-    if (count_++ >= rate_) {
+  // Renders the next sub-block of 8kHz samples into block_. Reflection
+  // coefficients are interpolated once per sub-block, at its middle, and
+  // sub-blocks never straddle frames. Energy and pitch are still
+  // interpolated per sample: holding the pitch moves the pitch pulses,
+  // which changes the level of some frames by over 10 dB.
+  void RenderBlock() {
+    if (count_ >= rate_) {
       ReadFrame();
       count_ = 0;
+    } else {
+      count_++;
     }
-
+    int n = rate_ - count_ + 1;
+    if (n > kBlock) n = kBlock;
     Frame f;
-    f.lerp(old_frame, new_frame, count_, rate_);
-
-    
-    int32_t u[11];
+    f.lerp(old_frame, new_frame, count_ + (n - 1) / 2, rate_);
+    for (int i = 0; i < n; i++) {
+      f.lerp_source(old_frame, new_frame, count_ + i, rate_);
+      block_[i] = Synthesize(f);
+    }
+    count_ += n - 1;
+    block_len_ = n;
+    block_pos_ = 0;
+  }
 
+  // One 8kHz sample. Reflection coefficients are Q15, the lattice works
+  // with 3 more fraction bits than the TMS5220 did.
+  int16_t Synthesize(const Frame& f) {
+    int32_t u;
     if (f.period) {
       // Voiced source
       if (periodCounter < f.period) {
@@ -861,45 +895,38 @@ public:
         periodCounter = 0;
       }
       if (periodCounter < MAX_CHIRP_SIZE) {
-        u[10] = ((coeffs_->chirptable[periodCounter]) * f.energy) >> 3;
+        u = coeffs_->chirptable[periodCounter] * f.energy;
       } else {
-        u[10] = 0;
+        u = 0;
       }
     } else {
       // Unvoiced source
       static uint16_t synthRand = 1;
       synthRand = (synthRand >> 1) ^ ((synthRand & 1) ? 0xB800 : 0);
-      u[10] = ((synthRand & 1) ? f.energy : -f.energy) << 3;
+      u = ((synthRand & 1) ? f.energy : -f.energy) << 6;
     }
 
-#define matrix_multiply(X, Y) (((X)*(Y)) >> 9)
-    u[9] = u[10] - matrix_multiply(f.k[9], x[9]);
-    u[8] = u[9] - matrix_multiply(f.k[8], x[8]);
-    u[7] = u[8] - matrix_multiply(f.k[7], x[7]);
-    u[6] = u[7] - matrix_multiply(f.k[6], x[6]);
-    u[5] = u[6] - matrix_multiply(f.k[5], x[5]);
-    u[4] = u[5] - matrix_multiply(f.k[4], x[4]);
-    u[3] = u[4] - matrix_multiply(f.k[3], x[3]);
-    u[2] = u[3] - matrix_multiply(f.k[2], x[2]);
-    u[1] = u[2] - matrix_multiply(f.k[1], x[1]);
-    u[0] = u[1] - matrix_multiply(f.k[0], x[0]);
+    int32_t un[10];
+    for (int i = 9; i >= 0; i--) {
+      u -= (f.k[i] * x[i]) >> 15;
+      un[i] = u;
+    }
 
     // Output clamp
-    if (u[0] > 511) u[0] = 511;
-    if (u[0] < -512) u[0] = -512;
+    u = clampi32(u, -512 << 3, 511 << 3);
+    un[0] = u;
 
-    x[9] = x[8] + matrix_multiply(f.k[8], u[8]);
-    x[8] = x[7] + matrix_multiply(f.k[7], u[7]);
-    x[7] = x[6] + matrix_multiply(f.k[6], u[6]);
-    x[6] = x[5] + matrix_multiply(f.k[5], u[5]);
-    x[5] = x[4] + matrix_multiply(f.k[4], u[4]);
-    x[4] = x[3] + matrix_multiply(f.k[3], u[3]);
-    x[3] = x[2] + matrix_multiply(f.k[2], u[2]);
-    x[2] = x[1] + matrix_multiply(f.k[1], u[1]);
-    x[1] = x[0] + matrix_multiply(f.k[0], u[0]);
-    x[0] = u[0];
+    for (int i = 9; i > 0; i--) {
+      x[i] = x[i - 1] + ((f.k[i - 1] * un[i - 1]) >> 15);
+    }
+    x[0] = u;
 
-    return u[0] << 5;
+    return u << 2;
+  }
+
+  int16_t Get8kHz() {
+    if (block_pos_ == block_len_) RenderBlock();
+    return block_[block_pos_++];
   }
 
 #if 1
@@ -944,6 +971,7 @@ public:
 #endif
   
   int read(int16_t* data, int elements) override {
+    // Idle, which is nearly always: nothing to do.
     if (eof()) return 0;
     for (int i = 0; i < elements; i++) {
       data[i] = Get44kHz();
@@ -1052,6 +1080,12 @@ private:
   uint8_t pos_ = 0;
   uint8_t periodCounter;
   int32_t x[10];
+
+  // 8kHz samples, see RenderBlock().
+  static const int kBlock = 8;
+  int16_t block_[kBlock];
+  uint8_t block_len_ = 0;
+  uint8_t block_pos_ = 0;
 };
 
 #endif
@@ -1,7 +1,7 @@
 #ifndef SOUND_VOLUME_OVERLAY_H
 #define SOUND_VOLUME_OVERLAY_H
 
-const uint32_t kVolumeShift = 14;
+const uint32_t kVolumeShift = kGainShift;
 const uint32_t kMaxVolume = 1 << kVolumeShift;
 const uint32_t kDefaultVolume = kMaxVolume / 2;
 // 1 / 500 second for to change the volume. (2ms)
@@ -20,53 +20,46 @@ public:
 
 
 
-   int read(int16_t* data, int elements) override {
-    
+  // Reads raw samples and reports the gain to apply to them. All volume
+  // bookkeeping (ramping, stop when faded to zero) happens here,
+  // so read() and the mixer's fused path behave identically.
+  int read_gain(int16_t* data, int elements, int32_t* gain) override {
     elements = T::read(data, elements);
+    *gain = volume_.value();
     if (volume_.isConstant()) {
-      int32_t mult = volume_.value();
-      if (mult == kMaxVolume) { 
-        // Do nothing
-      } 
-      else if (mult == 0) {   // volume at 0
+      if (*gain == 0) {   // volume at 0
         if (stop_when_zero_.get()) {
           stop_when_zero_.set(false);
           volume_.set_speed(kDefaultSpeed);
-          T::Stop();    // stop stream
-          Stop();     // stop player 
+          // The mixer's stop: Stop() waits for FillBuffer(), this doesn't.
+          this->ScheduledStop(0.0);
           reset_volume(); // don't leave it at 0, we reuse players
         }
-        if (restart_when_zero_) {
-          volume_.set_speed(kDefaultSpeed);
-          reset_volume(); // don't leave it at 0, we reuse players       
-          if (nextVolume) set_volume_now(nextVolume);   // 
-          ResetWav(); // Don't alter repeating data, might wanna repeat whatever is starting
-          PlayOnce(restart_when_zero_);
-          restart_when_zero_ = 0;
-        }
-        for (int i = 0; i < elements; i++) data[i] = 0; 
-      } 
-      else { // volume at target
-        for (int i = 0; i < elements; i++) {
-          data[i] = clamptoi16((data[i] * mult) >> kVolumeShift);
-        }
       }
     } 
     else { // volume not at target
+      volume_.advance();    
+    }
+    return elements;
+  }
+
+  int read(int16_t* data, int elements) override {
+    int32_t mult;
+    elements = read_gain(data, elements, &mult);
+    if (mult == kMaxVolume) { 
+      // Do nothing
+    } 
+    else if (mult == 0) {
+      for (int i = 0; i < elements; i++) data[i] = 0; 
+    } 
+    else {
       for (int i = 0; i < elements; i++) {
-        int32_t v = data[i] * (int16_t)volume_.value();
-        v >>= kVolumeShift;
-        data[i] = clamptoi16(v);
+        data[i] = clamptoi16((data[i] * mult) >> kVolumeShift);
       }
-        volume_.advance();    
     }
     return elements;
   }
 
-  
-
- 
-
   float volume() {
     return volume_.value() * (1.0f / (1 << kVolumeShift));
   }
@@ -109,26 +102,8 @@ public:
     stop_when_zero_.set(true);
   }
 
-  private:
-    // bool restart_when_zero_ = false;
-    Effect* restart_when_zero_ = 0;     // effect to start when current one fades out
-    float nextVolume = 0;     // volume to be restored when starting new file (after fade)
-  public:
-    void FadeAndPlay(Effect* effect, float nVol = 0) {  // Fade out then restore volume and play whatever's in the pipeline
-      volume_.set_target(0);
-      restart_when_zero_ = effect;
-      nextVolume = nVol;
-    }
-
-  
-  virtual void ResetWav() {}  // Overloaded by BufferedWavPlayer to signal PlayWav that current sound ended at the end of fadeout
-                              // It's all spaghetti anyway, so why not...
   virtual void Stop() {}      // Stop player (overloaded by BufferedWavPlayer)
 
-  virtual void PlayOnce(Effect* effect, float start = 0.0) {}
-
-
-
   void ResetStopWhenZero() {
     stop_when_zero_.set(false);
   }
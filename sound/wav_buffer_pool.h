@@ -0,0 +1,140 @@
+#ifndef SOUND_WAV_BUFFER_POOL_H
+#define SOUND_WAV_BUFFER_POOL_H
+
+// With WAV_BUFFER_POOL, wav players don't own buffers. GetFreeWavPlayer()
+// takes a sample buffer and an SD read buffer for the player out of one
+// shared pool, long or short ones depending on the sound, and they go
+// back once the sound is done. The pool only has to hold the buffers of
+// the sounds that play at the same time: "wavstats" shows its high water
+// mark, and WAV_BUFFER_POOL_SIZE can be set to that plus some room, or
+// kept while NUM_WAV_PLAYERS goes up.
+#ifndef WAV_BUFFER_POOL
+#ifdef ARDUINO_ARCH_ESP32   // ESP architecture
+#define WAV_BUFFER_POOL 1
+#else
+#define WAV_BUFFER_POOL 0
+#endif
+#endif
+
+#if WAV_BUFFER_POOL
+
+// Bytes. Defaults to what the fixed per-player buffers take, which is
+// enough for all players to play long sounds at once.
+#ifndef WAV_BUFFER_POOL_SIZE
+#define WAV_BUFFER_POOL_SIZE \
+  (NUM_LONG_WAV_PLAYERS * (LONG_AUDIO_BUFFER_SIZE * 2 + LONG_AUDIO_READ_SIZE) + \
+   (NUM_WAV_PLAYERS - NUM_LONG_WAV_PLAYERS) * (AUDIO_BUFFER_SIZE_BYTES * 2 + AUDIO_READ_SIZE))
+#endif
+
+const size_t kWavBufferMinBlock = 512;
+
+// Smallest block order (size kWavBufferMinBlock << order) that holds |bytes|.
+constexpr int WavBufferOrder(size_t bytes, int order = 0) {
+  return (kWavBufferMinBlock << order) >= bytes ? order : WavBufferOrder(bytes, order + 1);
+}
+
+// Buddy allocator: blocks are kWavBufferMinBlock bytes times a power of 2 and
+// aligned to their size. Requests are rounded up to the next block size.
+// Ring and read buffer sizes are powers of 2 already, so nothing is lost
+// to rounding, and a freed block merges with its free buddy right away.
+// Only use from loop().
+class WavBufferPool {
+public:
+  WavBufferPool() {
+    for (int k = 0; k <= kMaxOrder; k++)
+      for (int w = 0; w < kWords; w++) free_[k][w] = 0;
+    for (int i = 0; i < kTopBlocks; i++) Mark(kMaxOrder, i, true);
+  }
+
+  // nullptr if there isn't a free block that large.
+  void* Alloc(size_t bytes) {
+    int order = Order(bytes);
+    if (order > kMaxOrder) return nullptr;
+    int i = Take(order);
+    if (i < 0) return nullptr;
+    used_ += kMinBlock << order;
+    high_water_ = std::max(high_water_, used_);
+    return arena_ + (i << order) * kMinBlock;
+  }
+
+  // |bytes| as passed to Alloc().
+  void Free(void* p, size_t bytes) {
+    if (!p) return;
+    int order = Order(bytes);
+    int i = ((unsigned char*)p - arena_) / kMinBlock >> order;
+    used_ -= kMinBlock << order;
+    while (order < kMaxOrder && IsFree(order, i ^ 1)) {
+      Mark(order, i ^ 1, false);
+      i >>= 1;
+      order++;
+    }
+    Mark(order, i, true);
+  }
+
+  size_t size() const { return sizeof(arena_); }
+  size_t used() const { return used_; }
+  size_t high_water() const { return high_water_; }
+
+  // A player got no buffers at all.
+  void NoteFailure() { failures_++; }
+
+  void ResetStats() {
+    high_water_ = used_;
+    failures_ = 0;
+  }
+
+  void DumpStats() {
+    STDOUT << "Wav buffer pool: size=" << size()
+           << " used=" << used()
+           << " high water=" << high_water()
+           << " players without buffers=" << failures_
+           << "\n";
+  }
+
+private:
+  static const size_t kMinBlock = kWavBufferMinBlock;
+
+  static int Order(size_t bytes) { return WavBufferOrder(bytes); }
+
+  // The largest block holds the largest buffer there is.
+  static const int kMaxOrder = std::max(
+    std::max(WavBufferOrder(LONG_AUDIO_BUFFER_SIZE * 2), WavBufferOrder(LONG_AUDIO_READ_SIZE)),
+    std::max(WavBufferOrder(AUDIO_BUFFER_SIZE_BYTES * 2), WavBufferOrder(AUDIO_READ_SIZE)));
+  static const size_t kMaxBlock = kMinBlock << kMaxOrder;
+  static const int kTopBlocks = (WAV_BUFFER_POOL_SIZE + kMaxBlock - 1) / kMaxBlock;
+  static const int kWords = ((kTopBlocks << kMaxOrder) + 31) / 32;
+
+  bool IsFree(int order, int i) const {
+    return free_[order][i >> 5] & (1u << (i & 31));
+  }
+  void Mark(int order, int i, bool is_free) {
+    if (is_free) free_[order][i >> 5] |= 1u << (i & 31);
+    else free_[order][i >> 5] &= ~(1u << (i & 31));
+  }
+
+  // Index of a free block of |order|, splitting a larger one if need be.
+  int Take(int order) {
+    if (order > kMaxOrder) return -1;
+    for (int w = 0; w < kWords; w++) {
+      if (free_[order][w]) {
+        int i = w * 32 + __builtin_ctz(free_[order][w]);
+        Mark(order, i, false);
+        return i;
+      }
+    }
+    int i = Take(order + 1);
+    if (i < 0) return -1;
+    Mark(order, 2 * i + 1, true);
+    return 2 * i;
+  }
+
+  unsigned char arena_[kTopBlocks * kMaxBlock] __attribute__((aligned(4)));
+  uint32_t free_[kMaxOrder + 1][kWords];   // one bit per block
+  size_t used_ = 0;
+  size_t high_water_ = 0;
+  uint32_t failures_ = 0;
+};
+
+#endif  // WAV_BUFFER_POOL
+
+#endif
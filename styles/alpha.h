@@ -38,6 +38,24 @@ public:
     if (alpha == 0) return RGBA_um_nod::Transparent();
     return color_.getColor(led) * alpha;  // clamp?
   }
+  template<class C> void getColors(int begin, int end, C* out) {
+    int n = end - begin;
+    int alpha[STYLE_SPAN];
+    GetIntegers(&alpha_, begin, end, alpha);
+    int shown = 0;
+    for (int i = 0; i < n; i++) shown += alpha[i] != 0;
+    if (shown < n) {
+      // Partly transparent: only get the color where it shows, like getColor().
+      for (int i = 0; i < n; i++) {
+        if (alpha[i] == 0) out[i] = RGBA_um_nod::Transparent();
+        else out[i] = color_.getColor(begin + i) * alpha[i];
+      }
+      return;
+    }
+    decltype(color_.getColor(0)) color[STYLE_SPAN];
+    GetColors(&color_, begin, end, color);
+    for (int i = 0; i < n; i++) out[i] = color[i] * alpha[i];
+  }
 };
 
 // To enable Gradient/Mixes constricted within Bump<> and SmoothStep<> layers
@@ -153,4 +153,77 @@ inline FunctionRunResult RunFunction(T* style, BladeBase* blade) {
   return RunFunctionHelper<T, decltype(style->run(blade))>::run(style, blade);
 };
 
+// 1 = Style::run() gets the colors STYLE_SPAN LEDs at a time, 0 = one
+// getColor() per LED. Off until spans have been timed on the boards.
+#ifndef STYLE_SPANS
+#define STYLE_SPANS 0
+#endif
+
+// LEDs per call to GetColors(). Styles that work on spans keep
+// temporaries of this many colors on the stack.
+#ifndef STYLE_SPAN
+#ifdef ARDUINO_ARCH_ESP32   // ESP architecture
+#define STYLE_SPAN 16
+#else
+#define STYLE_SPAN 8
+#endif
+#endif
+
+// Span versions of getColor() and getInteger(), for end - begin <= STYLE_SPAN:
+//   GetColors(style, begin, end, out): out[i - begin] = style->getColor(i)
+//   GetIntegers(func, begin, end, out): out[i - begin] = func->getInteger(i)
+// LEDs are visited in order. Classes that can do a span faster than one
+// LED at a time, usually by doing things once per span instead of once per
+// LED, define getColors() or getIntegers() with the same arguments.
+// Everything else gets a loop over getColor() or getInteger().
+template<class T, typename X = void> struct GetColorsHelper {
+  template<class C>
+  static void get(T* style, int begin, int end, C* out) {
+    for (int i = begin; i < end; i++) *out++ = style->getColor(i);
+  }
+};
+
+template<class T> struct GetColorsHelper<T,
+  decltype(((T*)0)->getColors(0, 0, (decltype(((T*)0)->getColor(0))*)0))> {
+  template<class C>
+  static void get(T* style, int begin, int end, C* out) {
+    style->getColors(begin, end, out);
+  }
+};
+
+template<class T>
+inline void GetColors(T* style, int begin, int end, decltype(style->getColor(0))* out) {
+  GetColorsHelper<T>::get(style, begin, end, out);
+}
+
+template<class T, typename X = void> struct GetIntegersHelper {
+  static void get(T* func, int begin, int end, int* out) {
+    for (int i = begin; i < end; i++) *out++ = func->getInteger(i);
+  }
+};
+
+template<class T> struct GetIntegersHelper<T, decltype(((T*)0)->getIntegers(0, 0, (int*)0))> {
+  static void get(T* func, int begin, int end, int* out) {
+    func->getIntegers(begin, end, out);
+  }
+};
+
+template<class T>
+inline void GetIntegers(T* func, int begin, int end, int* out) {
+  GetIntegersHelper<T>::get(func, begin, end, out);
+}
+
+// Span of colors of type T for a result of type C. When the two are the
+// same, the span is |out| itself and copy() does nothing.
+template<class T, class C> struct SpanTemp {
+  T* get(C* out) { return buf_; }
+  void copy(C* out, int n) { for (int i = 0; i < n; i++) out[i] = buf_[i]; }
+  T buf_[STYLE_SPAN];
+};
+
+template<class T> struct SpanTemp<T, T> {
+  T* get(T* out) { return out; }
+  void copy(T* out, int n) {}
+};
+
 #endif
@@ -28,6 +28,22 @@ public:
     auto b = colors_.getColor((x >> 15) + 1, led);
     return MixColors(a, b, x & 0x7fff, 15);
   }
+  // One segment between two colors at a time.
+  template<class C> void getColors(int begin, int end, C* out) {
+    C b[STYLE_SPAN];
+    while (begin < end) {
+      int x = begin * mul_;
+      // First LED of the next segment.
+      int next = mul_ ? std::min(end, ((((x >> 15) + 1) << 15) + mul_ - 1) / mul_) : end;
+      colors_.getColors(x >> 15, begin, next, out);
+      colors_.getColors((x >> 15) + 1, begin, next, b);
+      for (int i = 0; i < next - begin; i++, x += mul_) {
+        out[i] = MixColors(out[i], b[i], x & 0x7fff, 15);
+      }
+      out += next - begin;
+      begin = next;
+    }
+  }
 };
 
 #endif
@@ -40,6 +40,15 @@ public:
     return base_.getColor(led) << layer_.getColor(led);
 //    return PRINT(base_.getColor(led) << PRINT(layer_.getColor(led), "layer"), __PRETTY_FUNCTION__);
   }
+  // Nested Compose<> all paint into the same span.
+  template<class C> void getColors(int begin, int end, C* out) {
+    SpanTemp<decltype(base_.getColor(0)), C> base;
+    decltype(layer_.getColor(0)) layer[STYLE_SPAN];
+    GetColors(&base_, begin, end, base.get(out));
+    GetColors(&layer_, begin, end, layer);
+    auto* b = base.get(out);
+    for (int i = 0; i < end - begin; i++) out[i] = b[i] << layer[i];
+  }
 };
 
 
@@ -60,6 +60,11 @@ public:
   auto getColor(int x, int led) -> decltype(a_.getColor(led)) {
     return a_.getColor(led);
   }
+  template<class C> void getColors(int x, int begin, int end, C* out) {
+    SpanTemp<decltype(a_.getColor(0)), C> a;
+    GetColors(&a_, begin, end, a.get(out));
+    a.copy(out, end - begin);
+  }
 };
   
 template<class A, class... B>
@@ -78,6 +83,11 @@ public:
     if (x < a_.size()) return a_.getColor(x, led);
     return b_.getColor(x - a_.size(), led);
   }
+  // Color |x| for a span of LEDs.
+  template<class C> void getColors(int x, int begin, int end, C* out) {
+    if (x < a_.size()) a_.getColors(x, begin, end, out);
+    else b_.getColors(x - a_.size(), begin, end, out);
+  }
 };
 
 template<class... COLORS> using MixHelper = MixHelper2<TypeList<COLORS...>>;
@@ -33,6 +33,9 @@ public:
   SimpleColor getColor(int led) {
     return SimpleColor(color());
   }
+  void getColors(int begin, int end, SimpleColor* out) {
+    for (int i = begin; i < end; i++) *out++ = SimpleColor(color());
+  }
 };
 
 // Simple solid color with 16-bit precision.
@@ -45,6 +48,9 @@ public:
     return LayerRunResult::UNKNOWN;
   }
   SimpleColor getColor(int led) { return SimpleColor(color()); }
+  void getColors(int begin, int end, SimpleColor* out) {
+    for (int i = begin; i < end; i++) *out++ = SimpleColor(color());
+  }
 };
 
 // Simple semi-transparent color with 16-bit precision.
@@ -22,6 +22,10 @@ public:
   SimpleColor getColor(int led) {
     return SimpleColor(color_);
   }
+  void getColors(int begin, int end, SimpleColor* out) {
+    SimpleColor c(color_);
+    for (int i = begin; i < end; i++) *out++ = c;
+  }
 protected:
   void init(int argnum) {
     // NO ARGUMENT PARSING - USE DEFAULT
@@ -8,7 +8,8 @@
 // return value: suitable for preset array
 // Most blade styls are created by taking a blade style template and wrapping it
 // this class, which implements the BladeStyle interface. We do this so that the
-// getColor calls will be inlined in this loop for speed.
+// getColor calls will be inlined for speed. With STYLE_SPANS, the loop gets
+// the colors STYLE_SPAN LEDs at a time, see GetColors().
 
 struct HandledTypeResetter {
   HandledTypeResetter() { BladeBase::ResetHandledTypes(); }
@@ -32,14 +33,26 @@ template<class RetType>
 class StyleHelper : public StyleBase {
 public:
   virtual RetType getColor2(int i) = 0;
+#if STYLE_SPANS
+  // getColor2() for LEDs begin ... end - 1, end - begin <= STYLE_SPAN.
+  virtual void getColors2(int begin, int end, RetType* out) = 0;
+#endif
   OverDriveColor getColor(int i) override { return getColor2(i); }
 
   template<bool ROTATE>
   void runloop2(BladeBase* blade) {
     int num_leds = blade->num_leds();
     int rotation = (SaberBase::GetCurrentVariation() & 0x7fff) * 3;
+#if STYLE_SPANS
+    RetType colors[STYLE_SPAN];
+#endif
     for (int i = 0; i < num_leds; i++) {
+#if STYLE_SPANS
+      if (i % STYLE_SPAN == 0) getColors2(i, std::min(i + STYLE_SPAN, num_leds), colors);
+      RetType c = colors[i % STYLE_SPAN];
+#else
       RetType c = getColor2(i);
+#endif
       if (ROTATE) c.c = c.c.rotate(rotation);
       // scale with masterBrightness [0, 65535]
       uint32_t tmp = c.c.r * userProfile.masterBrightness;
@@ -79,6 +92,12 @@ public:
     return base_.getColor(i);
   }
 
+#if STYLE_SPANS
+  void getColors2(int begin, int end, decltype(T().getColor(0))* out) override {
+    GetColors(&base_, begin, end, out);
+  }
+#endif
+
   void run(BladeBase* blade) override {
     if (!RunStyle(&base_, blade))
       blade->allow_disable();
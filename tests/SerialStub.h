@@ -0,0 +1,23 @@
+#ifndef TESTS_SERIAL_STUB_H
+#define TESTS_SERIAL_STUB_H
+
+// What the board packages provide to common/stdout.h, for host builds.
+// Serial prints to stdout; EmptySerial swallows everything.
+
+class HostSerial : public Print {
+public:
+  size_t write(uint8_t s) override {
+    if (!quiet) putchar(s);
+    return 1;
+  }
+  size_t write(const uint8_t *buffer, size_t size) override {
+    for (size_t i = 0; i < size; i++) write(buffer[i]);
+    return size;
+  }
+  explicit HostSerial(bool quiet = false) : quiet(quiet) {}
+  bool quiet;
+};
+HostSerial Serial;
+HostSerial EmptySerial(true);
+
+#endif  // TESTS_SERIAL_STUB_H
@@ -0,0 +1,77 @@
+// Start latency of clashes with and without the attack cache, as
+// measured by the players (PlayOnce() to the first sound the mixer
+// reads), and the cache's hit and miss counts.
+//
+// Runs on the host clock. The host has no SD card: the files come from
+// the page cache, so the uncached numbers are far lower than on a board.
+
+#define HOST_REAL_TIME
+#define ATTACK_CACHE_FILES 16
+#include "host.h"
+#include "test_wav.h"
+
+int errors = 0;
+
+void Expect(bool ok, const char* what, uint32_t got, uint32_t want) {
+  if (ok) return;
+  STDOUT << "FAIL: " << what << ": " << got << ", expected " << want << "\n";
+  errors++;
+}
+
+std::vector<int16_t> Noise(int samples) {
+  std::vector<int16_t> ret(samples);
+  for (int16_t& s : ret) s = 1000 + random(20000);
+  return ret;
+}
+
+// Plays |effect| |times| times, one at a time, reading the mixer right
+// after each start, and prints the players' start latency.
+void PlayAndReport(const char* what, Effect* effect, int times) {
+  RangeStats<int32_t, 3> latency;
+  int16_t out[AUDIO_BUFFER_SIZE];
+  for (int i = 0; i < times; i++) {
+    RefPtr<BufferedWavPlayer> player = GetFreeWavPlayer();
+    player->ResetStats();
+    player->PlayOnce(effect);
+    dynamic_mixer.read(out, AUDIO_BUFFER_SIZE);
+    latency.Add(player->stats().start_latency.val);
+    player->Stop();
+    dynamic_mixer.read(out, AUDIO_BUFFER_SIZE);
+  }
+  STDOUT << what << " start latency us: min=" << latency.min
+         << " avg=" << latency.avg << " max=" << latency.max << "\n";
+}
+
+int main() {
+  std::string dir = TestDir("attack_cache");
+  char name[64];
+  for (int i = 1; i <= 6; i++) {
+    sprintf(name, "/clsh%02d.wav", i);
+    WriteWav((dir + name).c_str(), Noise(AUDIO_RATE / 4));
+    sprintf(name, "/swng%02d.wav", i);
+    WriteWav((dir + name).c_str(), Noise(AUDIO_RATE / 2));
+  }
+  WriteWav((dir + "/hum.wav").c_str(), Noise(AUDIO_RATE));
+  MakeDirectoryList(current_directory, dir.c_str());
+  Effect::ScanCurrentDirectory();
+  SetupStandardAudio();
+
+  // Nothing cached yet, every clash is a miss.
+  PlayAndReport("uncached", &SFX_clsh, 50);
+  Expect(attack_cache.misses() == 50, "misses before loading", attack_cache.misses(), 50);
+
+  attack_cache.Reload();
+  for (int i = 0; i < 100; i++) AudioStreamWork::scheduleFillBuffer();
+  PlayAndReport("cached", &SFX_clsh, 50);
+  Expect(attack_cache.hits() == 50, "hits", attack_cache.hits(), 50);
+  Expect(attack_cache.misses() == 50, "misses after loading", attack_cache.misses(), 50);
+
+  // Swings aren't cached and don't count.
+  PlayAndReport("swing", &SFX_swng, 10);
+  Expect(attack_cache.hits() + attack_cache.misses() == 100, "lookups",
+         attack_cache.hits() + attack_cache.misses(), 100);
+
+  if (errors) return 1;
+  STDOUT << "attack_cache_test: OK\n";
+  return 0;
+}
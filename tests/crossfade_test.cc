@@ -0,0 +1,59 @@
+// The mixer runs a scheduled crossfade right before the sample it was
+// scheduled for, wherever that falls in the mixer's blocks, and the
+// outgoing player is silent from that sample on.
+
+#include "host.h"
+#include "test_wav.h"
+
+int errors = 0;
+
+void Expect(bool ok, const char* what, int got, int want) {
+  if (ok) return;
+  STDOUT << "FAIL: " << what << ": " << got << ", expected " << want << "\n";
+  errors++;
+}
+
+// First output sample whose sign is |sign|, -1 if none.
+int FirstWithSign(const std::vector<int16_t>& v, int sign) {
+  for (size_t i = 0; i < v.size(); i++) {
+    if (v[i] * sign > 0) return i;
+  }
+  return -1;
+}
+
+int main() {
+  std::string dir = TestDir("crossfade");
+  WriteWav((dir + "/hum.wav").c_str(), std::vector<int16_t>(AUDIO_RATE, 8000));
+  WriteWav((dir + "/clsh.wav").c_str(), std::vector<int16_t>(AUDIO_RATE, -8000));
+  MakeDirectoryList(current_directory, dir.c_str());
+  Effect::ScanCurrentDirectory();
+  SetupStandardAudio();
+
+  std::vector<int16_t> out(AUDIO_BUFFER_SIZE * 4);
+  for (int offset : {1, 37, AUDIO_MIXER_BLOCK, AUDIO_BUFFER_SIZE, AUDIO_BUFFER_SIZE + 5}) {
+    RefPtr<BufferedWavPlayer> from = GetFreeWavPlayer();
+    RefPtr<BufferedWavPlayer> to = GetFreeWavPlayer();
+    from->PlayOnce(&SFX_hum);
+    for (int i = 0; i < 4; i++) dynamic_mixer.read(out.data(), AUDIO_BUFFER_SIZE);
+
+    to->CrossfadeAt(from.get(), &SFX_clsh, dynamic_mixer.sample_count() + offset, 0.0);
+    // Read in odd sized pieces, so the command falls inside a read().
+    for (size_t pos = 0; pos < out.size(); pos += 50) {
+      dynamic_mixer.read(out.data() + pos, std::min<int>(50, out.size() - pos));
+    }
+    Expect(FirstWithSign(out, -1) == offset, "first sample of the new sound",
+           FirstWithSign(out, -1), offset);
+    Expect(offset == 0 || out[offset - 1] > 0, "old sound up to the crossfade",
+           out[offset - 1], 1);
+    Expect(FirstWithSign(std::vector<int16_t>(out.begin() + offset, out.end()), 1) == -1,
+           "old sound silent after the crossfade", 0, -1);
+
+    from->Stop();
+    to->Stop();
+    for (int i = 0; i < 4; i++) dynamic_mixer.read(out.data(), AUDIO_BUFFER_SIZE);
+  }
+
+  if (errors) return 1;
+  STDOUT << "crossfade_test: OK\n";
+  return 0;
+}
@@ -0,0 +1,185 @@
+// Ducking: while the voice bus plays, the other buses go down by
+// MIXER_DUCK_DB along a linear ramp of MIXER_DUCK_ATTACK_MS, at most one
+// block late, and come back up over MIXER_DUCK_RELEASE_MS once it stops.
+// Voices below MIXER_DUCK_THRESHOLD duck nothing, and bus gains multiply
+// with the duck.
+//
+// The voice is a click every 40 samples, which keys the ducking but leaves
+// the hum between the clicks to be measured in the output too. The
+// mixer's compressor makes up for part of the duck there.
+
+#define MIXER_BUSES 1
+#include "host.h"
+#include "test_wav.h"
+
+int errors = 0;
+
+void Expect(bool ok, const char* what, double got) {
+  if (ok) return;
+  STDOUT << "FAIL: " << what << ": " << got << "\n";
+  errors++;
+}
+
+const int kClick = 40;    // samples between voice clicks, less than a block
+const int kPeriod = 49;   // samples, of the hum
+
+std::vector<int16_t> Clicks(int samples, int16_t level) {
+  std::vector<int16_t> v(samples);
+  for (int i = 0; i < samples; i += kClick) v[i] = level;
+  return v;
+}
+
+// Duck gain after every block, and the hum level between the clicks.
+struct Trace {
+  std::vector<float> duck;
+  std::vector<float> hum;
+  int voice_start = -1;   // sample
+};
+
+MixerBuses& buses() { return dynamic_mixer.buses_; }
+
+Trace Run(Effect* voice, int blocks) {
+  Trace t;
+  RefPtr<BufferedWavPlayer> hum = GetFreeWavPlayer(false, BUS_HUM);
+  hum->PlayOnce(&SFX_hum);
+  hum->PlayLoop(&SFX_hum);
+  std::vector<int16_t> out(AUDIO_BUFFER_SIZE);
+  // Let the compressor settle on the hum.
+  for (int i = 0; i < AUDIO_RATE / AUDIO_BUFFER_SIZE; i++) {
+    dynamic_mixer.read(out.data(), AUDIO_BUFFER_SIZE);
+  }
+  RefPtr<BufferedWavPlayer> v = GetFreeWavPlayer(false, BUS_VOICE);
+  v->PlayOnce(voice);
+  for (int b = 0; b < blocks; b++) {
+    dynamic_mixer.read(out.data(), AUDIO_BUFFER_SIZE);
+    double sum = 0;
+    int n = 0;
+    for (int i = 0; i < AUDIO_BUFFER_SIZE; i++) {
+      int pos = b * AUDIO_BUFFER_SIZE + i;
+      // Clicks come out a few samples apart from where they are in the
+      // file, skip a few samples around each.
+      if (t.voice_start < 0 && out[i] > 20000) t.voice_start = pos;
+      if (t.voice_start >= 0 && v->isPlaying()) {
+        int phase = (pos - t.voice_start) % kClick;
+        if (phase < 2 || phase > kClick - 2) continue;
+      }
+      sum += out[i] * (double)out[i];
+      n++;
+    }
+    t.duck.push_back(buses().duck() / (float)kUnityGain);
+    t.hum.push_back(sqrt(sum / n));
+  }
+  hum->Stop();
+  v->Stop();
+  for (int i = 0; i < 4; i++) dynamic_mixer.read(out.data(), AUDIO_BUFFER_SIZE);
+  return t;
+}
+
+// Duck gain |t| samples into a ramp from |from| to |to| taking |ms|.
+float Ramp(float from, float to, float ms, int t) {
+  float done = std::max(0.0f, std::min(1.0f, t / (ms * AUDIO_RATE / 1000)));
+  return from + (to - from) * done;
+}
+
+double Db(double x) { return 20 * log10(x); }
+
+int main() {
+  std::string dir = TestDir("ducking");
+  std::vector<int16_t> hum(kPeriod * 900);
+  for (size_t i = 0; i < hum.size(); i++) hum[i] = 8000 * sin(2 * M_PI * i / kPeriod);
+  WriteWav((dir + "/hum.wav").c_str(), hum);
+  const int voice_len = AUDIO_RATE / 2;
+  WriteWav((dir + "/clsh.wav").c_str(), Clicks(voice_len, 30000));
+  WriteWav((dir + "/blst.wav").c_str(), Clicks(voice_len, MIXER_DUCK_THRESHOLD / 2));
+  MakeDirectoryList(current_directory, dir.c_str());
+  Effect::ScanCurrentDirectory();
+  SetupStandardAudio();
+
+  const float ducked = powf(10, -MIXER_DUCK_DB / 20.0f);
+  const int blocks = (voice_len + AUDIO_RATE * (MIXER_DUCK_RELEASE_MS + 100) / 1000) / AUDIO_BUFFER_SIZE;
+
+  {
+    Trace t = Run(&SFX_clsh, blocks);
+    Expect(t.voice_start >= 0 && t.voice_start < AUDIO_BUFFER_SIZE,
+           "voice starts in the first block", t.voice_start);
+    // The duck may lag the ramp by up to two blocks: the voice starts (or
+    // stops) somewhere in a block, and its level is measured on the block
+    // before.
+    int bad = 0;
+    int voice_end = t.voice_start + voice_len;
+    for (int b = 0; b < blocks; b++) {
+      int end = (b + 1) * AUDIO_BUFFER_SIZE - t.voice_start;   // of block b
+      float early, late;
+      if (end <= voice_len) {
+        early = Ramp(1, ducked, MIXER_DUCK_ATTACK_MS, end);
+        late = Ramp(1, ducked, MIXER_DUCK_ATTACK_MS, end - AUDIO_BUFFER_SIZE * 2);
+      } else {
+        int after = (b + 1) * AUDIO_BUFFER_SIZE - voice_end;
+        early = Ramp(ducked, 1, MIXER_DUCK_RELEASE_MS, after);
+        late = Ramp(ducked, 1, MIXER_DUCK_RELEASE_MS, after - AUDIO_BUFFER_SIZE * 2);
+      }
+      float lo = std::min(early, late) - 0.002f, hi = std::max(early, late) + 0.002f;
+      if (t.duck[b] < lo || t.duck[b] > hi) {
+        if (!bad++) {
+          STDOUT << "FAIL: block " << b << ": duck gain " << t.duck[b]
+                 << ", expected " << lo << " ... " << hi << "\n";
+        }
+      }
+    }
+    Expect(bad == 0, "blocks off the ducking ramp", bad);
+
+    int down = -1, up = -1;
+    float deepest = 1;
+    for (int b = 0; b < blocks; b++) {
+      deepest = std::min(deepest, t.duck[b]);
+      if (down < 0 && t.duck[b] <= ducked + 0.0005f) down = b;
+      if (down >= 0 && up < 0 && (b + 1) * AUDIO_BUFFER_SIZE > voice_end && t.duck[b] >= 0.9995f) up = b;
+    }
+    // Those two blocks, and one more to see the ramp has ended.
+    const double slack = 3 * AUDIO_BUFFER_SIZE * 1000.0 / AUDIO_RATE;
+    double down_ms = ((down + 1) * AUDIO_BUFFER_SIZE - t.voice_start) * 1000.0 / AUDIO_RATE;
+    double up_ms = ((up + 1) * AUDIO_BUFFER_SIZE - voice_end) * 1000.0 / AUDIO_RATE;
+    STDOUT << "duck " << Db(deepest) << " dB, all the way down " << down_ms
+           << " ms after the voice started, back up " << up_ms
+           << " ms after it stopped\n";
+    Expect(fabs(Db(deepest) + MIXER_DUCK_DB) < 0.01, "duck depth, dB", Db(deepest));
+    Expect(down_ms <= MIXER_DUCK_ATTACK_MS + slack, "attack, ms", down_ms);
+    Expect(up >= 0 && up_ms <= MIXER_DUCK_RELEASE_MS + slack, "release, ms", up_ms);
+
+    // What is left of the duck after the compressor.
+    int mid = (t.voice_start + voice_len / 2) / AUDIO_BUFFER_SIZE;
+    double heard = Db(t.hum[mid] / t.hum[0]);
+    STDOUT << "hum in the output: " << heard << " dB while ducked\n";
+    Expect(heard < -MIXER_DUCK_DB / 2.0, "hum level in the output while ducked, dB", heard);
+  }
+
+  {
+    Trace t = Run(&SFX_blst, blocks);
+    float deepest = *std::min_element(t.duck.begin(), t.duck.end());
+    Expect(deepest == 1.0f, "duck gain with a voice below the threshold", deepest);
+  }
+
+  {
+    buses().set_gain(BUS_HUM, 0.5);
+    buses().set_gain(BUS_VOICE, 0.25);
+    Trace t = Run(&SFX_clsh, 20);
+    buses().Update(0);
+    Expect(abs(buses().block_gain(BUS_HUM) - ((kUnityGain / 2 * buses().duck()) >> kGainShift)) <= 1,
+           "hum bus gain times the duck", buses().block_gain(BUS_HUM));
+    Expect(buses().block_gain(BUS_VOICE) == kUnityGain / 4,
+           "voice bus not ducked", buses().block_gain(BUS_VOICE));
+    buses().set_gain(BUS_HUM, 1);
+    buses().set_gain(BUS_VOICE, 1);
+  }
+
+  {
+    buses().set_ducking(0, MIXER_DUCK_ATTACK_MS, MIXER_DUCK_RELEASE_MS);
+    Trace t = Run(&SFX_clsh, 40);
+    float deepest = *std::min_element(t.duck.begin(), t.duck.end());
+    Expect(deepest == 1.0f, "duck gain with ducking off", deepest);
+  }
+
+  if (errors) return 1;
+  STDOUT << "ducking_test: OK\n";
+  return 0;
+}
@@ -0,0 +1,146 @@
+// Cold scan against the font index on a 500 file font, and what makes
+// the index go stale.
+
+#include "host.h"
+#include "test_wav.h"
+
+int errors = 0;
+
+void Expect(bool ok, const char* what) {
+  if (ok) return;
+  STDOUT << "FAIL: " << what << "\n";
+  errors++;
+}
+
+void Touch(const std::string& path, int bytes = 0) {
+  FILE* f = fopen(path.c_str(), "wb");
+  for (int i = 0; i < bytes; i++) fputc(0, f);
+  fclose(f);
+}
+
+// 500 sound files: numbered effects in subdirectories, a few in the font
+// directory itself, and some files the scan skips.
+void MakeFont(const std::string& dir) {
+  static const char* const effects[] = {
+    "clsh", "blst", "swng", "stab", "force", "lock", "drag", "melt", "in", "out"
+  };
+  char name[64];
+  for (const char* e : effects) {
+    mkdir((dir + "/" + e).c_str(), 0755);
+    for (int i = 1; i <= 49; i++) {
+      sprintf(name, "/%s/%s%02d.wav", e, e, i);
+      Touch(dir + name, 44);
+    }
+  }
+  for (const char* f : {"hum.wav", "boot.wav", "font.wav", "preon.wav",
+                        "bgnlock.wav", "endlock.wav", "swingl.wav", "swingh.wav",
+                        "pstoff.wav", "poweron.wav"}) {
+    Touch(dir + "/" + f, 44);
+  }
+  Touch(dir + "/config.ini");
+  Touch(dir + "/readme.txt");
+}
+
+// What the scan found, to compare a cold scan with an indexed one.
+std::string Summary() {
+  std::string ret;
+  char name[128];
+  for (Effect* e = all_effects; e; e = e->next_) {
+    if (!e->files_found()) continue;
+    Effect::FileID id(e, 0, 0);
+    id.GetName(name);
+    ret += std::to_string(e->files_found()) + " " + name + "\n";
+  }
+  return ret;
+}
+
+// Microseconds per call of |f|, best of |runs|.
+template<class F>
+double Time(F f, int runs = 20) {
+  uint32_t best = 0xffffffff;
+  for (int i = 0; i < runs; i++) {
+    uint32_t start = host_cycles();
+    f();
+    best = std::min(best, host_cycles() - start);
+  }
+  return best / 1000.0;
+}
+
+// The fingerprint as it was, with a stat() per file for its size.
+void FingerprintWithSizes(CheckSummer& sum, LSFS::Iterator& iter) {
+  for (; iter; ++iter) {
+    const char* name = iter.name();
+    uint32_t size;
+    if (name[0] == '.') continue;
+    if (iter.isdir()) {
+      if (!Effect::Scanner::ShouldScan(name)) continue;
+      size = 0xFFFFFFFFu;
+    } else {
+      if (Effect::IdentifyExtension(name) == Effect::UNKNOWN) continue;
+      size = iter.size();
+    }
+    sum.Write((const uint8_t*)name, strlen(name) + 1);
+    sum.Write((const uint8_t*)&size, sizeof(size));
+    if (iter.isdir()) {
+      LSFS::Iterator sub(iter);
+      FingerprintWithSizes(sum, sub);
+      sum.Write((const uint8_t*)&size, sizeof(size));
+    }
+  }
+}
+
+int main() {
+  std::string dir = TestDir("font_index");
+  MakeFont(dir);
+  MakeDirectoryList(current_directory, dir.c_str());
+  std::string index = dir + "/" FONT_INDEX_NAME;
+
+  double cold = Time([&]() {
+    Effect::ResetFontEffects();
+    Effect::ScanOneDirectory(current_directory);
+  });
+  std::string cold_summary = Summary();
+
+  Effect::ScanCurrentDirectory();   // writes the index
+  Expect(LSFS::Exists(index.c_str()), "index written");
+  double indexed = Time([&]() { Effect::ScanCurrentDirectory(); });
+  Expect(Summary() == cold_summary, "indexed scan finds the same files");
+
+  double fingerprint = Time([&]() { Effect::IndexFingerprint(); });
+  double with_sizes = Time([&]() {
+    CheckSummer sum;
+    LSFS::Iterator iter(current_directory);
+    FingerprintWithSizes(sum, iter);
+  });
+
+  STDOUT << "500 files, us: cold scan " << cold << ", indexed " << indexed
+         << " (fingerprint " << fingerprint << ", with file sizes "
+         << with_sizes << ")\n";
+
+  // Same names, other contents: the index stays.
+  uint32_t before = Effect::IndexFingerprint();
+  Touch(dir + "/clsh/clsh01.wav", 4000);
+  Expect(Effect::IndexFingerprint() == before, "fingerprint ignores file sizes");
+  // Files the scan doesn't look at don't matter either.
+  Touch(dir + "/notes.txt");
+  mkdir((dir + "/extras").c_str(), 0755);
+  Expect(Effect::IndexFingerprint() == before, "fingerprint ignores other files");
+  // A new sound file, in the font directory or a sound subdirectory.
+  Touch(dir + "/clsh/clsh50.wav", 44);
+  uint32_t added = Effect::IndexFingerprint();
+  Expect(added != before, "fingerprint sees an added file");
+  rename((dir + "/clsh/clsh50.wav").c_str(), (dir + "/blst/blst50.wav").c_str());
+  Expect(Effect::IndexFingerprint() != added, "fingerprint sees a moved file");
+  unlink((dir + "/blst/blst50.wav").c_str());
+  Expect(Effect::IndexFingerprint() == before, "fingerprint back to the original");
+  rename((dir + "/hum.wav").c_str(), (dir + "/humm.wav").c_str());
+  Expect(Effect::IndexFingerprint() != before, "fingerprint sees a renamed file");
+
+  Effect::ScanCurrentDirectory();
+  Expect(SFX_humm.files_found() == 1 && SFX_hum.files_found() == 0,
+         "rescan after the font changed");
+
+  if (errors) return 1;
+  STDOUT << "font_index_test: OK\n";
+  return 0;
+}
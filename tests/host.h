@@ -0,0 +1,237 @@
+#ifndef TESTS_HOST_H
+#define TESTS_HOST_H
+
+// Host (PROFFIE_TEST) build of the ProffieOS sound code, for the programs
+// in this directory. Stands in for <Arduino.h> and for the top of
+// ProffieOS.ino, up to and including sound/sound.h.
+//
+// Time is simulated: nothing moves millis() or micros() except
+// host_advance_micros() and delay(), unless HOST_REAL_TIME is defined.
+
+#ifndef PROFFIE_TEST
+#define PROFFIE_TEST
+#endif
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <algorithm>
+#include <chrono>
+
+// ---- Configuration, like a ProffieBoard V3 with config/board_config.h.
+
+#define ENABLE_AUDIO
+#define ENABLE_SD
+#define ENABLE_MOTION
+#define ENABLE_DEVELOPER_COMMANDS
+#define ENABLE_DIAGNOSE_COMMANDS
+#define NUM_BLADES 1
+#define NUM_BUTTONS 2
+#define VOLUME 3000
+#define CLASH_THRESHOLD_G userProfile.clashSensitivity.clashThreshold
+const unsigned int maxLedsPerStrip = 144;
+
+// ---- <Arduino.h>
+
+inline uint64_t host_nanos() {
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(
+    std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+#ifdef HOST_REAL_TIME
+// For tests that time real work: the clock runs and host_advance_micros()
+// does nothing.
+uint32_t micros() { return (uint32_t)(host_nanos() / 1000); }
+uint32_t millis() { return (uint32_t)(host_nanos() / 1000000); }
+void host_advance_micros(uint64_t us) {}
+void delayMicroseconds(uint32_t us) {
+  uint64_t end = host_nanos() + us * 1000ull;
+  while (host_nanos() < end);
+}
+void delay(uint32_t ms) { delayMicroseconds(ms * 1000); }
+#else
+uint64_t host_micros_ = 0;
+uint32_t micros() { return (uint32_t)host_micros_; }
+uint32_t millis() { return (uint32_t)(host_micros_ / 1000); }
+void host_advance_micros(uint64_t us) { host_micros_ += us; }
+void delay(uint32_t ms) { host_micros_ += ms * 1000ull; }
+void delayMicroseconds(uint32_t us) { host_micros_ += us; }
+#endif
+void noInterrupts() {}
+void interrupts() {}
+void yield() {}
+
+long random(long n) { return n > 0 ? rand() % n : 0; }
+long random(long a, long b) { return b > a ? a + rand() % (b - a) : a; }
+char* itoa(int value, char* str, int base) {
+  sprintf(str, base == 16 ? "%x" : "%d", value);
+  return str;
+}
+uint32_t getCpuFrequencyMhz() { return 1000; }   // cycles are nanoseconds
+
+#define HEX 16
+#define DEC 10
+#define PROGMEM
+#define DMAMEM
+#define INPUT 0
+#define INPUT_ANALOG 0
+#define OUTPUT 1
+#define LOW 0
+#define HIGH 1
+#define batteryLevelPin 0
+#define amplifierPin 0
+void pinMode(int pin, int mode) {}
+void digitalWrite(int pin, int value) {}
+int digitalRead(int pin) { return 0; }
+int analogRead(int pin) { return 0; }
+uint8_t pgm_read_byte(const void* p) { return *(const uint8_t*)p; }
+
+// Host cycle counter, in nanoseconds, for the benchmarks.
+inline uint32_t host_cycles() { return (uint32_t)host_nanos(); }
+
+#include "../common/common.h"
+#include "../common/state_machine.h"
+#include "../common/stdout.h"
+
+#include "../common/errors.h"
+DEFINE_COMMON_STDOUT_GLOBALS;
+
+#include "../motion/sensitivities.h"
+static struct {
+  uint16_t masterVolume = 65535;
+  uint16_t masterBrightness = 65535;
+  uint8_t preset = 0;
+  uint16_t apID = 0;
+  ClashSensitivity clashSensitivity;
+  uint16_t combatVolume = 65535;
+  uint16_t combatBrightness = 65535;
+  uint16_t stealthVolume = 10000;
+  uint16_t stealthBrightness = 10000;
+  SwSensitivity swingSensitivity;
+  StabSensitivity stabSensitivity;
+  ShakeSensitivity shakeSensitivity;
+  TapSensitivity tapSensitivity;
+  TwistSensitivity twistSensitivity;
+  MenuSensitivity menuSensitivity;
+} userProfile;
+
+const char version[] = "host";
+const char install_time[] = __DATE__ " " __TIME__;
+
+#include "../common/Probe.h"
+CPUprobe audio_dma_interrupt_cycles;
+CPUprobe pixel_dma_interrupt_cycles;
+CPUprobe motion_interrupt_cycles;
+CPUprobe wav_interrupt_cycles;
+
+#define NELEM(X) (sizeof(X)/sizeof((X)[0]))
+
+float fract(float x) { return x - floorf(x); }
+float clamp(float x, float a, float b) {
+  if (x < a) return a;
+  if (x > b) return b;
+  return x;
+}
+float Fmod(float a, float b) {
+  return a - floorf(a / b) * b;
+}
+int32_t clampi32(int32_t x, int32_t a, int32_t b) {
+  if (x < a) return a;
+  if (x > b) return b;
+  return x;
+}
+int16_t clamptoi16(int32_t x) {
+  return clampi32(x, -32768, 32767);
+}
+int32_t clamptoi24(int32_t x) {
+  return clampi32(x, -8388608, 8388607);
+}
+
+#include "../common/linked_list.h"
+#include "../common/looper.h"
+#include "../common/command_parser.h"
+CommandParser* parsers = NULL;
+
+#include "../common/vec3.h"
+#include "../common/quat.h"
+#include "../common/ref.h"
+#include "../common/events.h"
+#include "../common/saber_base.h"
+#include "../common/saber_base_passthrough.h"
+SaberBase* saberbases = NULL;
+SaberBase::LockupType SaberBase::lockup_ = SaberBase::LOCKUP_NONE;
+bool SaberBase::on_ = false;
+uint32_t SaberBase::current_variation_ = 0;
+float SaberBase::sound_length = 0.0;
+int SaberBase::sound_number = -1;
+float SaberBase::clash_strength_ = 0.0;
+bool SaberBase::monoFont = true;
+uint8_t Sensitivity::master = 128;
+
+#include "../common/box_filter.h"
+
+#include "../common/sin_table.h"
+
+void EnableBooster() {}
+void EnableAmplifier() {}
+void MountSDCard() {}
+const char* GetSaveDir() { return ""; }
+
+#include "../common/lsfs.h"
+#include "../common/strfun.h"
+
+char current_directory[128];
+const char* next_current_directory(const char* dir) {
+  dir += strlen(dir);
+  dir ++;
+  if (!*dir) return NULL;
+  return dir;
+}
+void MakeDirectoryList(char* dest, const char* font) {
+  for (const char *a = font; *a; a++) {
+    if (*a == '/' && (a[1] == 0 || a[1] == ';'))
+      continue;
+    if (*a == ';') {
+      *(dest++) = 0;
+      continue;
+    }
+    *(dest++) = *a;
+  }
+  *(dest++) = 0;
+  *(dest++) = 0;
+}
+const char* last_current_directory() {
+  const char* ret = current_directory;
+  while (true) {
+    const char* tmp = next_current_directory(ret);
+    if (!tmp) return ret;
+    ret = tmp;
+  }
+}
+const char* previous_current_directory(const char* dir) {
+  if (dir == current_directory) return nullptr;
+  dir -= 2;
+  while (true) {
+    if (dir == current_directory) return current_directory;
+    if (!*dir) return dir + 1;
+    dir--;
+  }
+}
+
+// Instead of sound/dac.h: nothing reads from the stream except the tests,
+// which call dynamic_mixer.read() themselves.
+class HostDAC {
+public:
+  void SetStream(class ProffieOSAudioStream* stream) { stream_ = stream; }
+  class ProffieOSAudioStream* stream_ = nullptr;
+};
+HostDAC dac;
+
+#include "../sound/sound.h"
+
+#define PROFFIEOS_DEFINE_FUNCTION_STAGE
+#include "../common/errors.h"
+
+#endif  // TESTS_HOST_H
@@ -0,0 +1,122 @@
+// Mixer cost with the gain computed once per AUDIO_MIXER_BLOCK samples,
+// against the old loop that updated the envelope and divided by its square
+// root on every sample. Also checks that the block envelope follows the
+// per-sample one, for whole and for partial sub-blocks.
+
+#include "host.h"
+
+// A sine at full scale, read straight from a table.
+class ToneStream : public ProffieOSAudioStream {
+public:
+  explicit ToneStream(int period) {
+    for (int i = 0; i < kLen; i++) {
+      table_[i] = 12000 * sinf(i * 2 * M_PI * (kLen / period) / kLen);
+    }
+  }
+  int read(int16_t* data, int elements) override {
+    for (int i = 0; i < elements; i++) {
+      data[i] = table_[pos_];
+      pos_ = (pos_ + 1) & (kLen - 1);
+    }
+    return elements;
+  }
+  static const int kLen = 1024;
+  int16_t table_[kLen];
+  int pos_ = 0;
+};
+
+// The mixer loop before the block-rate gain, for comparison.
+template<int N>
+class PerSampleMixer {
+public:
+  int read(int16_t* data, int elements) {
+    int32_t sum[AUDIO_BUFFER_SIZE];
+    int16_t tmp[AUDIO_BUFFER_SIZE];
+    while (elements) {
+      int to_do = std::min(elements, (int)NELEM(sum));
+      for (int i = 0; i < to_do; i++) sum[i] = 0;
+      for (int i = 0; i < N; i++) {
+        if (!streams_[i]) continue;
+        int e = streams_[i]->read(tmp, to_do);
+        for (int j = 0; j < e; j++) sum[j] += tmp[j];
+      }
+      for (int i = 0; i < to_do; i++) {
+        int32_t v = sum[i];
+        vol_ = ((vol_ + abs(v)) * 255) >> 8;
+        data[i] = clamptoi16(v * volume_ / (sqrt_.my_sqrt(vol_) + 100));
+      }
+      data += to_do;
+      elements -= to_do;
+    }
+    return elements;
+  }
+  ProffieOSAudioStream* streams_[N] = {};
+  AudioDynamicMixer<1> sqrt_;   // same square root as the mixer
+  int32_t vol_ = 0;
+  int32_t volume_ = VOLUME;
+};
+
+const int kMaxStreams = 10;
+const int kSeconds = 4;
+
+// Best of three runs.
+template<class MIXER>
+double NanosPerSample(MIXER* mixer) {
+  int16_t out[AUDIO_BUFFER_SIZE];
+  const int blocks = kSeconds * AUDIO_RATE / AUDIO_BUFFER_SIZE;
+  uint32_t best = 0xffffffff;
+  for (int run = 0; run < 3; run++) {
+    uint32_t start = host_cycles();
+    for (int b = 0; b < blocks; b++) mixer->read(out, AUDIO_BUFFER_SIZE);
+    best = std::min(best, host_cycles() - start);
+  }
+  return (double)best / (blocks * AUDIO_BUFFER_SIZE);
+}
+
+// Runs the per-sample envelope for |n| samples of level |a| and the block
+// envelope for one sub-block of the same, and returns the difference in
+// parts per thousand of the per-sample result. The block decay is kept
+// in 1/256 units, which is good to about 2%.
+int EnvelopeError(int n, int32_t start, int32_t a) {
+  int32_t vol = start;
+  for (int i = 0; i < n; i++) vol = ((vol + a) * 255) >> 8;
+  AudioDynamicMixer<1> mixer;
+  mixer.vol_ = start;
+  mixer.UpdateEnvelope(a * n, n);
+  return abs(mixer.vol_ - vol) * 1000 / std::max<int32_t>(vol, 1);
+}
+
+int main() {
+  int errors = 0;
+  for (int n = 1; n <= AUDIO_MIXER_BLOCK; n++) {
+    for (int32_t start : {0, 1000000, 5000000}) {
+      int e = EnvelopeError(n, start, 12000);
+      if (e > 25) {
+        STDOUT << "FAIL: envelope after " << n << " samples from " << start
+               << " is off by " << e << "/1000\n";
+        errors++;
+      }
+    }
+  }
+
+  ToneStream* tones[kMaxStreams];
+  for (int i = 0; i < kMaxStreams; i++) tones[i] = new ToneStream(64 + i * 7);
+
+  STDOUT << "streams  per-sample ns/sample  block ns/sample\n";
+  for (int streams : {1, 4, 10}) {
+    PerSampleMixer<kMaxStreams> old_mixer;
+    AudioDynamicMixer<kMaxStreams> mixer;
+    for (int i = 0; i < streams; i++) {
+      old_mixer.streams_[i] = tones[i];
+      mixer.streams_[i] = tones[i];
+      tones[i]->active_ = false;   // on the last mixer's list
+      tones[i]->Activate();
+    }
+    double old_ns = NanosPerSample(&old_mixer);
+    double new_ns = NanosPerSample(&mixer);
+    STDOUT << streams << "        " << old_ns << "               " << new_ns << "\n";
+  }
+  if (errors) return 1;
+  STDOUT << "mixer_bench: OK\n";
+  return 0;
+}
@@ -0,0 +1,79 @@
+// The paired swing player keeps swingl and swingh in step when the high
+// file is shorter or longer than the low one, and CheckPairs() finds such
+// pairs when the font is loaded.
+
+#define PAIRED_SWING_PLAYER 1
+#include "host.h"
+#include "test_wav.h"
+
+int errors = 0;
+
+void Expect(bool ok, const char* what) {
+  if (ok) return;
+  STDOUT << "FAIL: " << what << "\n";
+  errors++;
+}
+
+// Sample k of the file is k + 1, so the output tells where in the file
+// each channel is.
+void WriteCounter(const std::string& path, int samples) {
+  std::vector<int16_t> v(samples);
+  for (int k = 0; k < samples; k++) v[k] = k + 1;
+  WriteWav(path.c_str(), v);
+}
+
+// One channel of the pair, read through the player, with the other muted.
+std::vector<int16_t> Channel(int channel, int samples) {
+  paired_swing_player.Play(&SFX_swingl, &SFX_swingh, 0, 0.0);
+  paired_swing_player.set_volume_now(channel, kUnityGain);
+  std::vector<int16_t> out(samples);
+  for (int pos = 0; pos < samples; pos += AUDIO_BUFFER_SIZE) {
+    int n = std::min<int>(AUDIO_BUFFER_SIZE, samples - pos);
+    if (paired_swing_player.read(out.data() + pos, n) != n) {
+      Expect(false, "no underflows");
+      break;
+    }
+  }
+  return out;
+}
+
+void Run(int low_len, int high_len) {
+  std::string dir = TestDir("paired_swing");
+  WriteCounter(dir + "/swingl.wav", low_len);
+  WriteCounter(dir + "/swingh.wav", high_len);
+  MakeDirectoryList(current_directory, dir.c_str());
+  Effect::ScanCurrentDirectory();
+  // The players would otherwise rewind the files of the last run, which
+  // have the same names.
+  AudioStreamWork::CloseAllOpenFiles();
+
+  Expect(paired_swing_player.CheckPairs(&SFX_swingl, &SFX_swingh) == (low_len != high_len),
+         "pairs of different length found at font load");
+
+  int samples = low_len * 3 + 100;
+  std::vector<int16_t> low = Channel(0, samples);
+  std::vector<int16_t> high = Channel(1, samples);
+  int wrong = 0;
+  for (int t = 0; t < samples; t++) {
+    int pos = t % low_len;   // both start over with the low file
+    if (low[t] != pos + 1) wrong++;
+    if (high[t] != (pos < high_len ? pos + 1 : 0)) wrong++;
+  }
+  if (wrong) {
+    STDOUT << "FAIL: low " << low_len << ", high " << high_len << ": "
+           << wrong << " samples out of step\n";
+    errors++;
+  }
+  paired_swing_player.Stop();
+}
+
+int main() {
+  SetupStandardAudio();
+  Run(3000, 3000);
+  Run(3000, 2500);   // high padded with silence
+  Run(3000, 3700);   // high cut short
+
+  if (errors) return 1;
+  STDOUT << "paired_swing_test: OK\n";
+  return 0;
+}
@@ -0,0 +1,121 @@
+// Level and distortion of a sine through the post-mix EQ and limiter, and
+// an EQ that boosts far past its headroom, which must saturate rather than
+// wrap around.
+
+#define POST_MIX_DSP 1
+#include "host.h"
+#include <vector>
+
+int errors = 0;
+
+void Expect(bool ok, const char* what, double got) {
+  if (ok) return;
+  STDOUT << "FAIL: " << what << ": " << got << "\n";
+  errors++;
+}
+
+const int kPeriod = 48;                          // samples
+const double kFreq = (double)AUDIO_RATE / kPeriod;
+const int kSettle = kPeriod * 100;
+const int kMeasure = kPeriod * 200;
+
+// RBJ peaking EQ, normalized to a0 = 1, into |band| of |d|.
+void Peaking(postMixData_t* d, int band, double freq, double gain_db, double q) {
+  double A = pow(10, gain_db / 40), w = 2 * M_PI * freq / AUDIO_RATE;
+  double alpha = sin(w) / (2 * q), a0 = 1 + alpha / A;
+  float c[5] = {
+    (float)((1 + alpha * A) / a0),
+    (float)(-2 * cos(w) / a0),
+    (float)((1 - alpha * A) / a0),
+    (float)(-2 * cos(w) / a0),
+    (float)((1 - alpha / A) / a0),
+  };
+  memcpy(d->coefficients[band], c, sizeof(c));   // packed
+}
+
+// Runs a sine of |amplitude| (may be far over full scale, as the mix can
+// be) through |pm| and returns the output after it settled.
+std::vector<int16_t> Run(PostMix* pm, double amplitude) {
+  std::vector<int16_t> out(kSettle + kMeasure);
+  int32_t s[AUDIO_MIXER_BLOCK];
+  for (size_t pos = 0; pos < out.size(); pos += AUDIO_MIXER_BLOCK) {
+    int n = std::min<int>(AUDIO_MIXER_BLOCK, out.size() - pos);
+    for (int i = 0; i < n; i++) {
+      s[i] = lround(amplitude * sin(2 * M_PI * (pos + i) / kPeriod));
+    }
+    pm->Process(s, out.data() + pos, n);
+  }
+  return std::vector<int16_t>(out.begin() + kSettle, out.end());
+}
+
+// Amplitude of harmonic |h| of the sine.
+double Harmonic(const std::vector<int16_t>& v, int h) {
+  double re = 0, im = 0;
+  for (size_t i = 0; i < v.size(); i++) {
+    double a = 2 * M_PI * h * i / kPeriod;
+    re += v[i] * cos(a);
+    im += v[i] * sin(a);
+  }
+  return 2 * sqrt(re * re + im * im) / v.size();
+}
+
+// Total harmonic distortion up to the 10th harmonic, in dB.
+double THD(const std::vector<int16_t>& v) {
+  double sum = 0;
+  for (int h = 2; h <= 10; h++) sum += pow(Harmonic(v, h), 2);
+  return 20 * log10(sqrt(sum) / Harmonic(v, 1));
+}
+
+double Db(double x) { return 20 * log10(x); }
+
+int main() {
+  postMixData_t d = {};
+  d.referenceLevel = 2000;
+  d.limiterThreshold = 1.0;
+  d.limiterRelease = 0.05;
+
+  STDOUT << "sine at " << kFreq << " Hz\n";
+  {
+    PostMix pm;
+    pm.Set(d);
+    std::vector<int16_t> out = Run(&pm, 8000);
+    double level = Db(Harmonic(out, 1) / 8000), thd = THD(out);
+    STDOUT << "flat: level " << level << " dB, THD " << thd << " dB\n";
+    Expect(fabs(level) < 0.05, "flat level, dB", level);
+    Expect(thd < -80, "flat THD, dB", thd);
+  }
+  {
+    d.nBands = 1;
+    Peaking(&d, 0, kFreq, 12, 1.0);
+    PostMix pm;
+    pm.Set(d);
+    std::vector<int16_t> out = Run(&pm, 2000);
+    double level = Db(Harmonic(out, 1) / 2000), thd = THD(out);
+    STDOUT << "+12 dB band: level " << level << " dB, THD " << thd << " dB\n";
+    Expect(fabs(level - 12) < 0.1, "boosted level, dB", level);
+    Expect(thd < -70, "boosted THD, dB", thd);
+  }
+  {
+    // Two +12 dB bands on a mix at 32 x full scale: the second band's
+    // output is past what 32 bits hold.
+    d.nBands = 2;
+    Peaking(&d, 1, kFreq, 12, 1.0);
+    PostMix pm;
+    pm.Set(d);
+    std::vector<int16_t> out = Run(&pm, 32 * 32767);
+    int wraps = 0, peak = 0;
+    for (size_t i = 1; i < out.size(); i++) {
+      if (abs(out[i] - out[i - 1]) > 30000) wraps++;
+      peak = std::max(peak, abs(out[i]));
+    }
+    double level = Db(Harmonic(out, 1) / 32767), thd = THD(out);
+    STDOUT << "+24 dB on 32 x full scale: level " << level
+           << " dB of full scale, THD " << thd << " dB, peak " << peak << "\n";
+    Expect(wraps == 0, "samples that wrapped around", wraps);
+    Expect(level > -3, "overdriven level, dB", level);
+  }
+
+  if (errors) return 1;
+  STDOUT << "post_mix_test: OK\n";
+  return 0;
+}
@@ -0,0 +1,114 @@
+// The preset prefetch: the index check spread over Loop() calls gives the
+// same fingerprint as IndexFingerprint(), and Apply() falls back to a
+// normal scan when the font changed after it was prefetched.
+
+#define PRESET_PREFETCH 1
+#include "host.h"
+#include "test_wav.h"
+
+int errors = 0;
+
+void Expect(bool ok, const char* what) {
+  if (ok) return;
+  STDOUT << "FAIL: " << what << "\n";
+  errors++;
+}
+
+void Touch(const std::string& path, int bytes = 0) {
+  FILE* f = fopen(path.c_str(), "wb");
+  for (int i = 0; i < bytes; i++) fputc('#', f);
+  fclose(f);
+}
+
+void MakeFont(const std::string& dir) {
+  mkdir(dir.c_str(), 0755);
+  for (const char* e : {"clsh", "blst", "swng"}) {
+    mkdir((dir + "/" + e).c_str(), 0755);
+    for (int i = 1; i <= 8; i++) {
+      Touch(dir + "/" + e + "/" + e + std::to_string(i) + ".wav", 44);
+    }
+  }
+  for (const char* f : {"hum.wav", "font.wav", "in.wav", "out.wav"}) {
+    Touch(dir + "/" + f, 44);
+  }
+  Touch(dir + "/config.ini", 100);
+  Touch(dir + "/readme.txt");
+}
+
+class TestPrefetch : public PresetPrefetch {
+public:
+  using PresetPrefetch::Loop;
+};
+
+int main() {
+  std::string root = TestDir("preset_prefetch");
+  std::string a = root + "/a", b = root + "/b";
+  MakeFont(a);
+  MakeFont(b);
+  Touch(b + "/preon.wav", 44);
+
+  // The indexes are written by the first scan of each font.
+  for (const std::string& dir : {a, b}) {
+    MakeDirectoryList(current_directory, dir.c_str());
+    Effect::ScanCurrentDirectory();
+  }
+
+  // Spread over any number of calls, the walk ends up the same.
+  for (uint32_t budget : {1u, 2u, 5u, 1000u}) {
+    Effect::FingerprintWalk walk;
+    walk.Start(current_directory);
+    int calls = 1;
+    while (!walk.Step(budget)) calls++;
+    Expect(walk.fingerprint() == Effect::IndexFingerprint(), "walk fingerprint");
+    Expect(budget > 10 || calls > 1, "walk spread over several calls");
+  }
+  char missing[64];
+  MakeDirectoryList(missing, (root + "/none").c_str());
+  Effect::FingerprintWalk walk;
+  walk.Start(missing);
+  while (!walk.Step(1));
+  Expect(walk.fingerprint() == 0, "no fingerprint for a missing directory");
+
+  std::string font_a = a, font_b = b;
+  TestPrefetch prefetch;
+  auto prefetch_both = [&]() {
+    prefetch.SetTargets(font_b.c_str(), font_a.c_str());
+    for (int i = 0; i < 1000; i++) prefetch.Loop();
+  };
+
+  // Unchanged font: restored from the prefetch.
+  prefetch_both();
+  MakeDirectoryList(current_directory, b.c_str());
+  Expect(prefetch.Apply(), "prefetched font used");
+  Expect(SFX_preon.files_found() == 1 && SFX_clsh.files_found() == 8,
+         "prefetched font has the files");
+  FileReader f;
+  Expect(config_file_cache->OpenCached((b + "/config.ini").c_str(), &f) &&
+         f.FileSize() == 100, "config file read from the prefetch");
+  f.Close();
+
+  // A sound file added after the prefetch.
+  prefetch_both();
+  Touch(a + "/clsh/clsh9.wav", 44);
+  MakeDirectoryList(current_directory, a.c_str());
+  Expect(!prefetch.Apply(), "font with a new file rescanned");
+  Expect(prefetch.stale() == 1, "stale prefetch counted");
+  Effect::ScanCurrentDirectory();
+  Expect(SFX_clsh.files_found() == 9, "rescan finds the new file");
+
+  // A config file edited after the prefetch.
+  prefetch_both();
+  Touch(b + "/config.ini", 120);
+  MakeDirectoryList(current_directory, b.c_str());
+  Expect(!prefetch.Apply(), "font with an edited config file rescanned");
+  Expect(prefetch.stale() == 2, "second stale prefetch counted");
+
+  // Other files don't matter.
+  prefetch_both();
+  Touch(b + "/readme.txt", 10);
+  Expect(prefetch.Apply(), "other files ignored");
+
+  if (errors) return 1;
+  STDOUT << "preset_prefetch_test: OK\n";
+  return 0;
+}
@@ -0,0 +1,287 @@
+// Offline renderer: plays a font and a motion trace (common/motion_trace.h)
+// through the sound code on the simulated clock, and writes what the mixer
+// puts out to a WAV file.
+//
+//   ./render <font dir> <trace> <out.wav> [-b]
+//
+// Prints the mixer and buffer fill time per block of AUDIO_BUFFER_SIZE
+// samples (host nanoseconds), and the underflows; with -b, for every
+// block. The same font and trace give the same sound before and after a
+// change to the audio path, and the times show what it cost.
+//
+// Without arguments, it makes a font of tones and a trace of an ignition,
+// a few swings, a clash, a blast and a retraction, renders them to
+// /tmp/proffie_render, and checks that they all got played without an
+// underflow. That is what make runs.
+
+#include "host.h"
+#include "test_wav.h"
+#include <sys/stat.h>
+
+// Stands in for the prop: a short click on the power button turns the
+// saber on or off, one on the aux button is a blast, and a jump in the
+// acceleration is a clash. The motion goes to the font as it is.
+class RenderProp {
+public:
+  void DoMotion(const Vec3& gyro, bool clear) { SaberBase::DoMotion(gyro, clear); }
+
+  void DoAccel(const Vec3& accel, bool clear) {
+    SaberBase::DoAccel(accel, clear);
+    if (!clear && SaberBase::IsOn() && (accel - last_accel_).len() > kClashG &&
+        millis() - last_clash_ > 100) {
+      last_clash_ = millis();
+      clashes++;
+      SaberBase::DoClash();
+    }
+    last_accel_ = accel;
+  }
+
+  bool Event(BUTTON button, EVENT event) {
+    if (event != EVENT_CLICK_SHORT) return false;
+    switch (button) {
+      case BUTTON_POWER:
+        if (SaberBase::IsOn()) {
+          offs++;
+          SaberBase::TurnOff(SaberBase::OFF_NORMAL);
+        } else {
+          ons++;
+          SaberBase::TurnOn();
+        }
+        return true;
+      case BUTTON_AUX:
+        if (!SaberBase::IsOn()) return false;
+        blasts++;
+        SaberBase::DoBlast();
+        return true;
+      default:
+        return false;
+    }
+  }
+
+  int ons = 0, offs = 0, clashes = 0, blasts = 0;
+
+private:
+  static constexpr float kClashG = 2.0;
+  Vec3 last_accel_{0, 0, 0};
+  uint32_t last_clash_ = 0;
+};
+
+RenderProp prop;
+
+#include "../common/motion_trace.h"
+
+// The font part of PropBase::SetPreset(). There is no user profile on
+// the host, so the swing sensitivity stays as smoothsw.ini has it.
+void ActivateFont(const char* dir) {
+  MakeDirectoryList(current_directory, dir);
+  Effect::ScanCurrentDirectory();
+  hybrid_font.Activate();
+  smooth_swing_config.ReadInCurrentDir("smoothsw.ini");
+  if (!SFX_swingl) smooth_swing_config.Version = 0;
+  switch (smooth_swing_config.Version) {
+    case 1: looped_swing_wrapper.Activate(&hybrid_font); break;
+    case 2: smooth_swing_v2.Activate(&hybrid_font); break;
+  }
+}
+
+uint32_t Underflows() {
+  uint32_t ret = dynamic_mixer.underflow_count_.get();
+  for (size_t i = 0; i < NELEM(wav_players); i++) ret += wav_players[i].underflows();
+  return ret;
+}
+
+struct Times {
+  std::vector<uint32_t> ns;
+  void Print(const char* what) {
+    std::vector<uint32_t> v = ns;
+    std::sort(v.begin(), v.end());
+    uint64_t sum = 0;
+    for (uint32_t t : v) sum += t;
+    STDOUT << what << " per block [ns]: min=" << v[0] << " avg=" << (uint32_t)(sum / v.size())
+           << " 99%=" << v[v.size() * 99 / 100] << " max=" << v.back() << "\n";
+  }
+};
+
+// Renders until the trace has played and then |tail_ms| more. Returns
+// the underflows, -1 if the trace can't be played.
+int Render(const char* font, const char* trace, const char* out,
+           bool per_block, int tail_ms, std::vector<int16_t>* samples) {
+  ActivateFont(font);
+  std::string cmd = std::string("play ") + trace;
+  motion_trace.Parse("trace", cmd.c_str());
+  if (!motion_trace.playing()) return -1;
+
+  const uint32_t block_us = AUDIO_BUFFER_SIZE * 1000000ull / AUDIO_RATE;
+  Times mixer, fill;
+  uint32_t underflows = Underflows(), tail_blocks = tail_ms * 1000 / block_us;
+  int16_t data[AUDIO_BUFFER_SIZE];
+  for (uint32_t block = 0; motion_trace.playing() || tail_blocks--; block++) {
+    motion_trace.Loop();
+    hybrid_font.Loop();
+
+    // As on the boards, the buffers are filled outside of the mixer.
+    uint64_t t0 = host_nanos();
+    AudioStreamWork::FillBuffersAndWait();
+    uint64_t t1 = host_nanos();
+    AudioStreamWork::LockSD_nomount(true);
+    dynamic_mixer.read(data, AUDIO_BUFFER_SIZE);
+    uint64_t t2 = host_nanos();
+    AudioStreamWork::LockSD_nomount(false);
+    host_advance_micros(block_us);
+
+    samples->insert(samples->end(), data, data + AUDIO_BUFFER_SIZE);
+    fill.ns.push_back(t1 - t0);
+    mixer.ns.push_back(t2 - t1);
+    if (per_block) {
+      STDOUT << "block " << block << ": mixer " << (uint32_t)(t2 - t1) << " ns, fill "
+             << (uint32_t)(t1 - t0) << " ns, underflows " << (Underflows() - underflows) << "\n";
+    }
+  }
+  underflows = Underflows() - underflows;
+
+  WriteWav(out, *samples);
+  STDOUT << samples->size() << " samples to " << out << "\n";
+  mixer.Print("Mixer");
+  fill.Print("Fill");
+  STDOUT << "of " << block_us * 1000 << " ns per block, " << underflows << " underflows\n";
+  return underflows;
+}
+
+// ---- Without arguments: a made-up font and trace.
+
+std::vector<int16_t> Tone(int ms, float period, int amplitude) {
+  std::vector<int16_t> v(AUDIO_RATE * ms / 1000);
+  for (size_t i = 0; i < v.size(); i++) v[i] = amplitude * sin(2 * M_PI * i / period);
+  return v;
+}
+
+class TraceWriter {
+public:
+  explicit TraceWriter(const std::string& path) : f_(fopen(path.c_str(), "wb")) {}
+  ~TraceWriter() { fclose(f_); }
+  void Motion(uint32_t ms, MotionTraceType type, float x, float y, float z) {
+    MotionTraceRecord r;
+    r.millis = ms;
+    r.type = type;
+    r.v[0] = x;
+    r.v[1] = y;
+    r.v[2] = z;
+    fwrite(&r, sizeof(r), 1, f_);
+  }
+  void Click(uint32_t ms, BUTTON button) {
+    MotionTraceRecord r;
+    r.millis = ms;
+    r.type = MOTION_TRACE_BUTTON;
+    r.e.button = button;
+    r.e.event = EVENT_CLICK_SHORT;
+    r.e.press_count = 1;
+    fwrite(&r, sizeof(r), 1, f_);
+  }
+private:
+  FILE* f_;
+};
+
+int errors = 0;
+
+void Expect(bool ok, const char* what, double got) {
+  if (ok) return;
+  STDOUT << "FAIL: " << what << ": " << got << "\n";
+  errors++;
+}
+
+double RMS(const std::vector<int16_t>& v, int from_ms, int to_ms) {
+  size_t begin = AUDIO_RATE * from_ms / 1000, end = AUDIO_RATE * to_ms / 1000;
+  double sum = 0;
+  for (size_t i = begin; i < end; i++) sum += v[i] * (double)v[i];
+  return sqrt(sum / (end - begin));
+}
+
+// Amplitude of the tone with |period| in |v| from |from_ms| to |to_ms|.
+double Tone(const std::vector<int16_t>& v, float period, int from_ms, int to_ms) {
+  size_t begin = AUDIO_RATE * from_ms / 1000, end = AUDIO_RATE * to_ms / 1000;
+  double re = 0, im = 0;
+  for (size_t i = begin; i < end; i++) {
+    re += v[i] * cos(2 * M_PI * i / period);
+    im += v[i] * sin(2 * M_PI * i / period);
+  }
+  return 2 * sqrt(re * re + im * im) / (end - begin);
+}
+
+int SelfTest() {
+  std::string dir = TestDir("render");
+  std::string font = dir + "/font";
+  if (mkdir(font.c_str(), 0777)) return 1;
+  WriteWav((font + "/out.wav").c_str(), Tone(500, 80, 4000));
+  WriteWav((font + "/hum.wav").c_str(), Tone(1000, 200, 3000));
+  WriteWav((font + "/in.wav").c_str(), Tone(500, 80, 4000));
+  WriteWav((font + "/swingl.wav").c_str(), Tone(1000, 150, 6000));
+  WriteWav((font + "/swingh.wav").c_str(), Tone(1000, 120, 6000));
+  WriteWav((font + "/clsh.wav").c_str(), Tone(300, 40, 10000));
+  WriteWav((font + "/blst.wav").c_str(), Tone(300, 60, 10000));
+
+  // Ignition at 200 ms, swings from 1 to 2 s, a clash at 2.3 s, a blast
+  // at 2.8 s and retraction at 3.5 s. The motion sensor runs at 1 kHz.
+  std::string trace = dir + "/trace.bin";
+  {
+    TraceWriter w(trace);
+    for (uint32_t ms = 0; ms < 4000; ms++) {
+      if (ms == 200 || ms == 3500) w.Click(ms, BUTTON_POWER);
+      if (ms == 2800) w.Click(ms, BUTTON_AUX);
+      float swing = ms >= 1000 && ms < 2000 ? 500 * powf(sinf(M_PI * (ms - 1000) / 250.0f), 2) : 0;
+      w.Motion(ms, MOTION_TRACE_GYRO, 0, 0, swing);
+      w.Motion(ms, MOTION_TRACE_ACCEL, ms == 2300 ? 5 : 1, 0, 0);
+    }
+  }
+
+  std::vector<int16_t> out;
+  int underflows = Render(font.c_str(), trace.c_str(), (dir + "/out.wav").c_str(),
+                               false, 1000, &out);
+
+  Expect(prop.ons == 1 && prop.offs == 1, "ignitions and retractions", prop.ons + prop.offs);
+  Expect(prop.clashes == 1, "clashes", prop.clashes);
+  Expect(prop.blasts == 1, "blasts", prop.blasts);
+  Expect(underflows == 0, "underflows", underflows);
+  Expect(out.size() >= AUDIO_RATE * 5 - AUDIO_BUFFER_SIZE, "samples", out.size());
+  double before = RMS(out, 0, 190), after = RMS(out, 4700, 5000);
+  STDOUT << "RMS before ignition " << before << ", after retraction " << after << "\n";
+  Expect(before == 0, "RMS before ignition", before);
+  Expect(after == 0, "RMS after retraction", after);
+  // Each sound is a tone of its own, loud in its part of the trace and
+  // not in an earlier part as long.
+  struct { const char* name; float period; int from_ms, to_ms, before_ms; } parts[] = {
+    { "out", 80, 220, 400, 0 },
+    { "hum", 200, 800, 1000, 0 },
+    { "swingl", 150, 1100, 1900, 200 },
+    { "swingh", 120, 1100, 1900, 200 },
+    { "clsh", 40, 2310, 2500, 2100 },
+    { "blst", 60, 2810, 3000, 2600 },
+    { "in", 80, 3510, 3700, 3300 },
+  };
+  for (const auto& p : parts) {
+    int len = p.to_ms - p.from_ms;
+    double during = Tone(out, p.period, p.from_ms, p.to_ms);
+    double before = Tone(out, p.period, p.before_ms, p.before_ms + len);
+    STDOUT << p.name << ": " << during << ", before " << before << "\n";
+    Expect(during > 300 && during > before * 4, p.name, during);
+  }
+
+  if (errors) return 1;
+  STDOUT << "render: OK\n";
+  return 0;
+}
+
+int main(int argc, char** argv) {
+  bool per_block = false;
+  std::vector<const char*> args;
+  for (int i = 1; i < argc; i++) {
+    if (!strcmp(argv[i], "-b")) per_block = true;
+    else args.push_back(argv[i]);
+  }
+  if (args.empty() && !per_block) return SelfTest();
+  if (args.size() != 3) {
+    fprintf(stderr, "usage: %s <font dir> <trace> <out.wav> [-b]\n", argv[0]);
+    return 2;
+  }
+  std::vector<int16_t> out;
+  return Render(args[0], args[1], args[2], per_block, 1000, &out) < 0 ? 1 : 0;
+}
@@ -0,0 +1,88 @@
+// Frequency response and cost of the polyphase resampler for each input
+// rate PlayWav converts, and a check that a new file doesn't start with
+// samples left over from the last one.
+
+#include "host.h"
+#include "test_wav.h"
+
+int errors = 0;
+
+void Expect(bool ok, const char* what, uint32_t rate, double value) {
+  if (ok) return;
+  STDOUT << "FAIL: " << what << " at " << (int)rate << " Hz: " << value << "\n";
+  errors++;
+}
+
+// Level in dB of a full scale sine at |freq| after resampling from |rate|.
+// Also returns the cost in ns per output sample.
+double Level(uint32_t rate, double freq, double* ns) {
+  static int16_t out[2 * 96000 * kMaxResampleOutput];
+  PolyphaseResampler r;
+  r.Setup(rate);
+  int n = 0;
+  uint32_t start = host_cycles();
+  for (uint32_t i = 0; i < 2 * rate; i++) {
+    n += r.Push(16000 * sin(2 * M_PI * freq * i / rate), out + n);
+  }
+  *ns = (double)(host_cycles() - start) / n;
+  double sq = 0;
+  for (int i = n / 4; i < n; i++) sq += (double)out[i] * out[i];
+  return 20 * log10(sqrt(sq / (n - n / 4) * 2) / 16000);
+}
+
+void FrequencyResponse() {
+  STDOUT << "rate    0.1    0.5    0.8 x Nyquist   30 kHz   ns/sample\n";
+  for (uint32_t rate : {8000, 11025, 16000, 22050, 32000, 48000, 88200, 96000}) {
+    double nyquist = std::min<uint32_t>(rate, AUDIO_RATE) / 2.0, ns;
+    double low = Level(rate, 0.1 * nyquist, &ns);
+    double mid = Level(rate, 0.5 * nyquist, &ns);
+    double high = Level(rate, 0.8 * nyquist, &ns);
+    // The 8-tap tables are down 3 dB at 0.8 x Nyquist.
+    Expect(fabs(low) < 0.1, "level at 0.1 x Nyquist", rate, low);
+    Expect(fabs(mid) < 0.5, "level at 0.5 x Nyquist", rate, mid);
+    Expect(high > -3.5 && high < 0.5, "level at 0.8 x Nyquist", rate, high);
+    STDOUT << (int)rate << "  " << low << "  " << mid << "  " << high;
+    if (rate > 60000) {
+      double stop = Level(rate, 30000, &ns);
+      Expect(stop < -35, "alias of 30 kHz", rate, stop);
+      STDOUT << "  " << stop;
+    }
+    STDOUT << "  " << ns << "\n";
+  }
+}
+
+// Play a file to the end in reads of |chunk| samples, then another one.
+// The second is silent, so anything but zeros is left over from the first.
+void NewFileStartsClean(const std::string& dir, int chunk) {
+  static unsigned char read_buffer[512];
+  PlayWav wav;
+  wav.SetReadBuffer(read_buffer, sizeof(read_buffer));
+  std::string loud = dir + "/loud.wav", silent = dir + "/silent.wav";
+  int16_t out[AUDIO_BUFFER_SIZE];
+  wav.Play(loud.c_str());
+  for (int i = 0; i < 10000 && !wav.eof(); i++) wav.read(out, chunk);
+  wav.Play(silent.c_str());
+  int n = wav.read(out, kMaxResampleOutput);
+  for (int i = 0; i < n; i++) {
+    if (out[i] == 0) continue;
+    STDOUT << "FAIL: sample " << i << " of the new file is " << out[i]
+           << " after reads of " << chunk << "\n";
+    errors++;
+  }
+}
+
+int main() {
+  FrequencyResponse();
+
+  std::string dir = TestDir("resampler");
+  std::vector<int16_t> loud(1001, 20000), silent(100, 0);
+  WriteWav((dir + "/loud.wav").c_str(), loud, 8000);
+  WriteWav((dir + "/silent.wav").c_str(), silent, 8000);
+  for (int chunk = 1; chunk < kMaxResampleOutput; chunk++) {
+    NewFileStartsClean(dir, chunk);
+  }
+
+  if (errors) return 1;
+  STDOUT << "resampler_test: OK\n";
+  return 0;
+}
@@ -0,0 +1,212 @@
+// Replays a gyro trace through SmoothSwingV2 and through the float code it
+// replaced, and compares the hum, swingl and swingh volumes after every
+// motion sample. The speed is rounded differently, so the two may decide
+// differently on whether a swing has started or ended when it is right at
+// one of the thresholds; those samples are counted separately.
+
+#include "host.h"
+#include "test_wav.h"
+
+const float kMotionRate = 1600;   // samples per second
+
+// The float version of SmoothSwingV2::SB_Motion(), before the fixed point
+// rewrite, with the players replaced by their volumes.
+class FloatSmoothSwing {
+public:
+  void On() {
+    on_ = true;
+    PickRandomSwing();
+  }
+
+  void Motion(const Vec3& raw_gyro) {
+    Vec3 gyro = gyro_filter_.filter(raw_gyro);
+    float speed = sqrtf(gyro.z * gyro.z + gyro.y * gyro.y);
+    speed_ = speed;
+    uint32_t t = micros();
+    uint32_t delta = t - last_micros_;
+    if (delta > 1000000) delta = 1;
+    last_micros_ = t;
+    float hum_volume = 1.0;
+
+    switch (state_) {
+      case OFF:
+        if (speed < smooth_swing_config.SwingStrengthThreshold) break;
+        state_ = ON;
+      case ON:
+        if (speed >= smooth_swing_config.SwingStrengthThreshold * 0.9) {
+          float swing_strength =
+            std::min<float>(1.0, speed / smooth_swing_config.SwingSensitivity);
+          A.midpoint -= speed * delta / 1000000.0;
+          while (A.end() < 0.0) {
+            B.midpoint = A.midpoint + 180.0;
+            std::swap(A, B);
+          }
+          float mixab = 0.0;
+          if (A.begin() < 0.0)
+            mixab = clamp(- A.begin() / A.width, 0.0, 1.0);
+          float mixhum = powf(swing_strength, smooth_swing_config.SwingSharpness);
+          hum_volume = 1.0 - mixhum * smooth_swing_config.MaximumHumDucking / 100.0;
+          mixhum *= smooth_swing_config.MaxSwingVolume;
+          if (on_) {
+            A.volume = mixhum * mixab;
+            B.volume = mixhum * (1.0 - mixab);
+          }
+          break;
+        }
+        A.volume = 0;
+        B.volume = 0;
+        state_ = OUT;
+      case OUT:
+        PickRandomSwing();
+        state_ = OFF;
+    }
+    hum_volume_ = hum_volume;
+  }
+
+  float speed() const { return speed_; }   // after the gyro filter
+  float hum_volume() const { return hum_volume_; }
+  float low_volume() const { return A.low ? A.volume : B.volume; }
+  float high_volume() const { return A.low ? B.volume : A.volume; }
+
+private:
+  void PickRandomSwing() {
+    uint32_t m = millis();
+    if (picked_ && m - last_random_ < 1000) return;
+    picked_ = true;
+    last_random_ = m;
+    random(SFX_swingl.files_found());
+    A = Data{0, 0, 0, true};
+    B = Data{0, 0, 0, false};
+    if (random(2)) std::swap(A, B);
+    float t1_offset = random(1000) / 1000.0 * 50 + 10;
+    A.midpoint = t1_offset;
+    A.width = smooth_swing_config.Transition1Degrees;
+    B.midpoint = t1_offset + 180.0;
+    B.width = smooth_swing_config.Transition2Degrees;
+  }
+
+  struct Data {
+    float begin() const { return midpoint - width / 2; }
+    float end() const { return midpoint + width / 2; }
+    float midpoint;
+    float width;
+    float volume;
+    bool low;   // swingl, else swingh
+  };
+  Data A, B;
+  enum { OFF, ON, OUT } state_ = OFF;
+  bool on_ = false;
+  bool picked_ = false;
+  uint32_t last_random_ = 0;
+  uint32_t last_micros_ = 0;
+  float hum_volume_ = 1.0;
+  float speed_ = 0;
+  BoxFilter<Vec3, 3> gyro_filter_;
+};
+
+// Stands in for the font underneath SmoothSwingV2.
+class HumRecorder : public SaberBase {
+public:
+  HumRecorder() : SaberBase(NOLINK) {}
+  void SetHumVolume(float volume) override { hum_volume = volume; }
+  float hum_volume = 1.0;
+};
+
+struct MotionSample {
+  Vec3 gyro;      // degrees per second
+  int segment;    // a swing and the rest before it
+};
+
+// Swings of increasing speed, in random directions, with rests in between
+// and a little sensor noise.
+std::vector<MotionSample> MakeTrace() {
+  std::vector<MotionSample> trace;
+  int segment = 0;
+  auto noise = []() { return (random(600) - 300) / 100.0f; };
+  for (int round = 0; round < 4; round++) {
+    for (float peak : {15.0f, 40.0f, 120.0f, 300.0f, 600.0f, 1000.0f, 1800.0f}) {
+      segment++;
+      for (int i = 0; i < kMotionRate / 2; i++) {
+        trace.push_back({Vec3(noise(), noise(), noise()), segment});
+      }
+      float angle = random(360) * M_PI / 180;
+      int len = kMotionRate * (0.3 + random(100) / 100.0);
+      for (int i = 0; i < len; i++) {
+        float s = peak * sinf(M_PI * i / len);
+        trace.push_back({Vec3(noise(), s * cosf(angle) + noise(), s * sinf(angle) + noise()), segment});
+      }
+    }
+  }
+  return trace;
+}
+
+float PlayerVolume(Effect* effect) {
+  RefPtr<BufferedWavPlayer> player = GetWavPlayerPlaying(effect);
+  return player ? player->volume_target() / (float)kDefaultVolume : 0.0f;
+}
+
+int main() {
+  std::string dir = TestDir("smooth_swing");
+  for (const char* name : {"hum", "swingl", "swingh"}) {
+    WriteWav((dir + "/" + name + ".wav").c_str(), std::vector<int16_t>(AUDIO_RATE, 1000));
+  }
+  MakeDirectoryList(current_directory, dir.c_str());
+  Effect::ScanCurrentDirectory();
+  SetupStandardAudio();
+  smooth_swing_config.ReadInCurrentDir("smoothsw.ini");   // defaults
+
+  std::vector<MotionSample> trace = MakeTrace();
+  int errors = 0;
+  for (float sharpness : {0.5f, 1.0f, 1.75f, 3.0f}) {
+    smooth_swing_config.SwingSharpness = sharpness;
+    HumRecorder font;
+    SmoothSwingV2 fixed;
+    FloatSmoothSwing ref;
+    fixed.Activate(&font);
+    srand(1);
+    fixed.SB_On();
+    srand(1);
+    ref.On();
+
+    float max_swing = 0, max_hum = 0;
+    int at_threshold = 0;
+    for (const MotionSample& m : trace) {
+      host_advance_micros(1000000 / kMotionRate);
+      // Both pick the same random swing transitions, even if they pick
+      // them a motion sample apart.
+      srand(m.segment);
+      fixed.SB_Motion(m.gyro, false);
+      srand(m.segment);
+      ref.Motion(m.gyro);
+      float swing = std::max(fabsf(PlayerVolume(&SFX_swingl) - ref.low_volume()),
+                             fabsf(PlayerVolume(&SFX_swingh) - ref.high_volume()));
+      float hum = fabsf(font.hum_volume - ref.hum_volume());
+      if (swing > 0.01 || hum > 0.005) {
+        float threshold = smooth_swing_config.SwingStrengthThreshold;
+        if (fabsf(ref.speed() - threshold) < 0.25 ||
+            fabsf(ref.speed() - threshold * 0.9) < 0.25) {
+          at_threshold++;
+        } else {
+          STDOUT << "FAIL: motion sample " << (&m - trace.data()) << " at "
+                 << ref.speed() << " deg/s: swing volume off by " << swing
+                 << ", hum volume off by " << hum << "\n";
+          errors++;
+        }
+        continue;
+      }
+      max_swing = std::max(max_swing, swing);
+      max_hum = std::max(max_hum, hum);
+    }
+    STDOUT << "sharpness " << sharpness << ": " << trace.size()
+           << " motion samples, largest difference, % of default volume: swing "
+           << max_swing * 100 << ", hum " << max_hum * 100 << "; "
+           << at_threshold << " at a threshold\n";
+    fixed.SB_Off(SaberBase::OFF_NORMAL);
+    fixed.Deactivate();
+    for (size_t i = 0; i < NELEM(wav_players); i++) wav_players[i].Stop();
+  }
+
+  if (errors) return 1;
+  STDOUT << "smooth_swing_test: OK\n";
+  return 0;
+}
@@ -0,0 +1,210 @@
+// Style::run() with STYLE_SPANS, which gets the colors STYLE_SPAN LEDs at
+// a time, against the loop it replaces, which made one virtual
+// getColor2() call per LED. Both must set the same colors on the blade,
+// frame after frame, for a blade of whole spans and for one that ends in
+// a partial span. Also prints the time per frame of each for a 144 LED
+// blade; this one is built with -Os, like the boards.
+//
+// Random draws happen in a different order when more than one node of a
+// style draws them per LED, so such styles are left out here.
+
+#define STYLE_SPANS 1
+#include "host.h"
+#include "test_wav.h"
+
+#include "../common/color.h"
+#include "../common/range.h"
+#include "../blades/blade_base.h"
+#include "../blades/blade_wrapper.h"
+
+template<class T, class U>
+struct is_same_type { static const bool value = false; };
+template<class T>
+struct is_same_type<T, T> { static const bool value = true; };
+#define StyleAllocator class StyleFactory*
+
+#include "../functions/svf.h"
+#include "../styles/rgb.h"
+#include "../styles/gradient.h"
+#include "../styles/audio_flicker.h"
+#include "../styles/brown_noise_flicker.h"
+#include "../styles/colors.h"
+#include "../styles/mix.h"
+#include "../styles/style_ptr.h"
+#include "../functions/int.h"
+#include "../functions/smoothstep.h"
+#include "../functions/sound_level.h"
+
+// Keeps what the style sets.
+class HostBlade : public BladeBase {
+public:
+  explicit HostBlade(int num_leds) : colors_(num_leds), overdrive_(num_leds) {}
+  int num_leds() const override { return colors_.size(); }
+  Color8::Byteorder get_byteorder() const override { return Color8::RGB; }
+  bool is_on() const override { return true; }
+  bool is_powered() const override { return true; }
+  size_t GetEffects(BladeEffect** blade_effects) override { return 0; }
+  void set(int led, Color16 c) override {
+    colors_[led] = c;
+    overdrive_[led] = false;
+  }
+  void set_overdrive(int led, Color16 c) override {
+    colors_[led] = c;
+    overdrive_[led] = true;
+  }
+  void allow_disable() override {}
+  bool IsPrimary() override { return true; }
+  void Activate() override {}
+  void Deactivate() override {}
+  BladeStyle* UnSetStyle() override { return nullptr; }
+  void SetStyle(BladeStyle* style) override {}
+  BladeStyle* current_style() const override { return nullptr; }
+  StyleHeart StylesAccepted() override { return StyleHeart(); }
+
+  // LEDs that differ from |other|.
+  int Compare(const HostBlade& other) const {
+    int ret = 0;
+    for (size_t i = 0; i < colors_.size(); i++) {
+      const Color16& a = colors_[i];
+      const Color16& b = other.colors_[i];
+      if (a.r != b.r || a.g != b.g || a.b != b.b || overdrive_[i] != other.overdrive_[i]) ret++;
+    }
+    return ret;
+  }
+
+private:
+  std::vector<Color16> colors_;
+  std::vector<bool> overdrive_;
+};
+
+// Style<T>::run() before spans: one virtual getColor2() per LED.
+template<class C>
+class PerLedStyleBase {
+public:
+  virtual C getColor2(int i) = 0;
+  virtual void run(BladeBase* blade) = 0;
+
+  void runloop(BladeBase* blade) {
+    for (int i = 0; i < blade->num_leds(); i++) {
+      C c = getColor2(i);
+      uint32_t tmp = c.c.r * userProfile.masterBrightness;
+      c.c.r = tmp >> 16;
+      tmp = c.c.g * userProfile.masterBrightness;
+      c.c.g = tmp >> 16;
+      tmp = c.c.b * userProfile.masterBrightness;
+      c.c.b = tmp >> 16;
+      if (c.getOverdrive()) blade->set_overdrive(i, c.c);
+      else blade->set(i, c.c);
+    }
+  }
+};
+
+template<class T>
+class PerLedStyle : public PerLedStyleBase<decltype(T().getColor(0))> {
+public:
+  auto getColor2(int i) -> decltype(T().getColor(0)) override { return base_.getColor(i); }
+  void run(BladeBase* blade) override {
+    RunStyle(&base_, blade);
+    this->runloop(blade);
+  }
+private:
+  T base_;
+};
+
+int errors = 0;
+int16_t audio[AUDIO_BUFFER_SIZE];
+
+// Both versions draw the same random numbers in a frame.
+template<class S>
+void Frame(S* style, HostBlade* blade, int frame) {
+  srand(frame);
+  style->run(blade);
+}
+
+// A block of sound, for the sound level, and a millisecond.
+void NextFrame() {
+  dynamic_mixer.read(audio, AUDIO_BUFFER_SIZE);
+  host_advance_micros(1000);
+}
+
+template<class T>
+void Compare(const char* name, int num_leds) {
+  Style<T> spans;
+  PerLedStyle<T> per_led;
+  BladeStyle* spans_base = &spans;
+  PerLedStyleBase<decltype(T().getColor(0))>* per_led_base = &per_led;
+  HostBlade a(num_leds), b(num_leds);
+  int differ = 0;
+  for (int f = 0; f < 500; f++) {
+    NextFrame();
+    Frame(spans_base, &a, f);
+    Frame(per_led_base, &b, f);
+    int d = a.Compare(b);
+    if (d && !differ++) {
+      STDOUT << "FAIL: " << name << ", " << num_leds << " LEDs: frame " << f
+             << ": " << d << " LEDs differ\n";
+    }
+  }
+  if (differ) errors++;
+}
+
+// Nanoseconds per frame of 144 LEDs, spans and per LED.
+template<class T>
+void Bench(const char* name) {
+  const int kFrames = 2000;
+  Style<T> spans;
+  PerLedStyle<T> per_led;
+  BladeStyle* spans_base = &spans;
+  PerLedStyleBase<decltype(T().getColor(0))>* per_led_base = &per_led;
+  HostBlade blade(144);
+  uint64_t span_ns = 0, per_led_ns = 0;
+  for (int f = 0; f < kFrames; f++) {
+    NextFrame();
+    uint64_t t0 = host_nanos();
+    per_led_base->run(&blade);
+    uint64_t t1 = host_nanos();
+    spans_base->run(&blade);
+    uint64_t t2 = host_nanos();
+    per_led_ns += t1 - t0;
+    span_ns += t2 - t1;
+  }
+  STDOUT << name << ": per LED " << (uint32_t)(per_led_ns / kFrames)
+         << " ns, spans " << (uint32_t)(span_ns / kFrames) << " ns\n";
+}
+
+template<class T>
+void Run(const char* name) {
+  Compare<T>(name, 144);
+  Compare<T>(name, 37);
+  Bench<T>(name);
+}
+
+int main() {
+  // Something for the sound level to follow.
+  std::string dir = TestDir("style_span");
+  std::vector<int16_t> hum(AUDIO_RATE);
+  for (size_t i = 0; i < hum.size(); i++) hum[i] = (i % 8000) * sin(i * 0.03);
+  WriteWav((dir + "/hum.wav").c_str(), hum);
+  MakeDirectoryList(current_directory, dir.c_str());
+  Effect::ScanCurrentDirectory();
+  SetupStandardAudio();
+  RefPtr<BufferedWavPlayer> player = GetFreeWavPlayer(true, BUS_HUM);
+  player->PlayOnce(&SFX_hum);
+  player->PlayLoop(&SFX_hum);
+
+  STDOUT << "ns per frame of 144 LEDs, STYLE_SPAN " << STYLE_SPAN << "\n";
+  Run<RED>("Red");
+  Run<Gradient<RED, BLUE>>("Gradient<Red,Blue>");
+  Run<Gradient<RED, GREEN, BLUE, WHITE>>("Gradient<Red,Green,Blue,White>");
+  Run<AudioFlicker<BLUE, CYAN>>("AudioFlicker<Blue,Cyan>");
+  Run<BrownNoiseFlicker<RED, WHITE, 50>>("BrownNoiseFlicker<Red,White,50>");
+  Run<Mix<NoisySoundLevel, RED, BLUE>>("Mix<NoisySoundLevel,Red,Blue>");
+  Run<Mix<Int<10000>, RED, GREEN, BLUE>>("Mix<Int<10000>,Red,Green,Blue>");
+  Run<Mix<SmoothStep<Int<16384>, Int<-4000>>, RED, BLUE>>("Mix<SmoothStep,Red,Blue>");
+  Run<Layers<Gradient<RED, BLUE>, AudioFlickerL<CYAN>>>("Layers<Gradient,AudioFlickerL>");
+  Run<Layers<BLUE, AlphaL<WHITE, SmoothStep<Int<16384>, Int<-4000>>>>>("Layers<Blue,AlphaL<White,SmoothStep>>");
+
+  if (errors) return 1;
+  STDOUT << "style_span_test: OK\n";
+  return 0;
+}
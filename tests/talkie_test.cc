@@ -0,0 +1,319 @@
+// Renders the built-in Talkie phrases with Talkie and with the per-sample
+// Q9 synthesizer it replaced, compares them LPC frame by LPC frame, and
+// reports the time per output sample of each. Both renders are written to
+// /tmp/proffie_talkie for listening.
+//
+// Some phrases carry a DC offset of a few thousand, which comes with the
+// LPC data (a double precision lattice has it too) and varies with the
+// rounding, so each frame is compared after removing its mean.
+
+#include "host.h"
+#include "test_wav.h"
+
+// The per-sample Talkie synthesizer, before block rendering, for a single
+// phrase at a time.
+class OldTalkie {
+public:
+  // With |ideal|, the lattice works in double precision, as a reference
+  // for how far each fixed point version is from the LPC model.
+  explicit OldTalkie(bool ideal = false) : ideal_(ideal) {
+    for (int i = 0; i < 10; i++) x[i] = 0;
+  }
+
+  void Say(const uint8_t* addr, uint32_t rate) {
+    rate_ = rate * 7;
+    coeffs_ = &tms5220_coeff;
+    count_ = rate_ - 1;
+    ptrAddr = addr;
+    ptrBit = 0;
+    frames.clear();
+    samples_ = 0;
+  }
+
+  int read(int16_t* data, int elements) {
+    if (eof()) return 0;
+    for (int i = 0; i < elements; i++) {
+      data[i] = Get44kHz();
+      samples_++;
+    }
+    return elements;
+  }
+
+  bool eof() const {
+    return ptrAddr == NULL && !A && !B && !C && !D;
+  }
+
+  // Output sample at which each LPC frame started.
+  std::vector<size_t> frames;
+
+private:
+  static uint8_t rev(uint8_t a) {
+    a = (a>>4) | (a<<4);
+    a = ((a & 0xcc)>>2) | ((a & 0x33)<<2);
+    a = ((a & 0xaa)>>1) | ((a & 0x55)<<1);
+    return a;
+  }
+
+  uint8_t getBits(uint8_t bits) {
+    uint16_t data = rev(pgm_read_byte(ptrAddr))<<8;
+    if (ptrBit+bits > 8) data |= rev(pgm_read_byte(ptrAddr+1));
+    data <<= ptrBit;
+    uint8_t value = data >> (16-bits);
+    ptrBit += bits;
+    if (ptrBit >= 8) {
+      ptrBit -= 8;
+      ptrAddr++;
+    }
+    return value;
+  }
+
+  void ReadFrame() {
+    frames.push_back(samples_);
+    old_frame = new_frame;
+    if (!ptrAddr) {
+      new_frame.inited = false;
+      return;
+    }
+    new_frame.inited = true;
+    uint8_t energy = getBits(coeffs_->energy_bits);
+    if (energy == 0) {
+      new_frame.energy = 0;
+    } else if (energy == ((1 << coeffs_->energy_bits) - 1)) {
+      new_frame.energy = 0;
+      for (int i = 0; i < 10; i++) new_frame.k[i] = 0;
+      ptrAddr = NULL;
+    } else {
+      new_frame.energy = coeffs_->energytable[energy];
+      uint8_t repeat = getBits(1);
+      new_frame.period = coeffs_->pitchtable[getBits(coeffs_->pitch_bits)];
+      if (!repeat) {
+        for (int i = 0; i < 4; i++)
+          new_frame.k[i] = coeffs_->ktable[i][getBits(coeffs_->kbits[i])];
+        if (new_frame.period) {
+          for (int i = 4; i < 10; i++)
+            new_frame.k[i] = coeffs_->ktable[i][getBits(coeffs_->kbits[i])];
+        } else {
+          for (int i = 4; i < 10; i++)
+            new_frame.k[i] = 0;
+        }
+      }
+    }
+  }
+
+  int16_t Get8kHz() {
+    if (count_++ >= rate_) {
+      ReadFrame();
+      count_ = 0;
+    }
+    Frame f;
+    f.lerp(old_frame, new_frame, count_, rate_);
+
+    int32_t u[11];
+    if (f.period) {
+      if (periodCounter < f.period) {
+        periodCounter++;
+      } else {
+        periodCounter = 0;
+      }
+      if (periodCounter < MAX_CHIRP_SIZE) {
+        u[10] = ((coeffs_->chirptable[periodCounter]) * f.energy) >> 3;
+      } else {
+        u[10] = 0;
+      }
+    } else {
+      synthRand = (synthRand >> 1) ^ ((synthRand & 1) ? 0xB800 : 0);
+      u[10] = ((synthRand & 1) ? f.energy : -f.energy) << 3;
+    }
+
+    if (ideal_) {
+      double v[11];
+      v[10] = u[10];
+      for (int i = 9; i >= 0; i--) v[i] = v[i + 1] - f.k[i] * xd[i] / 512;
+      v[0] = std::max(-512.0, std::min(511.0, v[0]));
+      for (int i = 9; i > 0; i--) xd[i] = xd[i - 1] + f.k[i - 1] * v[i - 1] / 512;
+      xd[0] = v[0];
+      return lround(v[0] * 32);
+    }
+
+    for (int i = 9; i >= 0; i--) u[i] = u[i + 1] - ((f.k[i] * x[i]) >> 9);
+    if (u[0] > 511) u[0] = 511;
+    if (u[0] < -512) u[0] = -512;
+    for (int i = 9; i > 0; i--) x[i] = x[i - 1] + ((f.k[i - 1] * u[i - 1]) >> 9);
+    x[0] = u[0];
+
+    return u[0] << 5;
+  }
+
+  int16_t Get44kHz() {
+    int32_t sum =
+      A * lanc2_11[l_pos_] +
+      B * lanc2_11[l_pos_ + 11] +
+      C * lanc2_11[l_pos_ + 22] +
+      D * lanc2_11[l_pos_ + 33];
+    l_pos_ += 2;
+    if (l_pos_ >= 11) {
+      l_pos_ -= 11;
+      D = C; C = B; B = A;
+      A = Get8kHz();
+    }
+    return clamptoi16(sum >> 14);
+  }
+
+  const uint8_t* ptrAddr = NULL;
+  uint32_t rate_ = 0;
+  uint8_t ptrBit = 0;
+  const tms5100_coeffs* coeffs_;
+  Frame new_frame, old_frame;
+  uint8_t count_ = 0;
+  uint8_t periodCounter = 0;
+  int32_t x[10];
+  bool ideal_;
+  double xd[10] = {};
+  uint16_t synthRand = 1;
+  uint32_t l_pos_ = 0;
+  int16_t A = 0, B = 0, C = 0, D = 0;
+  size_t samples_ = 0;
+};
+
+struct Phrase {
+  const char* name;
+  const uint8_t* data;
+  uint32_t rate;
+};
+
+const Phrase phrases[] = {
+  { "zero", spZERO, 25 },
+  { "one", spONE, 25 },
+  { "two", spTWO, 25 },
+  { "three", spTHREE, 25 },
+  { "four", spFOUR, 25 },
+  { "five", spFIVE, 25 },
+  { "six", spSIX, 25 },
+  { "seven", spSEVEN, 25 },
+  { "eight", spEIGHT, 25 },
+  { "nine", spNINE, 25 },
+  { "error_in", talkie_error_in_15, 15 },
+  { "font_directory", talkie_font_directory_15, 15 },
+  { "not_found", talkie_not_found_15, 15 },
+  { "sd_card", talkie_sd_card_15, 15 },
+  { "blade_array", talkie_blade_array_15, 15 },
+  { "low_battery", talkie_low_battery_15, 15 },
+};
+
+template<class T>
+std::vector<int16_t> Render(T* t, uint64_t* ns) {
+  std::vector<int16_t> out;
+  int16_t buf[AUDIO_BUFFER_SIZE];
+  uint64_t start = host_nanos();
+  while (int n = t->read(buf, AUDIO_BUFFER_SIZE)) {
+    out.insert(out.end(), buf, buf + n);
+  }
+  *ns += host_nanos() - start;
+  return out;
+}
+
+// Root mean square of |v| in [begin, end), around |mean|.
+double RMS(const std::vector<int16_t>& v, size_t begin, size_t end, double mean) {
+  double sum = 0;
+  for (size_t i = begin; i < end; i++) sum += (v[i] - mean) * (v[i] - mean);
+  return sqrt(sum / (end - begin));
+}
+
+double Mean(const std::vector<int16_t>& v, size_t begin, size_t end) {
+  double sum = 0;
+  for (size_t i = begin; i < end; i++) sum += v[i];
+  return sum / (end - begin);
+}
+
+double Db(double x) { return 20 * log10(x); }
+
+// Frames more than this far below the loudest frame of the phrase are
+// onsets and tails, which are not compared.
+const double kRange = 20;   // dB
+
+// Level of frame [begin, end) of |v| after removing its mean, dB.
+double Level(const std::vector<int16_t>& v, size_t begin, size_t end) {
+  return Db(std::max(RMS(v, begin, end, Mean(v, begin, end)), 1.0));
+}
+
+// Globals, like talkie, so they start out zeroed.
+OldTalkie old_talkie, ideal(true);
+
+int main() {
+  std::string dir = TestDir("talkie");
+  int errors = 0;
+  uint64_t new_ns = 0, old_ns = 0, ideal_ns = 0, total_samples = 0;
+  int compared = 0, within1 = 0, within3 = 0;
+  double worst = 0;
+
+  for (const Phrase& p : phrases) {
+    talkie.Say(p.data, p.rate);
+    old_talkie.Say(p.data, p.rate);
+    ideal.Say(p.data, p.rate);
+    std::vector<int16_t> now = Render(&talkie, &new_ns);
+    std::vector<int16_t> was = Render(&old_talkie, &old_ns);
+    std::vector<int16_t> model = Render(&ideal, &ideal_ns);
+    total_samples += was.size();
+    WriteWav((dir + "/" + p.name + ".wav").c_str(), now);
+    WriteWav((dir + "/" + p.name + "_old.wav").c_str(), was);
+
+    // Same frames; the tail decays to zero a little sooner or later.
+    std::vector<size_t> bounds = old_talkie.frames;
+    size_t frame = (p.rate * 7 + 1) * AUDIO_RATE / 8000;
+    if (now.size() < bounds.back() || now.size() > was.size() + frame) {
+      STDOUT << "FAIL: " << p.name << ": " << now.size() << " samples, was "
+             << was.size() << "\n";
+      errors++;
+      continue;
+    }
+    bounds.push_back(std::min({now.size(), was.size(), model.size()}));
+
+    // A frame may differ from the old render by up to 3 dB, or by more if
+    // the old render was as far off from the double precision lattice.
+    // The lattice clamps its output, so rounding alone moves the level of
+    // a frame by a few dB at times.
+    std::vector<double> now_level, was_level, model_level;
+    for (size_t f = 0; f + 1 < bounds.size(); f++) {
+      size_t b = bounds[f], e = std::min(bounds[f + 1], bounds.back());
+      if (e < b + frame / 2) break;
+      now_level.push_back(Level(now, b, e));
+      was_level.push_back(Level(was, b, e));
+      model_level.push_back(Level(model, b, e));
+    }
+    double loudest = *std::max_element(was_level.begin(), was_level.end());
+    double phrase_worst = 0;
+    for (size_t f = 0; f < was_level.size(); f++) {
+      if (std::max(now_level[f], was_level[f]) < loudest - kRange) continue;
+      double d = now_level[f] - was_level[f];
+      compared++;
+      if (fabs(d) <= 1) within1++;
+      if (fabs(d) <= 3) within3++;
+      if (fabs(d) > fabs(phrase_worst)) phrase_worst = d;
+      if (fabs(d) > 3 &&
+          fabs(now_level[f] - model_level[f]) > fabs(was_level[f] - model_level[f]) + 1) {
+        STDOUT << "FAIL: " << p.name << " frame " << f << ": level " << d
+               << " dB from the old render, " << (now_level[f] - model_level[f])
+               << " dB from the double precision lattice\n";
+        errors++;
+      }
+    }
+    STDOUT << p.name << ": " << (bounds.size() - 1) << " frames, " << now.size()
+           << " samples (was " << was.size() << "), largest frame level difference "
+           << phrase_worst << " dB\n";
+    if (fabs(phrase_worst) > fabs(worst)) worst = phrase_worst;
+  }
+
+  STDOUT << compared << " frames compared: " << (within1 * 100.0 / compared)
+         << "% within 1 dB, " << (within3 * 100.0 / compared) << "% within 3 dB, largest difference " << worst << " dB\n";
+  STDOUT << "ns per 44.1kHz sample: " << (double)new_ns / total_samples
+         << ", was " << (double)old_ns / total_samples << "\n";
+  if (within1 < compared * 0.9) {
+    STDOUT << "FAIL: fewer than 90% of the frames within 1 dB\n";
+    errors++;
+  }
+  STDOUT << "renders in " << dir.c_str() << "\n";
+
+  if (errors) return 1;
+  STDOUT << "talkie_test: OK\n";
+  return 0;
+}
@@ -0,0 +1,38 @@
+#ifndef TESTS_TEST_WAV_H
+#define TESTS_TEST_WAV_H
+
+// Writes 16-bit PCM WAV files for the host tests.
+
+#include <string>
+#include <vector>
+
+void WriteWav(const char* path, const int16_t* samples, size_t n,
+              uint32_t rate = AUDIO_RATE, int channels = 1) {
+  FILE* f = fopen(path, "wb");
+  if (!f) { perror(path); exit(1); }
+  uint32_t data_bytes = n * 2;
+  uint32_t header[11] = {
+    0x46464952, 36 + data_bytes, 0x45564157,     // RIFF, size, WAVE
+    0x20746d66, 16,                               // "fmt ", 16 bytes
+    1u | (channels << 16), rate,                  // PCM, channels
+    rate * 2 * channels, (2u * channels) | (16 << 16),
+    0x61746164, data_bytes };                     // "data", size
+  fwrite(header, 1, sizeof(header), f);
+  fwrite(samples, 2, n, f);
+  fclose(f);
+}
+
+void WriteWav(const char* path, const std::vector<int16_t>& samples,
+              uint32_t rate = AUDIO_RATE) {
+  WriteWav(path, samples.data(), samples.size(), rate);
+}
+
+// A fresh, empty directory under /tmp.
+std::string TestDir(const char* name) {
+  std::string dir = std::string("/tmp/proffie_") + name;
+  std::string cmd = "rm -rf " + dir + " && mkdir -p " + dir;
+  if (system(cmd.c_str()) != 0) exit(1);
+  return dir;
+}
+
+#endif  // TESTS_TEST_WAV_H
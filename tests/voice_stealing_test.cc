@@ -0,0 +1,127 @@
+// Voice stealing under bursts of overlapping clashes, blasts and swings,
+// on top of a hum that is held the whole time. Reports how many requests
+// found every player busy, and how many of those were stolen or dropped.
+// A request may only be dropped when no player of the same or a lower
+// priority was playing, the hum is never taken, and the stolen sounds
+// fade out instead of stopping on a click.
+
+#define VOICE_STEALING 1
+#include "host.h"
+#include "test_wav.h"
+
+int errors = 0;
+
+void Expect(bool ok, const char* what, double got) {
+  if (ok) return;
+  STDOUT << "FAIL: " << what << ": " << got << "\n";
+  errors++;
+}
+
+// Slow sines that start and end on 5 ms ramps, so a sound cut off in the
+// middle is a jump far larger than anything the mix does from one sample
+// to the next.
+const double kStep = 0.01;    // radians per sample
+const int kAmplitude = 3000;
+const int kRamp = AUDIO_RATE / 200;
+
+int16_t out[AUDIO_BUFFER_SIZE];
+int16_t last = 0;
+int largest_jump = 0;
+
+void Tick() {
+  dynamic_mixer.read(out, AUDIO_BUFFER_SIZE);
+  for (int i = 0; i < AUDIO_BUFFER_SIZE; i++) {
+    largest_jump = std::max(largest_jump, abs(out[i] - last));
+    last = out[i];
+  }
+  host_advance_micros(AUDIO_BUFFER_SIZE * 1000000ull / AUDIO_RATE);
+}
+
+void RunMs(int ms) {
+  for (int i = 0; i < ms * AUDIO_RATE / 1000 / AUDIO_BUFFER_SIZE; i++) Tick();
+}
+
+int requests = 0, all_busy = 0, stealable = 0, wrongly_dropped = 0;
+
+void Play(Effect* effect, MixerBus bus) {
+  requests++;
+  uint8_t priority = WavPlayerPriority(bus);
+  bool any_free = false, any_victim = false;
+  for (size_t i = 0; i < NELEM(wav_players); i++) {
+    BufferedWavPlayer* p = wav_players + i;
+    if (p->Available()) any_free = true;
+    if (!p->refs() && p->isPlaying() && p->priority() <= priority &&
+        p->priority() < kWavPlayerNotStolen) {
+      any_victim = true;
+    }
+  }
+  if (!any_free) all_busy++;
+  if (!any_free && any_victim) stealable++;
+  RefPtr<BufferedWavPlayer> p = GetFreeWavPlayer(false, bus);
+  if (!p) {
+    if (any_victim) wrongly_dropped++;
+    return;
+  }
+  p->PlayOnce(effect);
+}
+
+int main() {
+  std::string dir = TestDir("voice_stealing");
+  auto tone = [](int ms) {
+    std::vector<int16_t> v(AUDIO_RATE * ms / 1000);
+    for (size_t i = 0; i < v.size(); i++) {
+      int edge = std::min<int>(i, v.size() - 1 - i);
+      v[i] = kAmplitude * std::min(1.0, (double)edge / kRamp) * sin(i * kStep);
+    }
+    return v;
+  };
+  WriteWav((dir + "/hum.wav").c_str(), tone(1000));
+  WriteWav((dir + "/swng.wav").c_str(), tone(400));
+  WriteWav((dir + "/clsh.wav").c_str(), tone(300));
+  WriteWav((dir + "/blst.wav").c_str(), tone(200));
+  MakeDirectoryList(current_directory, dir.c_str());
+  Effect::ScanCurrentDirectory();
+  SetupStandardAudio();
+
+  RefPtr<BufferedWavPlayer> hum = GetFreeWavPlayer(true, BUS_HUM);
+  hum->PlayOnce(&SFX_hum);
+  hum->PlayLoop(&SFX_hum);
+  RunMs(100);
+
+  srand(1);
+  for (int burst = 0; burst < 300; burst++) {
+    int events = random(2, 10);
+    for (int e = 0; e < events; e++) {
+      switch (random(4)) {
+        case 0: Play(&SFX_swng, BUS_SWING); break;
+        case 1: Play(&SFX_blst, BUS_EFFECTS); break;
+        default: Play(&SFX_clsh, BUS_EFFECTS); break;
+      }
+      RunMs(random(3, 30));
+    }
+    RunMs(random(50, 400));
+  }
+  RunMs(500);
+
+  STDOUT << requests << " requests, " << all_busy << " found every player busy: "
+         << wav_players_stolen << " stolen, " << wav_players_dropped << " dropped\n";
+  STDOUT << "largest step between two output samples " << largest_jump
+         << ", a sound cut off takes up to " << kAmplitude << "\n";
+
+  Expect(all_busy > requests / 10, "requests that found every player busy", all_busy);
+  Expect(wav_players_stolen == (uint32_t)stealable, "players stolen", wav_players_stolen);
+  Expect(wav_players_stolen + wav_players_dropped == (uint32_t)all_busy,
+         "stolen and dropped", wav_players_stolen + wav_players_dropped);
+  Expect(wrongly_dropped == 0, "dropped with a player to steal", wrongly_dropped);
+  Expect(hum->isPlaying() && hum->current_file_id().GetEffect() == &SFX_hum,
+         "hum still playing", hum->isPlaying());
+  Expect(largest_jump < kAmplitude / 3, "largest step between two output samples", largest_jump);
+
+  hum->Stop();
+  RunMs(10);
+  Expect(stolen_voice_fade.eof(), "fade done", 0);
+
+  if (errors) return 1;
+  STDOUT << "voice_stealing_test: OK\n";
+  return 0;
+}
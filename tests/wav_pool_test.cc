@@ -0,0 +1,131 @@
+// The wav buffer pool: a few seconds of hum, swings, a track and bursts
+// of clashes and blasts, with loop() running between mixer blocks. Every
+// sound gets buffers, they all go back to the pool once the sounds are
+// done, and the high water mark shows how much of the pool was needed.
+
+#define WAV_BUFFER_POOL 1
+#include "host.h"
+#include "test_wav.h"
+
+int errors = 0;
+
+void Expect(bool ok, const char* what, double got) {
+  if (ok) return;
+  STDOUT << "FAIL: " << what << ": " << got << "\n";
+  errors++;
+}
+
+// What the fixed per-player buffers take without the pool.
+const size_t kFixed =
+  NUM_LONG_WAV_PLAYERS * (LONG_AUDIO_BUFFER_SIZE * 2 + LONG_AUDIO_READ_SIZE) +
+  (NUM_WAV_PLAYERS - NUM_LONG_WAV_PLAYERS) * (AUDIO_BUFFER_SIZE_BYTES * 2 + AUDIO_READ_SIZE);
+
+int16_t out[AUDIO_BUFFER_SIZE];
+
+// Most bytes the players that were playing needed at the same time.
+size_t needed = 0;
+void NoteNeeded() {
+  size_t n = 0;
+  for (size_t i = 0; i < NELEM(wav_players); i++) {
+    if (wav_players[i].Available()) continue;
+    n += wav_players[i].buffer_size() * sizeof(int16_t) + wav_players[i].read_size();
+  }
+  needed = std::max(needed, n);
+}
+
+// One mixer block, and the pool's part of loop().
+void Tick() {
+  dynamic_mixer.read(out, AUDIO_BUFFER_SIZE);
+  host_advance_micros(AUDIO_BUFFER_SIZE * 1000000ull / AUDIO_RATE);
+  wav_buffer_reclaimer.Loop();
+}
+
+void RunMs(int ms) {
+  for (int i = 0; i < ms * AUDIO_RATE / 1000 / AUDIO_BUFFER_SIZE; i++) Tick();
+}
+
+int missing = 0;
+
+void Play(Effect* effect, bool long_sound, MixerBus bus, bool loop = false) {
+  RefPtr<BufferedWavPlayer> p = GetFreeWavPlayer(long_sound, bus);
+  if (!p) {
+    missing++;
+    return;
+  }
+  p->PlayOnce(effect);
+  if (loop) p->PlayLoop(effect);
+  NoteNeeded();
+}
+
+int main() {
+  std::string dir = TestDir("wav_pool");
+  auto tone = [](int ms) {
+    std::vector<int16_t> v(AUDIO_RATE * ms / 1000);
+    for (size_t i = 0; i < v.size(); i++) v[i] = 3000 * sin(i * 0.05);
+    return v;
+  };
+  WriteWav((dir + "/hum.wav").c_str(), tone(1000));
+  WriteWav((dir + "/swingl.wav").c_str(), tone(1000));
+  WriteWav((dir + "/swingh.wav").c_str(), tone(1000));
+  WriteWav((dir + "/boot.wav").c_str(), tone(3000));   // stands in for a track
+  WriteWav((dir + "/clsh.wav").c_str(), tone(300));
+  WriteWav((dir + "/blst.wav").c_str(), tone(200));
+  MakeDirectoryList(current_directory, dir.c_str());
+  Effect::ScanCurrentDirectory();
+  SetupStandardAudio();
+
+  STDOUT << "pool " << wav_buffer_pool.size() << " bytes, fixed buffers "
+         << kFixed << " bytes\n";
+
+  Play(&SFX_boot, true, BUS_TRACK);
+  Play(&SFX_hum, true, BUS_HUM, true);
+  Play(&SFX_swingl, true, BUS_SWING, true);
+  Play(&SFX_swingh, true, BUS_SWING, true);
+  RunMs(200);
+  srand(1);
+  for (int i = 0; i < 12; i++) {
+    Play(&SFX_clsh, false, BUS_EFFECTS);
+    RunMs(100 + random(300));
+  }
+  RunMs(300);
+  for (int burst = 0; burst < 3; burst++) {
+    for (int i = 0; i < 4; i++) {
+      Play(&SFX_blst, false, BUS_EFFECTS);
+      RunMs(40);
+    }
+    RunMs(300);
+  }
+  size_t playing_high_water = wav_buffer_pool.high_water();
+
+  for (size_t i = 0; i < NELEM(wav_players); i++) wav_players[i].Stop();
+  RunMs(10);
+  STDOUT << "high water " << playing_high_water << " bytes, for sounds that needed "
+         << needed << " bytes, "
+         << wav_buffer_pool.used() << " bytes in use after everything stopped, "
+         << missing << " sounds without a player\n";
+  wav_buffer_pool.DumpStats();
+
+  Expect(missing == 0, "sounds without a player", missing);
+  Expect(wav_buffer_pool.used() == 0, "bytes still held after all sounds stopped",
+         wav_buffer_pool.used());
+  Expect(playing_high_water == needed, "high water, bytes", playing_high_water);
+  Expect(playing_high_water < kFixed, "high water, bytes", playing_high_water);
+  for (size_t i = 0; i < NELEM(wav_players); i++) {
+    Expect(!wav_players[i].has_buffers(), "stopped player with buffers", i);
+  }
+
+  // A short sound right after a long one on the same player gets the
+  // short buffers, not the long ones the player used to have.
+  Play(&SFX_hum, true, BUS_HUM);
+  RunMs(10);
+  for (size_t i = 0; i < NELEM(wav_players); i++) wav_players[i].Stop();
+  RunMs(10);
+  Play(&SFX_clsh, false, BUS_EFFECTS);
+  RunMs(10);
+  size_t used = wav_buffer_pool.used();
+  Expect(used == AUDIO_BUFFER_SIZE_BYTES * 2 + AUDIO_READ_SIZE, "bytes for one clash", used);
+
+  if (errors) return 1;
+  STDOUT << "wav_pool_test: OK\n";
+  return 0;
+}